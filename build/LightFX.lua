@@ -56,6 +56,9 @@ project "LightFX"
 	filter { "platforms:Win64", "configurations:Release"  }
 		-- tbb release
 		links { "tbb", "tbbmalloc", "tbbmalloc_proxy" }
+	filter { "platforms:Linux" }
+		-- embree 3/4 from the system packages
+		links { "embree" .. _OPTIONS["embree"], "pthread" }
 	filter{}
 	
 project "uvunwrap"
@@ -137,6 +140,9 @@ project "hm2terrain"
 	filter { "platforms:Win64", "configurations:Release"  }
 		-- tbb release
 		links { "tbb", "tbbmalloc", "tbbmalloc_proxy" }
+	filter { "platforms:Linux" }
+		-- embree 3/4 from the system packages
+		links { "embree" .. _OPTIONS["embree"], "pthread" }
 	filter{}
 
 
@@ -195,4 +201,7 @@ project "cc2ext"
 	filter { "platforms:Win64", "configurations:Release"  }
 		-- tbb release
 		links { "tbb", "tbbmalloc", "tbbmalloc_proxy" }
+	filter { "platforms:Linux" }
+		-- embree 3/4 from the system packages
+		links { "embree" .. _OPTIONS["embree"], "pthread" }
 	filter{}
\ No newline at end of file
@@ -9,6 +9,13 @@ solution "LightFX"
 	-- 	configurations { _OPTIONS["build"] }
 	-- end
 
+	newoption {
+		trigger = "embree",
+		value = "VERSION",
+		description = "Embree major version used on linux (3 or 4)",
+		default = "3",
+	}
+
 	--windows configure
 	filter {"system:windows"}
 		platforms { "Win64" }
@@ -80,7 +87,26 @@ solution "LightFX"
 		libdirs {
 			"../vcpkg/installed/uni-osx/lib",
 		}
-		
+
+	-- linux configure
+	filter {"system:linux"}
+		platforms { "Linux" }
+		system "linux"
+		architecture "x64"
+		defines { "LFX_EMBREE_VERSION=" .. _OPTIONS["embree"] }
+
+	filter { "system:linux", "configurations:Debug" }
+		symbols "On"
+		targetdir "bin/Debug"
+		debugdir "bin/Debug"
+		defines { "DEBUG", "_DEBUG" }
+
+	filter { "system:linux", "configurations:Release" }
+		optimize "On"
+		debugdir "bin/Release"
+		targetdir "bin/Release"
+		defines { "NDEBUG" }
+
 	filter {}
 
 require "./LightFX"
@@ -155,16 +155,33 @@ namespace LFX {
 #endif
 
 	Float3 AOBaker::Calc(const Vertex& v, int flags, void* entity)
+	{
+		if (World::Instance()->GetSetting()->AORadius <= 0) {
+			return Float3(1, 1, 1);
+		}
+
+		return ToColor(CalcOcclusion(v, flags, entity));
+	}
+
+	Float3 AOBaker::ToColor(float occlusion)
+	{
+		const auto* settings = World::Instance()->GetSetting();
+
+		float ao = 1.0f - Clamp(occlusion, 0.0f, 1.0f);
+		ao = std::powf(ao, settings->AOStrength);
+
+		return Float3::Lerp(settings->AOColor, Float3(1, 1, 1), ao);
+	}
+
+	float AOBaker::CalcOcclusion(const Vertex& v, int flags, void* entity)
 	{
 		const auto* settings = World::Instance()->GetSetting();
-		const float strength = settings->AOStrength;
 		const float radius = settings->AORadius;
 		const float slope = 180.0f;
-		const int32 samples = settings->AOLevel == 1 ? 15 * 15 : 25 * 25;
-		const Float3 color = settings->AOColor;
+		const int32 maxSamples = settings->AOLevel == 1 ? 15 * 15 : 25 * 25;
 
 		if (radius <= 0) {
-			return Float3(1, 1, 1);
+			return 0;
 		}
 
 		Mat3 tangentToWorld;
@@ -172,45 +189,77 @@ namespace LFX {
 		tangentToWorld.SetYBasis(v.Binormal);
 		tangentToWorld.SetZBasis(v.Normal);
 
-		float ao = 0;
+		Scene* scene = World::Instance()->GetScene();
 		const float hr = radius / 2;
 		const float hs = slope / 2;
-		for (int s = 0; s < samples; ++s) {
-			Float2 rd = Random.RandomFloat2();
+		// one sobol sequence per texel, the random generator only decorrelates the texels
+		const uint32 seed = Random.RandomUint();
+
+		Ray rays[kPassSamples];
+		Ray hitRays[kPassSamples];
+		float lens[kPassSamples];
+		bool occluded[kPassSamples];
+		bool hits[kPassSamples];
+		Contact contacts[kPassSamples];
+		for (int k = 0; k < kPassSamples; ++k) {
+			lens[k] = radius;
+		}
 
-			Float3 sampleDir;
-			sampleDir = ILBaker::SampleCosineHemisphere(rd.x, rd.y);
-			sampleDir = Mat3::Transform(sampleDir, tangentToWorld);
-			sampleDir = Float3::Normalize(sampleDir);
+		double sum = 0, sumSq = 0;
+		int samples = 0;
+		while (samples < maxSamples) {
+			const int count = std::min(maxSamples - samples, (int)kPassSamples);
+			for (int k = 0; k < count; ++k) {
+				Float2 rd = ILBaker::SampleSobol2D(samples + k, seed);
 
-			Ray ray;
-			ray.orig = v.Position + v.Normal * 0.01f;
-			ray.dir = sampleDir;
+				Float3 sampleDir;
+				sampleDir = ILBaker::SampleCosineHemisphere(rd.x, rd.y);
+				sampleDir = Mat3::Transform(sampleDir, tangentToWorld);
+				sampleDir = Float3::Normalize(sampleDir);
 
-			Contact contact;
-			if (!World::Instance()->GetScene()->RayCheck(contact, ray, radius, flags)) {
-				continue;
+				rays[k].orig = v.Position + v.Normal * 0.01f;
+				rays[k].dir = sampleDir;
 			}
 
-			if (contact.entity == entity) {
-				continue;
+			// most rays escape, only the occluded ones need the closest hit for its distance and normal
+			scene->OccludedBatch(occluded, rays, lens, count, flags);
+
+			int numHits = 0;
+			for (int k = 0; k < count; ++k) {
+				if (occluded[k]) {
+					hitRays[numHits++] = rays[k];
+				}
 			}
+			scene->RayCheckBatch(contacts, hits, hitRays, lens, numHits, flags);
+
+			for (int k = 0; k < numHits; ++k) {
+				const Contact& contact = contacts[k];
+				if (!hits[k] || contact.entity == entity) {
+					continue;
+				}
 
-			float ka = Clamp(contact.vhit.Normal.dot(-v.Normal), -1.0f, 1.0f);
-			ka = RadianToDegree(Acos(ka));
-			ka = (ka <= hs) ? 1.0f : (1 - std::min((ka - hs) / (slope - hs), 1.0f));
+				float ka = Clamp(contact.vhit.Normal.dot(-v.Normal), -1.0f, 1.0f);
+				ka = RadianToDegree(Acos(ka));
+				ka = (ka <= hs) ? 1.0f : (1 - std::min((ka - hs) / (slope - hs), 1.0f));
 
-			float kd = (contact.td <= hr) ? 1.0f : (1 - std::min((contact.td - hr) / (radius - hr), 1.0f));
-			kd = Clamp(kd, 0.0f, 1.0f);
+				float kd = (contact.td <= hr) ? 1.0f : (1 - std::min((contact.td - hr) / (radius - hr), 1.0f));
+				kd = Clamp(kd, 0.0f, 1.0f);
 
-			ao += ka * kd;
-		}
+				sum += ka * kd;
+				sumSq += ka * kd * ka * kd;
+			}
 
-		ao = ao / samples;
-		ao = 1.0f - Clamp(ao, 0.0f, 1.0f);
-		ao = std::powf(ao, strength);
+			samples += count;
+			if (samples >= kMinSamples) {
+				const double mean = sum / samples;
+				const double variance = std::max(sumSq / samples - mean * mean, 0.0);
+				if (std::sqrt(variance / samples) <= kMaxError) {
+					break;
+				}
+			}
+		}
 
-		return Float3::Lerp(color, Float3(1, 1, 1), ao);
+		return (float)(sum / samples);
 	}
 
 }
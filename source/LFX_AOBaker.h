@@ -9,11 +9,19 @@
 #include "LFX_Entity.h"
 #include "LFX_ILBakerRandom.h"
 #include "LFX_ILBakerSampling.h"
+#include "LFX_ILBakerSamples.h"
 
 namespace LFX {
 
 	class AOBaker
 	{
+	public:
+		// rays are traced in passes of kPassSamples, after kMinSamples a texel stops once the
+		// standard error of its occlusion is below kMaxError
+		static const int kPassSamples = 32;
+		static const int kMinSamples = 64;
+		static constexpr float kMaxError = 0.005f;
+
 	public:
 		AOBaker();
 		~AOBaker();
@@ -22,6 +30,13 @@ namespace LFX {
 
 		Float3 Calc(const Vertex& v, int flags, void* entity);
 
+		// weighted fraction of occluded rays in [0, 1]
+		float CalcOcclusion(const Vertex& v, int flags, void* entity);
+		// applies the strength and color settings to an occlusion
+		Float3 ToColor(float occlusion);
+
+		void SetSeed(unsigned int seed) { Random.SetSeed(seed); }
+
 	protected:
 		Float4 hd[29];
 		Float4 ld[13];
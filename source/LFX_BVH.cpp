@@ -0,0 +1,155 @@
+#include "LFX_BVH.h"
+
+namespace LFX {
+
+	static_assert(sizeof(BVH::Node) == 32, "BVH::Node should be 32 bytes");
+
+	static float _BVH_HalfArea(const Aabb& bound)
+	{
+		Float3 size = bound.Size();
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
+
+	BVH::BVH()
+	{
+	}
+
+	BVH::~BVH()
+	{
+	}
+
+	void BVH::Clear()
+	{
+		mNodes.clear();
+		mPrimitives.clear();
+	}
+
+	void BVH::Build(const std::vector<Aabb>& bounds)
+	{
+		Clear();
+		if (bounds.empty())
+			return;
+
+		std::vector<Float3> centers(bounds.size());
+		mPrimitives.resize(bounds.size());
+		for (size_t i = 0; i < bounds.size(); ++i) {
+			centers[i] = bounds[i].Center();
+			mPrimitives[i] = (int)i;
+		}
+
+		mNodes.reserve(bounds.size() * 2);
+		_build(bounds, centers, 0, (int)bounds.size(), 0);
+		mNodes.shrink_to_fit();
+	}
+
+	int BVH::_build(const std::vector<Aabb>& bounds, const std::vector<Float3>& centers, int first, int count, int depth)
+	{
+		const int index = (int)mNodes.size();
+		mNodes.push_back(Node());
+
+		Aabb bound, centerBound;
+		bound.Invalid();
+		centerBound.Invalid();
+		for (int i = first; i < first + count; ++i) {
+			bound.Merge(bounds[mPrimitives[i]]);
+			centerBound.Merge(centers[mPrimitives[i]]);
+		}
+
+		mNodes[index].minimum = bound.minimum;
+		mNodes[index].maximum = bound.maximum;
+
+		const Float3 extent = centerBound.Size();
+		auto binOf = [&](int prim, int axis) {
+			const float scale = kNumBins / extent[axis];
+			const int b = (int)((centers[prim][axis] - centerBound.minimum[axis]) * scale);
+			return std::min(b, kNumBins - 1);
+		};
+
+		// find the cheapest split, the cost of a leaf is the number of primitives
+		int bestAxis = -1;
+		int bestSplit = 0;
+		float bestCost = count * _BVH_HalfArea(bound);
+		for (int axis = 0; axis < 3 && count > 1 && depth < kMaxSAHDepth; ++axis) {
+			if (extent[axis] <= 0)
+				continue;
+
+			Aabb binBounds[kNumBins];
+			int binCounts[kNumBins];
+			for (int b = 0; b < kNumBins; ++b) {
+				binBounds[b].Invalid();
+				binCounts[b] = 0;
+			}
+
+			for (int i = first; i < first + count; ++i) {
+				const int prim = mPrimitives[i];
+				const int b = binOf(prim, axis);
+				binBounds[b].Merge(bounds[prim]);
+				binCounts[b] += 1;
+			}
+
+			float rightAreas[kNumBins];
+			int rightCounts[kNumBins];
+			Aabb acc;
+			acc.Invalid();
+			int n = 0;
+			for (int b = kNumBins - 1; b > 0; --b) {
+				acc.Merge(binBounds[b]);
+				n += binCounts[b];
+				rightAreas[b] = n > 0 ? _BVH_HalfArea(acc) : 0;
+				rightCounts[b] = n;
+			}
+
+			acc.Invalid();
+			n = 0;
+			for (int b = 0; b < kNumBins - 1; ++b) {
+				acc.Merge(binBounds[b]);
+				n += binCounts[b];
+				if (n == 0 || rightCounts[b + 1] == 0)
+					continue;
+
+				const float cost = _BVH_HalfArea(bound) + n * _BVH_HalfArea(acc) + rightCounts[b + 1] * rightAreas[b + 1];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b + 1;
+				}
+			}
+		}
+
+		if (bestAxis < 0 && count <= kMaxLeafSize) {
+			mNodes[index].offset = first;
+			mNodes[index].count = (uint16)count;
+			mNodes[index].axis = 0;
+			return index;
+		}
+
+		int* begin = &mPrimitives[first];
+		int* end = begin + count;
+		int mid = first + count / 2;
+		if (bestAxis >= 0) {
+			mid = (int)(std::partition(begin, end, [&](int prim) { return binOf(prim, bestAxis) < bestSplit; }) - &mPrimitives[0]);
+		}
+		else {
+			// leaf is too large but no split pays off, fall back to a median split
+			bestAxis = 0;
+			if (extent.y > extent[bestAxis])
+				bestAxis = 1;
+			if (extent.z > extent[bestAxis])
+				bestAxis = 2;
+
+			std::nth_element(begin, &mPrimitives[mid], end, [&](int a, int b) {
+				return centers[a][bestAxis] < centers[b][bestAxis];
+			});
+		}
+
+		mNodes[index].count = 0;
+		mNodes[index].axis = (uint16)bestAxis;
+
+		_build(bounds, centers, first, mid - first, depth + 1);
+		const int right = _build(bounds, centers, mid, first + count - mid, depth + 1);
+		mNodes[index].offset = right;
+
+		return index;
+	}
+
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "LFX_Math.h"
+
+namespace LFX {
+
+	// Flat bounding volume hierarchy built with the binned surface area heuristic.
+	// Nodes are stored depth first, the left child of an inner node is the next node.
+	class BVH
+	{
+	public:
+		struct Node
+		{
+			Float3 minimum;
+			int32 offset;	// leaf: first primitive, inner: right child
+			Float3 maximum;
+			uint16 count;	// leaf: number of primitives, inner: 0
+			uint16 axis;	// inner: split axis
+
+			bool IsLeaf() const { return count > 0; }
+			Aabb Bound() const { return Aabb(minimum, maximum); }
+		};
+
+		static const int kMaxLeafSize = 8;
+		static const int kNumBins = 16;
+		// SAH splits are only used up to this depth, deeper nodes split at the median,
+		// so the traversal stack is bounded.
+		static const int kMaxSAHDepth = 64;
+		static const int kStackSize = 128;
+
+	public:
+		BVH();
+		~BVH();
+
+		void Clear();
+		// primitive i is bounded by bounds[i]
+		void Build(const std::vector<Aabb>& bounds);
+
+		bool Valid() const { return !mNodes.empty(); }
+		int NumOfNodes() const { return (int)mNodes.size(); }
+		const Node& GetNode(int i) const { return mNodes[i]; }
+		int GetPrimitive(int i) const { return mPrimitives[i]; }
+
+		// Closest hit traversal, the nearer child is visited first and the far child is culled
+		// once tmax shrinks. leaf(first, count) intersects the primitives and returns the new tmax.
+		template <class LeafFunc>
+		void RayCheck(const Ray& ray, float tmax, LeafFunc leaf) const;
+
+		// Any hit traversal, leaf(first, count) returns true if a primitive occludes the ray.
+		template <class LeafFunc>
+		bool Occluded(const Ray& ray, float tmax, LeafFunc leaf) const;
+
+		static bool _intersect(const Node& node, const Float3& orig, const Float3& invDir, float tmax, float& tnear)
+		{
+			float t0 = 0, t1 = tmax;
+			for (int k = 0; k < 3; ++k) {
+				float tn = (node.minimum[k] - orig[k]) * invDir[k];
+				float tf = (node.maximum[k] - orig[k]) * invDir[k];
+				if (tn > tf)
+					std::swap(tn, tf);
+
+				t0 = tn > t0 ? tn : t0;
+				t1 = tf < t1 ? tf : t1;
+				if (t0 > t1)
+					return false;
+			}
+
+			tnear = t0;
+			return true;
+		}
+
+	protected:
+		int _build(const std::vector<Aabb>& bounds, const std::vector<Float3>& centers, int first, int count, int depth);
+
+	protected:
+		std::vector<Node> mNodes;
+		std::vector<int> mPrimitives;
+	};
+
+	template <class LeafFunc>
+	void BVH::RayCheck(const Ray& ray, float tmax, LeafFunc leaf) const
+	{
+		struct Entry { int node; float tnear; };
+
+		const Float3 invDir(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+		const bool dirNeg[3] = { ray.dir.x < 0, ray.dir.y < 0, ray.dir.z < 0 };
+
+		Entry stack[kStackSize];
+		int top = 0;
+
+		float tnear;
+		if (mNodes.empty() || !_intersect(mNodes[0], ray.orig, invDir, tmax, tnear))
+			return;
+
+		stack[top++] = { 0, tnear };
+		while (top > 0) {
+			const Entry entry = stack[--top];
+			if (entry.tnear > tmax)
+				continue;
+
+			const Node& node = mNodes[entry.node];
+			if (node.IsLeaf()) {
+				tmax = leaf(node.offset, node.count);
+				continue;
+			}
+
+			// the left child holds the lower half of the split axis
+			int nearChild = entry.node + 1;
+			int farChild = node.offset;
+			if (dirNeg[node.axis])
+				std::swap(nearChild, farChild);
+
+			float tfar;
+			if (_intersect(mNodes[farChild], ray.orig, invDir, tmax, tfar))
+				stack[top++] = { farChild, tfar };
+			if (_intersect(mNodes[nearChild], ray.orig, invDir, tmax, tnear))
+				stack[top++] = { nearChild, tnear };
+		}
+	}
+
+	template <class LeafFunc>
+	bool BVH::Occluded(const Ray& ray, float tmax, LeafFunc leaf) const
+	{
+		const Float3 invDir(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+
+		int stack[kStackSize];
+		int top = 0;
+
+		if (!mNodes.empty())
+			stack[top++] = 0;
+
+		while (top > 0) {
+			const Node& node = mNodes[stack[--top]];
+
+			float tnear;
+			if (!_intersect(node, ray.orig, invDir, tmax, tnear))
+				continue;
+
+			if (node.IsLeaf()) {
+				if (leaf(node.offset, node.count))
+					return true;
+				continue;
+			}
+
+			stack[top++] = node.offset;
+			stack[top++] = (int)(&node - &mNodes[0]) + 1;
+		}
+
+		return false;
+	}
+
+}
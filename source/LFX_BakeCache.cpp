@@ -0,0 +1,477 @@
+#include "LFX_BakeCache.h"
+#include "LFX_World.h"
+#include "LFX_Stream.h"
+
+namespace LFX {
+
+	static const int LFX_CACHE_VERSION = 0x0001;
+
+	BakeCache::BakeCache()
+	{
+		mSceneHash = 0;
+		mSettingHash = 0;
+		mGILightHash = 0;
+	}
+
+	BakeCache::~BakeCache()
+	{
+	}
+
+	bool BakeCache::Load(const String& filename)
+	{
+		mEntries.clear();
+
+		FileStream stream(filename.c_str());
+		if (!stream.IsOpen()) {
+			return false;
+		}
+
+		int version = 0, count = 0;
+		stream >> version;
+		stream >> count;
+		if (version != LFX_CACHE_VERSION) {
+			LOGW("Bake cache '%s' is out of date", filename.c_str());
+			return false;
+		}
+
+		for (int i = 0; i < count; ++i) {
+			uint64 hash = 0;
+			int numValues = 0, numCoefs = 0;
+
+			Entry entry;
+			stream >> hash;
+			stream >> numValues;
+			entry.lightmap.resize(numValues);
+			if (numValues > 0) {
+				stream.Read(&entry.lightmap[0], numValues * sizeof(LightmapValue));
+			}
+			stream >> numCoefs;
+			entry.coefficients.resize(numCoefs);
+			if (numCoefs > 0) {
+				stream.Read(&entry.coefficients[0], numCoefs * sizeof(Float3));
+			}
+
+			if (stream.IsEOF() && i < count - 1) {
+				LOGW("Bake cache '%s' is truncated", filename.c_str());
+				mEntries.clear();
+				return false;
+			}
+
+			mEntries[hash] = entry;
+		}
+
+		LOGI("-: Bake cache entries %d", (int)mEntries.size());
+		return true;
+	}
+
+	bool BakeCache::Save(const String& filename)
+	{
+		FILE* fp = fopen(filename.c_str(), "wb");
+		if (fp == NULL) {
+			LOGE("Can not open file '%s'", filename.c_str());
+			return false;
+		}
+
+		const int count = (int)mResults.size();
+		fwrite(&LFX_CACHE_VERSION, sizeof(int), 1, fp);
+		fwrite(&count, sizeof(int), 1, fp);
+		for (const auto& it : mResults) {
+			const Entry& entry = it.second;
+			const int numValues = (int)entry.lightmap.size();
+			const int numCoefs = (int)entry.coefficients.size();
+
+			fwrite(&it.first, sizeof(uint64), 1, fp);
+			fwrite(&numValues, sizeof(int), 1, fp);
+			fwrite(entry.lightmap.data(), sizeof(LightmapValue), numValues, fp);
+			fwrite(&numCoefs, sizeof(int), 1, fp);
+			fwrite(entry.coefficients.data(), sizeof(Float3), numCoefs, fp);
+		}
+
+		fclose(fp);
+		return true;
+	}
+
+	void BakeCache::Prepare()
+	{
+		const auto* settings = World::Instance()->GetSetting();
+		auto* env = World::Instance()->GetEnvironment();
+
+		// only the settings used by the bake, the output format is applied when saving
+		Hasher settingHash;
+		settingHash.Add(settings->Selected);
+		settingHash.Add(settings->Ambient);
+		settingHash.Add(settings->SkyRadiance);
+		settingHash.Add(settings->MSAA);
+		settingHash.Add(settings->GIScale);
+		settingHash.Add(settings->GISamples);
+		settingHash.Add(settings->GIPathLength);
+		settingHash.Add(settings->GIProgressive);
+		settingHash.Add(settings->GINoiseThreshold);
+		settingHash.Add(settings->GITimeBudget);
+		settingHash.Add(settings->GIRussianRouletteDepth);
+		settingHash.Add(settings->GIRussianRouletteProbability);
+		settingHash.Add(settings->GIIrradianceCache);
+		settingHash.Add(settings->GIIrradianceCacheError);
+		settingHash.Add(settings->GIRadianceCache);
+		settingHash.Add(settings->GIRadianceCacheVoxel);
+		settingHash.Add(settings->GIProbeScale);
+		settingHash.Add(settings->GIProbeSamples);
+		settingHash.Add(settings->GIProbePathLength);
+		settingHash.Add(settings->ProbeEncoding);
+		settingHash.Add(settings->ProbeOctahedralSize);
+		settingHash.Add(settings->AOLevel);
+		settingHash.Add(settings->AOStrength);
+		settingHash.Add(settings->AORadius);
+		settingHash.Add(settings->AOColor);
+		settingHash.Add(settings->Filter);
+		settingHash.Add(settings->Denoise);
+		settingHash.Add(settings->DenoiseIterations);
+		settingHash.Add(env->SkyColor);
+		settingHash.Add(env->GroundColor);
+		settingHash.Add(env->SkyIllum);
+		mSettingHash = settingHash.value;
+
+		Hasher giLightHash;
+		for (auto* light : World::Instance()->GetLights()) {
+			if (light->GIEnable) {
+				giLightHash.Add(_lightHash(light));
+			}
+		}
+		mGILightHash = giLightHash.value;
+
+		Hasher sceneHash;
+		mMeshHashes.clear();
+		mMeshBounds.clear();
+		for (auto* mesh : World::Instance()->GetMeshes()) {
+			mMeshHashes.push_back(_meshHash(mesh));
+			mMeshBounds.push_back(mesh->GetBound());
+			sceneHash.Add(mMeshHashes.back());
+		}
+
+		mTerrainHashes.clear();
+		mTerrainBounds.clear();
+		for (auto* terrain : World::Instance()->GetTerrains()) {
+			Aabb bound;
+			bound.Invalid();
+			for (const auto& v : terrain->_getVertexBuffer()) {
+				bound.Merge(v.Position);
+			}
+
+			mTerrainHashes.push_back(_terrainHash(terrain));
+			mTerrainBounds.push_back(bound);
+			sceneHash.Add(mTerrainHashes.back());
+		}
+		mSceneHash = sceneHash.value;
+	}
+
+	uint64 BakeCache::GetTaskHash(Entity* entity, int index)
+	{
+		const auto* settings = World::Instance()->GetSetting();
+
+		bool hasLightForGI = false;
+		for (auto* light : World::Instance()->GetLights()) {
+			if (light->GIEnable) {
+				hasLightForGI = true;
+				break;
+			}
+		}
+
+		std::vector<Light*> lights;
+		const float aoRadius = settings->AOLevel > 0 ? settings->AORadius : 0;
+
+		if (entity->GetType() == LFX_MESH) {
+			const auto& meshes = World::Instance()->GetMeshes();
+			const int i = (int)(std::find(meshes.begin(), meshes.end(), (Mesh*)entity) - meshes.begin());
+			Mesh* pMesh = (Mesh*)entity;
+
+			for (auto* light : World::Instance()->GetLights()) {
+				if (IsLightVisible(light, pMesh->GetBound())) {
+					lights.push_back(light);
+				}
+			}
+
+			return _dependencyHash(mMeshHashes[i], mMeshBounds[i], lights,
+				hasLightForGI && settings->GIScale > 0, aoRadius);
+		}
+		else if (entity->GetType() == LFX_TERRAIN) {
+			const auto& terrains = World::Instance()->GetTerrains();
+			const int t = (int)(std::find(terrains.begin(), terrains.end(), (Terrain*)entity) - terrains.begin());
+			Terrain* pTerrain = (Terrain*)entity;
+
+			const int xblock = index % pTerrain->GetDesc().BlockCount.x;
+			const int yblock = index / pTerrain->GetDesc().BlockCount.x;
+			const float blockSize = pTerrain->GetDesc().Dimension.x / pTerrain->GetDesc().BlockCount.x;
+
+			Aabb bound = mTerrainBounds[t];
+			bound.minimum.x = pTerrain->GetDesc().Position.x + xblock * blockSize;
+			bound.minimum.z = pTerrain->GetDesc().Position.z + yblock * blockSize;
+			bound.maximum.x = bound.minimum.x + blockSize;
+			bound.maximum.z = bound.minimum.z + blockSize;
+
+			for (auto* light : World::Instance()->GetLights()) {
+				if (IsLightVisible(light, bound)) {
+					lights.push_back(light);
+				}
+			}
+
+			Hasher self;
+			self.Add(mTerrainHashes[t]);
+			self.Add(index);
+			return _dependencyHash(self.value, bound, lights,
+				hasLightForGI && settings->GIScale > 0, aoRadius);
+		}
+		else if (entity->GetType() == LFX_SHPROBE) {
+			SHProbe* pProbe = (SHProbe*)entity;
+
+			for (auto* light : World::Instance()->GetLights()) {
+				if (IsLightVisible(light, pProbe->position)) {
+					lights.push_back(light);
+				}
+			}
+
+			Hasher self;
+			self.Add(pProbe->position);
+			self.Add(pProbe->normal);
+			return _dependencyHash(self.value, Aabb(pProbe->position, pProbe->position), lights,
+				hasLightForGI && settings->GIProbeScale > 0, 0);
+		}
+
+		return 0;
+	}
+
+	bool BakeCache::Restore(Entity* entity, int index, uint64 hash)
+	{
+		auto it = mEntries.find(hash);
+		if (it == mEntries.end()) {
+			return false;
+		}
+
+		const Entry& entry = it->second;
+		if (entity->GetType() == LFX_MESH) {
+			auto& lmap = ((Mesh*)entity)->_getLightingMap();
+			if (entry.lightmap.size() != lmap.size()) {
+				return false;
+			}
+
+			lmap = entry.lightmap;
+		}
+		else if (entity->GetType() == LFX_TERRAIN) {
+			Terrain* pTerrain = (Terrain*)entity;
+			const int mapSize = pTerrain->GetDesc().LMapSize - Terrain::kLMapBorder * 2;
+			if (entry.lightmap.size() != mapSize * mapSize) {
+				return false;
+			}
+
+			const int xblock = index % pTerrain->GetDesc().BlockCount.x;
+			const int yblock = index / pTerrain->GetDesc().BlockCount.x;
+			std::copy(entry.lightmap.begin(), entry.lightmap.end(), pTerrain->_getLightingMap(xblock, yblock));
+		}
+		else if (entity->GetType() == LFX_SHPROBE) {
+			if (entry.coefficients.empty()) {
+				return false;
+			}
+
+			((SHProbe*)entity)->coefficients = entry.coefficients;
+		}
+		else {
+			return false;
+		}
+
+		mResults[hash] = entry;
+		return true;
+	}
+
+	void BakeCache::Store(Entity* entity, int index, uint64 hash)
+	{
+		Entry& entry = mResults[hash];
+
+		if (entity->GetType() == LFX_MESH) {
+			entry.lightmap = ((Mesh*)entity)->_getLightingMap();
+		}
+		else if (entity->GetType() == LFX_TERRAIN) {
+			Terrain* pTerrain = (Terrain*)entity;
+			const int mapSize = pTerrain->GetDesc().LMapSize - Terrain::kLMapBorder * 2;
+			const int xblock = index % pTerrain->GetDesc().BlockCount.x;
+			const int yblock = index / pTerrain->GetDesc().BlockCount.x;
+
+			const LightmapValue* lmap = pTerrain->_getLightingMap(xblock, yblock);
+			entry.lightmap.assign(lmap, lmap + mapSize * mapSize);
+		}
+		else if (entity->GetType() == LFX_SHPROBE) {
+			entry.coefficients = ((SHProbe*)entity)->coefficients;
+		}
+	}
+
+	uint64 BakeCache::_meshHash(Mesh* mesh)
+	{
+		Hasher h;
+		h.Add(mesh->GetLightingMapSize());
+		h.Add(mesh->GetCastShadow());
+		h.Add(mesh->GetRecieveShadow());
+
+		Mesh* geometry = mesh;
+		if (mesh->IsInstance()) {
+			geometry = mesh->GetSource();
+			h.Add(mesh->GetTransform());
+		}
+
+		const auto& vertices = geometry->_getVertexBuffer();
+		for (const auto& v : vertices) {
+			h.Add(v.Position);
+			h.Add(v.Normal);
+			h.Add(v.UV);
+			h.Add(v.LUV);
+		}
+
+		const auto& triangles = geometry->_getTriangleBuffer();
+		if (!triangles.empty()) {
+			h.Update(&triangles[0], triangles.size() * sizeof(Triangle));
+		}
+
+		for (const auto& mtl : geometry->_getMaterialBuffer()) {
+			h.Add(_materialHash(mtl));
+		}
+
+		return h.value;
+	}
+
+	uint64 BakeCache::_terrainHash(Terrain* terrain)
+	{
+		const auto& desc = terrain->GetDesc();
+
+		Hasher h;
+		h.Add(desc.Position);
+		h.Add(desc.LMapSize);
+		h.Add(desc.GridSize);
+		h.Add(desc.BlockCount);
+		for (const auto& v : terrain->_getVertexBuffer()) {
+			h.Add(v.Position.y);
+		}
+		h.Add(_materialHash(*terrain->GetMaterial()));
+
+		return h.value;
+	}
+
+	uint64 BakeCache::_materialHash(const Material& mtl)
+	{
+		Hasher h;
+		h.Add(mtl.AlphaCutoff);
+		h.Add(mtl.Metallic);
+		h.Add(mtl.Roughness);
+		h.Add(mtl.GIWeight);
+		h.Add(mtl.Diffuse);
+		h.Add(mtl.Emissive);
+		h.Add(mtl.TilingOffset);
+		h.Add(_textureHash(mtl.DiffuseMap));
+		h.Add(_textureHash(mtl.EmissiveMap));
+		h.Add(_textureHash(mtl.PBRMap));
+
+		return h.value;
+	}
+
+	uint64 BakeCache::_textureHash(Texture* texture)
+	{
+		if (texture == NULL) {
+			return 0;
+		}
+
+		auto it = mTextureHashes.find(texture);
+		if (it != mTextureHashes.end()) {
+			return it->second;
+		}
+
+		Hasher h;
+		h.Add(texture->name);
+		h.Add(texture->width);
+		h.Add(texture->height);
+		h.Add(texture->channels);
+		if (!texture->data.empty()) {
+			h.Update(&texture->data[0], texture->data.size());
+		}
+
+		mTextureHashes[texture] = h.value;
+		return h.value;
+	}
+
+	uint64 BakeCache::_lightHash(Light* light)
+	{
+		Hasher h;
+		h.Add(light->Type);
+		h.Add(light->Position);
+		h.Add(light->Direction);
+		h.Add(light->Color);
+		h.Add(light->AttenStart);
+		h.Add(light->AttenEnd);
+		h.Add(light->AttenFallOff);
+		h.Add(light->SpotInner);
+		h.Add(light->SpotOuter);
+		h.Add(light->SpotFallOff);
+		h.Add(light->DirectScale);
+		h.Add(light->IndirectScale);
+		h.Add(light->GIEnable);
+		h.Add(light->CastShadow);
+		h.Add(light->SaveShadowMask);
+		h.Add(light->ShadowMask);
+
+		return h.value;
+	}
+
+	uint64 BakeCache::_occluderHash(const Aabb& region)
+	{
+		Hasher h;
+		for (size_t i = 0; i < mMeshHashes.size(); ++i) {
+			if (mMeshBounds[i].Intersect(region)) {
+				h.Add(mMeshHashes[i]);
+			}
+		}
+
+		for (size_t i = 0; i < mTerrainHashes.size(); ++i) {
+			if (mTerrainBounds[i].Intersect(region)) {
+				h.Add(mTerrainHashes[i]);
+			}
+		}
+
+		return h.value;
+	}
+
+	uint64 BakeCache::_dependencyHash(uint64 self, const Aabb& bound, const std::vector<Light*>& lights, bool indirect, float aoRadius)
+	{
+		Hasher h;
+		h.Add(self);
+		h.Add(mSettingHash);
+		for (auto* light : lights) {
+			h.Add(_lightHash(light));
+		}
+
+		// the paths of the indirect lighting may reach anything
+		if (indirect) {
+			h.Add(mGILightHash);
+			h.Add(mSceneHash);
+			return h.value;
+		}
+
+		// the shadow rays stay between the entity and the lights, the ao rays within the radius
+		Aabb region = bound;
+		region.minimum -= Float3(aoRadius, aoRadius, aoRadius);
+		region.maximum += Float3(aoRadius, aoRadius, aoRadius);
+
+		bool global = false;
+		for (auto* light : lights) {
+			if (!light->CastShadow) {
+				continue;
+			}
+
+			if (light->Type == Light::DIRECTION) {
+				global = true;
+			}
+			else {
+				region.Merge(light->Position);
+			}
+		}
+
+		h.Add(global ? mSceneHash : _occluderHash(region));
+
+		return h.value;
+	}
+
+}
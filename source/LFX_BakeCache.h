@@ -0,0 +1,85 @@
+#pragma once
+
+#include "LFX_Types.h"
+#include "LFX_Light.h"
+#include "LFX_Entity.h"
+#include <map>
+
+namespace LFX {
+
+	class Mesh;
+	class Terrain;
+
+	// 64 bit FNV-1a
+	struct Hasher
+	{
+		uint64 value;
+
+		Hasher() : value(14695981039346656037ULL) {}
+
+		void Update(const void* data, size_t size)
+		{
+			const uint8_t* bytes = (const uint8_t*)data;
+			for (size_t i = 0; i < size; ++i) {
+				value ^= bytes[i];
+				value *= 1099511628211ULL;
+			}
+		}
+
+		template <class T>
+		void Add(const T& v) { Update(&v, sizeof(T)); }
+		void Add(const String& s) { Add((int)s.size()); Update(s.c_str(), s.size()); }
+	};
+
+	// Results of the previous bake keyed by the dependency hash of their task. The hash covers
+	// the entity itself, the lights reaching it, the occluders around it and the bake settings,
+	// a task whose hash is found is restored instead of baked again.
+	class LFX_ENTRY BakeCache
+	{
+	public:
+		BakeCache();
+		~BakeCache();
+
+		bool Load(const String& filename);
+		bool Save(const String& filename);
+
+		// hashes the geometry of the world, call it after the world is loaded
+		void Prepare();
+
+		// index is the block of a terrain
+		uint64 GetTaskHash(Entity* entity, int index);
+		// copies the cached result of the task into the entity
+		bool Restore(Entity* entity, int index, uint64 hash);
+		// records the baked result of the task, only recorded results are saved
+		void Store(Entity* entity, int index, uint64 hash);
+
+	protected:
+		struct Entry
+		{
+			std::vector<LightmapValue> lightmap;
+			std::vector<Float3> coefficients;
+		};
+
+		uint64 _meshHash(Mesh* mesh);
+		uint64 _terrainHash(Terrain* terrain);
+		uint64 _materialHash(const Material& mtl);
+		uint64 _textureHash(Texture* texture);
+		uint64 _lightHash(Light* light);
+		uint64 _occluderHash(const Aabb& region);
+		uint64 _dependencyHash(uint64 self, const Aabb& bound, const std::vector<Light*>& lights, bool indirect, float aoRadius);
+
+	protected:
+		std::map<uint64, Entry> mEntries;
+		std::map<uint64, Entry> mResults;
+
+		std::map<Texture*, uint64> mTextureHashes;
+		std::vector<uint64> mMeshHashes;
+		std::vector<Aabb> mMeshBounds;
+		std::vector<uint64> mTerrainHashes;
+		std::vector<Aabb> mTerrainBounds;
+		uint64 mSceneHash;
+		uint64 mSettingHash;
+		uint64 mGILightHash;
+	};
+
+}
@@ -10,7 +10,7 @@ namespace LFX {
 		mId = id;
 		mEntity = NULL;
 		mIndex = 0;
-		mCompeleted = true;
+		mTile = -1;
 	}
 
 	STBaker::~STBaker()
@@ -19,167 +19,247 @@ namespace LFX {
 
 	void STBaker::Run()
 	{
-		while (1) {
-			if (mStatus == STOP)
-				break;
+		Task task;
+		while (mRenderer->_waitTask(this, task)) {
+			mEntity = task.entity;
+			mIndex = task.index;
+			mTile = task.tile;
 
-			if (mCompeleted)
+			if (mEntity->GetType() == LFX_SHPROBE) {
+				LOGI("Baking LightProbe batch %d", mIndex);
+
+				_calcuSHProbe();
+				mRenderer->_onTaskCompeleted(task);
 				continue;
+			}
 
-			bool hasLightForGI = false;
-			for (auto* light : World::Instance()->GetLights()) {
-				if (light->GIEnable) {
-					hasLightForGI = true;
-					break;
-				}
+			if (mTile < 0) {
+				_beginLighting(task);
+				continue;
 			}
 
 			if (mEntity->GetType() == LFX_TERRAIN) {
-				Terrain* pTerrain = (Terrain*)mEntity;
-				int xblock = mIndex % pTerrain->GetDesc().BlockCount.x;
-				int yblock = mIndex / pTerrain->GetDesc().BlockCount.x;
-				LOGI("Baking terrain %d %d, %dx", xblock, yblock, pTerrain->GetDesc().LMapSize);
-
 				_calcuDirectLightingTerrain();
-				if (hasLightForGI) {
+				if (_hasIndirectLighting()) {
 					_calcuIndirectLightingTerrain();
 				}
 				_calcuAmbientOcclusionTerrain();
-				_postProcess();
 			}
 			else if (mEntity->GetType() == LFX_MESH) {
-				Mesh* pMesh = (Mesh*)mEntity;
-				LOGI("Baking Mesh %d, %dx", mIndex, pMesh->GetLightingMapSize());
-
 				_calcuDirectLightingMesh();
-				if (hasLightForGI) {
+				if (_hasIndirectLighting()) {
 					_calcuIndirectLightingMesh();
 				}
 				_calcuAmbientOcclusionMesh();
-				_postProcess();
-			}
-			else if (mEntity->GetType() == LFX_SHPROBE) {
-				LOGI("Baking LightProbe %d", mIndex);
-
-				_calcuSHProbe();
 			}
 			else {
 				assert(0 && "Invalid entity!");
 			}
 
-			mRenderer->_onThreadCompeleted();
-
-			mCompeleted = true;
+			// the last tile resolves the entity
+			if (mRenderer->_onTileCompeleted(task)) {
+				_postProcess();
+				mRenderer->_onTaskCompeleted(task);
+			}
 		}
 	}
 
-	void STBaker::Enqueue(Entity * entity, int index)
+	void STBaker::_beginLighting(const Task& task)
 	{
-		mEntity = entity;
-		mIndex = index;
+		int tiles = 0;
+
+		if (mEntity->GetType() == LFX_TERRAIN) {
+			Terrain* pTerrain = (Terrain*)mEntity;
+			int xblock = mIndex % pTerrain->GetDesc().BlockCount.x;
+			int yblock = mIndex / pTerrain->GetDesc().BlockCount.x;
+			LOGI("Baking terrain %d %d, %dx", xblock, yblock, pTerrain->GetDesc().LMapSize);
+
+			pTerrain->BeginLighting(xblock, yblock);
+
+			tiles = pTerrain->NumOfLightingTiles();
+		}
+		else if (mEntity->GetType() == LFX_MESH) {
+			Mesh* pMesh = (Mesh*)mEntity;
+			LOGI("Baking Mesh %d, %dx", mIndex, pMesh->GetLightingMapSize());
+
+			std::vector<Light*> lights;
+			_getDirectLights(lights);
+
+			pMesh->BeginLighting(
+				lights.size() > 0,
+				_hasIndirectLighting(),
+				World::Instance()->GetSetting()->AOLevel > 0);
+			tiles = pMesh->NumOfLightingTiles();
+		}
+		else {
+			assert(0 && "Invalid entity!");
+		}
 
-		mCompeleted = false;
+		if (tiles > 0) {
+			mRenderer->_pushTiles(this, task, tiles);
+		}
+		else {
+			_postProcess();
+			mRenderer->_onTaskCompeleted(task);
+		}
 	}
 
-	void STBaker::_calcuDirectLightingMesh()
+	void STBaker::_getDirectLights(std::vector<Light*>& lights)
 	{
-		Mesh * pMesh = (Mesh*)mEntity;
-		if (pMesh->GetLightingMapSize())
+		Aabb bound;
+
+		if (mEntity->GetType() == LFX_TERRAIN) {
+			Terrain* pTerrain = (Terrain*)mEntity;
+
+			float blockSize = pTerrain->GetDesc().Dimension.x / pTerrain->GetDesc().BlockCount.x;
+
+			int xblock = mIndex % pTerrain->GetDesc().BlockCount.x;
+			int yblock = mIndex / pTerrain->GetDesc().BlockCount.x;
+
+			bound.minimum.x = xblock * blockSize;
+			bound.minimum.y = 0;
+			bound.minimum.z = yblock * blockSize;
+			bound.maximum.x = xblock * blockSize + blockSize;
+			bound.maximum.y = 10000;
+			bound.maximum.z = yblock * blockSize + blockSize;
+			bound.minimum += pTerrain->GetDesc().Position;
+			bound.maximum += pTerrain->GetDesc().Position;
+		}
+		else {
+			bound = ((Mesh*)mEntity)->GetBound();
+		}
+
+		for (auto* light : World::Instance()->GetLights())
 		{
-			std::vector<Light *> lights;
-			for (auto* light: World::Instance()->GetLights())
+			if (IsLightVisible(light, bound))
 			{
-				if (IsLightVisible(light, pMesh->GetBound()))
-				{
-					lights.push_back(light);
-				}
+				lights.push_back(light);
 			}
+		}
+	}
+
+	bool STBaker::_hasIndirectLighting()
+	{
+		if (World::Instance()->GetSetting()->GIScale <= 0) {
+			return false;
+		}
 
-			if (lights.size() > 0) {
-				pMesh->CalcuDirectLighting(lights);
+		for (auto* light : World::Instance()->GetLights()) {
+			if (light->GIEnable) {
+				return true;
 			}
 		}
+
+		return false;
+	}
+
+	void STBaker::Enqueue(const Task& task)
+	{
+		mQueueMutex.Lock();
+		mQueue.push_back(task);
+		mQueueMutex.Unlock();
+	}
+
+	bool STBaker::_popTask(Task& task)
+	{
+		bool ret = false;
+
+		mQueueMutex.Lock();
+		if (!mQueue.empty()) {
+			task = mQueue.back();
+			mQueue.pop_back();
+			ret = true;
+		}
+		mQueueMutex.Unlock();
+
+		return ret;
+	}
+
+	bool STBaker::_stealTask(Task& task)
+	{
+		bool ret = false;
+
+		mQueueMutex.Lock();
+		if (!mQueue.empty()) {
+			task = mQueue.front();
+			mQueue.pop_front();
+			ret = true;
+		}
+		mQueueMutex.Unlock();
+
+		return ret;
+	}
+
+	void STBaker::_calcuDirectLightingMesh()
+	{
+		Mesh * pMesh = (Mesh*)mEntity;
+
+		std::vector<Light *> lights;
+		_getDirectLights(lights);
+
+		if (lights.size() > 0) {
+			pMesh->CalcuDirectLighting(mTile, lights);
+		}
 	}
 
 	void STBaker::_calcuDirectLightingTerrain()
 	{
 		Terrain * pTerrain = (Terrain*)mEntity;
 
-		float blockSize = pTerrain->GetDesc().Dimension.x / pTerrain->GetDesc().BlockCount.x;
-
 		int xblock = mIndex % pTerrain->GetDesc().BlockCount.x;
 		int yblock = mIndex / pTerrain->GetDesc().BlockCount.x;
 
-		Aabb bound;
-		bound.minimum.x = xblock * blockSize;
-		bound.minimum.y = 0;
-		bound.minimum.z = yblock * blockSize;
-		bound.maximum.x = xblock * blockSize + blockSize;
-		bound.maximum.y = 10000;
-		bound.maximum.z = yblock * blockSize + blockSize;
-		bound.minimum += pTerrain->GetDesc().Position;
-		bound.maximum += pTerrain->GetDesc().Position;
-
 		std::vector<Light *> lights;
-		for (auto* light : World::Instance()->GetLights())
-		{
-			if (IsLightVisible(light, bound))
-			{
-				lights.push_back(light);
-			}
-		}
+		_getDirectLights(lights);
 
 		if (lights.size() > 0) {
-			pTerrain->CalcuDirectLighting(xblock, yblock, lights);
+			pTerrain->CalcuDirectLighting(xblock, yblock, mTile, lights);
 		}
 	}
 
 	void STBaker::_calcuIndirectLightingMesh()
 	{
-		if (World::Instance()->GetSetting()->GIScale > 0) {
-			Mesh* pMesh = World::Instance()->GetMeshes()[mIndex];
+		Mesh* pMesh = (Mesh*)mEntity;
 
-			if (pMesh->GetLightingMapSize()) {
-				pMesh->CalcuIndirectLighting();
-			}
-		}
+		pMesh->CalcuIndirectLighting(mTile);
 	}
 
 	void STBaker::_calcuIndirectLightingTerrain()
 	{
-		if (World::Instance()->GetSetting()->GIScale > 0) {
-			Terrain* pTerrain = (Terrain*)mEntity;
+		Terrain* pTerrain = (Terrain*)mEntity;
 
-			float blockSize = pTerrain->GetDesc().Dimension.x / pTerrain->GetDesc().BlockCount.x;
-			int xblock = mIndex % pTerrain->GetDesc().BlockCount.x;
-			int yblock = mIndex / pTerrain->GetDesc().BlockCount.x;
+		int xblock = mIndex % pTerrain->GetDesc().BlockCount.x;
+		int yblock = mIndex / pTerrain->GetDesc().BlockCount.x;
 
-			pTerrain->CalcuIndirectLighting(xblock, yblock);
-		}
+		pTerrain->CalcuIndirectLighting(xblock, yblock, mTile);
 	}
 
 	void STBaker::_calcuAmbientOcclusionMesh()
 	{
 		if (World::Instance()->GetSetting()->AOLevel > 0) {
-			Mesh* pMesh = World::Instance()->GetMeshes()[mIndex];
+			Mesh* pMesh = (Mesh*)mEntity;
 
-			if (pMesh->GetLightingMapSize() > 0) {
-				pMesh->CalcuAmbientOcclusion();
-			}
+			pMesh->CalcuAmbientOcclusion(mTile);
 		}
 	}
 
 	void STBaker::_calcuAmbientOcclusionTerrain()
 	{
 		if (World::Instance()->GetSetting()->AOLevel > 0) {
-			//...
+			Terrain* pTerrain = (Terrain*)mEntity;
+
+			int xblock = mIndex % pTerrain->GetDesc().BlockCount.x;
+			int yblock = mIndex / pTerrain->GetDesc().BlockCount.x;
+
+			pTerrain->CalcuAmbientOcclusion(xblock, yblock, mTile);
 		}
 	}
 
 	void STBaker::_calcuSHProbe()
 	{
+		// the probe tasks are batches of close probes
 		SHBaker baker;
-		baker.Run((SHProbe*)mEntity);
+		baker.Run(mRenderer->_getProbeBatch(mIndex), mRenderer->_getProbeSamples());
 	}
 
 	void STBaker::_postProcess()
@@ -193,12 +273,12 @@ namespace LFX {
 		}
 		else if (mEntity->GetType() == LFX_MESH) {
 			Mesh* pMesh = (Mesh*)mEntity;
-			auto& lmap = pMesh->_getLightingMap();
-			int size = pMesh->GetLightingMapSize();
+			pMesh->EndLighting();
 
+			//auto& lmap = pMesh->_getLightingMap();
+			//int size = pMesh->GetLightingMapSize();
 			//Rasterizer::Blur(&lmap[0], size, size, size, 2);
 		}
 	}
 
 }
-
@@ -2,6 +2,8 @@
 
 #include "LFX_Thread.h"
 #include "LFX_Entity.h"
+#include "LFX_Light.h"
+#include <deque>
 
 namespace LFX {
 
@@ -14,6 +16,8 @@ namespace LFX {
 		{
 			Entity* entity;
 			int index;
+			int tile; // -1 means the whole entity, it will be split into tile tasks
+			int group; // index of the entity task in CRenderer::mTasks
 		};
 
 	public:
@@ -22,10 +26,20 @@ namespace LFX {
 
 		virtual void Run();
 
-		bool IsCompeleted() { return mCompeleted; }
-		void Enqueue(Entity* entity, int index);
+		int GetId() const { return mId; }
+
+		// push to the back of the local queue, any thread can call it
+		void Enqueue(const Task& task);
+
+		// the owner takes the newest task, the others steal the oldest
+		bool _popTask(Task& task);
+		bool _stealTask(Task& task);
 
 	protected:
+		void _beginLighting(const Task& task);
+		void _getDirectLights(std::vector<Light*>& lights);
+		bool _hasIndirectLighting();
+
 		void _calcuDirectLightingMesh();
 		void _calcuDirectLightingTerrain();
 		void _calcuIndirectLightingMesh();
@@ -40,6 +54,8 @@ namespace LFX {
 		int mId;
 		Entity* mEntity;
 		int mIndex;
-		std::atomic_bool mCompeleted;
+		int mTile;
+		std::deque<Task> mQueue;
+		Mutex mQueueMutex;
 	};
 }
\ No newline at end of file
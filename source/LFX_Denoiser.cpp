@@ -0,0 +1,120 @@
+#include "LFX_Denoiser.h"
+#include "LFX_ILBakerMath.h"
+
+namespace LFX {
+
+	float Denoiser::_texelSize(const RVertex* gbuffer, int w, int h)
+	{
+		std::vector<float> distances;
+		for (int v = 0; v < h; ++v)
+		{
+			for (int u = 0; u < w; ++u)
+			{
+				const int index = v * w + u;
+				if (gbuffer[index].MaterialId == -1) {
+					continue;
+				}
+				if (u + 1 < w && gbuffer[index + 1].MaterialId != -1) {
+					distances.push_back((gbuffer[index + 1].Position - gbuffer[index].Position).len());
+				}
+				if (v + 1 < h && gbuffer[index + w].MaterialId != -1) {
+					distances.push_back((gbuffer[index + w].Position - gbuffer[index].Position).len());
+				}
+			}
+		}
+
+		if (distances.empty()) {
+			return 0;
+		}
+
+		std::nth_element(distances.begin(), distances.begin() + distances.size() / 2, distances.end());
+		return distances[distances.size() / 2];
+	}
+
+	void Denoiser::Run(Float4* data, const RVertex* gbuffer, int w, int h, int iterations)
+	{
+		static const float kernel[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+		// the color weight is relative to the luminance of the texel and halves every iteration
+		const float colorSigma = 1.0f;
+		const float normalPower = 32.0f;
+		// in texels of the current step
+		const float positionSigma = 2.0f;
+
+		const float texelSize = _texelSize(gbuffer, w, h);
+		if (texelSize <= 0) {
+			return;
+		}
+
+		iterations = Clamp<int>(iterations, 0, kMaxIterations);
+
+		// ping pong between the buffers, the last iteration writes to data
+		std::vector<Float4> temp(data, data + w * h);
+		Float4* src = &temp[0];
+		Float4* dst = data;
+		if (iterations % 2 == 0) {
+			std::swap(src, dst);
+		}
+
+		for (int i = 0; i < iterations; ++i)
+		{
+			const int step = 1 << i;
+			const float invColorSigma = 1.0f / (colorSigma / step);
+			const float invPositionSigma2 = 1.0f / (positionSigma * positionSigma * texelSize * texelSize * step * step);
+
+			for (int v = 0; v < h; ++v)
+			{
+				for (int u = 0; u < w; ++u)
+				{
+					const int index = v * w + u;
+					const RVertex& p = gbuffer[index];
+					if (p.MaterialId == -1) {
+						dst[index] = src[index];
+						continue;
+					}
+
+					const Float3 cp = Float3(src[index].x, src[index].y, src[index].z);
+					const float lp = std::max(ILBaker::ComputeLuminance(cp), 0.001f);
+
+					Float3 sum = Float3(0, 0, 0);
+					float weightSum = 0;
+					for (int y = -2; y <= 2; ++y)
+					{
+						const int t = v + y * step;
+						if (t < 0 || t >= h)
+							continue;
+
+						for (int x = -2; x <= 2; ++x)
+						{
+							const int s = u + x * step;
+							if (s < 0 || s >= w)
+								continue;
+
+							const int other = t * w + s;
+							const RVertex& q = gbuffer[other];
+							if (q.MaterialId == -1)
+								continue;
+
+							const Float3 cq = Float3(src[other].x, src[other].y, src[other].z);
+
+							const float dl = std::abs(ILBaker::ComputeLuminance(cq) - lp) / lp;
+							const float wc = std::exp(-dl * invColorSigma);
+							const float wn = std::pow(std::max(0.0f, Float3::Dot(p.Normal, q.Normal)), normalPower);
+							const float wp = std::exp(-(q.Position - p.Position).lenSqr() * invPositionSigma2);
+
+							const float weight = kernel[std::abs(x)] * kernel[std::abs(y)] * wc * wn * wp;
+							sum += cq * weight;
+							weightSum += weight;
+						}
+					}
+
+					// the center texel always has a weight
+					sum /= weightSum;
+					dst[index] = Float4(sum.x, sum.y, sum.z, src[index].w);
+				}
+			}
+
+			std::swap(src, dst);
+		}
+	}
+
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "LFX_Rasterizer.h"
+
+namespace LFX {
+
+	// Edge avoiding a-trous wavelet filter [Dammertz 2010] for the baked lighting. The weights
+	// of the 5x5 B3 spline kernel are stopped by the color, the normal and the world position of
+	// the texels, texels of different UV charts are far apart and don't blend.
+	class LFX_ENTRY Denoiser
+	{
+	public:
+		static const int kMaxIterations = 8;
+
+		// gbuffer[i] is the texel of data[i], texels with MaterialId -1 are empty and skipped
+		static void Run(Float4* data, const RVertex* gbuffer, int w, int h, int iterations);
+
+	protected:
+		// median distance of the neighbor texels
+		static float _texelSize(const RVertex* gbuffer, int w, int h);
+	};
+
+}
@@ -1,6 +1,8 @@
 #include "LFX_DeviceStats.h"
 
-#ifndef _WIN32
+#if defined(__linux__)
+#include <unistd.h>
+#elif !defined(_WIN32)
 #include <sys/types.h>
 #include <sys/sysctl.h>
 #endif
@@ -15,6 +17,8 @@ namespace LFX {
 		SYSTEM_INFO sysInfo;
 		GetSystemInfo(&sysInfo);
 		stats.Processors = sysInfo.dwNumberOfProcessors;
+#elif defined(__linux__)
+		stats.Processors = std::max((int)sysconf(_SC_NPROCESSORS_ONLN), 1);
 #else
 		int count = 1;
 		size_t size = sizeof(int);
@@ -5,6 +5,419 @@
 
 namespace LFX {
 
+#if LFX_EMBREE_VERSION >= 3
+	static bool EmbreeAlphaTest(Mesh* mesh, unsigned int primID, float u, float v)
+	{
+		const Triangle& triangle = mesh->_getTriangle(primID);
+		const Material& m = mesh->_getMaterial(triangle.MaterialId);
+		if (m.DiffuseMap == NULL)
+			return true;
+
+		const Float2& uv0 = mesh->_getVertex(triangle.Index0).UV;
+		const Float2& uv1 = mesh->_getVertex(triangle.Index1).UV;
+		const Float2& uv2 = mesh->_getVertex(triangle.Index2).UV;
+
+		Float2 uv = uv0 * (1 - u - v) + uv1 * u + uv2 * v;
+
+		return m.DiffuseMap->SampleColor(uv.x, uv.y).w >= m.AlphaCutoff;
+	}
+
+	static void EmbreeFilterFunc(const RTCFilterFunctionNArguments* args)
+	{
+		Entity* entity = (Entity*)args->geometryUserPtr;
+
+		for (unsigned int i = 0; i < args->N; ++i)
+		{
+			if (args->valid[i] == 0)
+				continue;
+
+			// ray masks may be compiled out of the embree library
+			if ((RTCRayN_mask(args->ray, args->N, i) & entity->GetType()) == 0)
+			{
+				args->valid[i] = 0;
+				continue;
+			}
+
+			if (entity->GetType() == LFX_MESH)
+			{
+				const unsigned int primID = RTCHitN_primID(args->hit, args->N, i);
+				const float u = RTCHitN_u(args->hit, args->N, i);
+				const float v = RTCHitN_v(args->hit, args->N, i);
+				if (!EmbreeAlphaTest((Mesh*)entity, primID, u, v))
+					args->valid[i] = 0;
+			}
+		}
+	}
+
+	static void EmbreeInitRay(RTCRay& r, const Ray& ray, float len, int mask)
+	{
+		r.org_x = ray.orig.x;
+		r.org_y = ray.orig.y;
+		r.org_z = ray.orig.z;
+		r.tnear = 0;
+		r.dir_x = ray.dir.x;
+		r.dir_y = ray.dir.y;
+		r.dir_z = ray.dir.z;
+		r.time = 0;
+		r.tfar = len;
+		r.mask = mask;
+		r.id = 0;
+		r.flags = 0;
+	}
+
+	static void EmbreeInitRay8(RTCRay8& r, int k, const Ray& ray, float len, int mask)
+	{
+		r.org_x[k] = ray.orig.x;
+		r.org_y[k] = ray.orig.y;
+		r.org_z[k] = ray.orig.z;
+		r.tnear[k] = 0;
+		r.dir_x[k] = ray.dir.x;
+		r.dir_y[k] = ray.dir.y;
+		r.dir_z[k] = ray.dir.z;
+		r.time[k] = 0;
+		r.tfar[k] = len;
+		r.mask[k] = mask;
+		r.id[k] = k;
+		r.flags[k] = 0;
+	}
+
+#if LFX_EMBREE_VERSION >= 4
+	static void EmbreeIntersect1(RTCScene scene, RTCRayHit& rayhit)
+	{
+		rtcIntersect1(scene, &rayhit);
+	}
+
+	static void EmbreeOccluded1(RTCScene scene, RTCRay& ray)
+	{
+		rtcOccluded1(scene, &ray);
+	}
+
+	static void EmbreeIntersect8(const int* valid, RTCScene scene, RTCRayHit8& rayhit)
+	{
+		RTCIntersectArguments args;
+		rtcInitIntersectArguments(&args);
+		args.flags = RTC_RAY_QUERY_FLAG_COHERENT;
+		rtcIntersect8(valid, scene, &rayhit, &args);
+	}
+
+	static void EmbreeOccluded8(const int* valid, RTCScene scene, RTCRay8& ray)
+	{
+		RTCOccludedArguments args;
+		rtcInitOccludedArguments(&args);
+		args.flags = RTC_RAY_QUERY_FLAG_COHERENT;
+		rtcOccluded8(valid, scene, &ray, &args);
+	}
+#else
+	static void EmbreeIntersect1(RTCScene scene, RTCRayHit& rayhit)
+	{
+		RTCIntersectContext context;
+		rtcInitIntersectContext(&context);
+		rtcIntersect1(scene, &context, &rayhit);
+	}
+
+	static void EmbreeOccluded1(RTCScene scene, RTCRay& ray)
+	{
+		RTCIntersectContext context;
+		rtcInitIntersectContext(&context);
+		rtcOccluded1(scene, &context, &ray);
+	}
+
+	static void EmbreeIntersect8(const int* valid, RTCScene scene, RTCRayHit8& rayhit)
+	{
+		RTCIntersectContext context;
+		rtcInitIntersectContext(&context);
+		context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+		rtcIntersect8(valid, scene, &context, &rayhit);
+	}
+
+	static void EmbreeOccluded8(const int* valid, RTCScene scene, RTCRay8& ray)
+	{
+		RTCIntersectContext context;
+		rtcInitIntersectContext(&context);
+		context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+		rtcOccluded8(valid, scene, &context, &ray);
+	}
+#endif
+
+	EmbreeScene::EmbreeScene()
+	{
+		rtcDevice = NULL;
+		rtcScene = NULL;
+
+		rtcDevice = rtcNewDevice(NULL);
+		if (rtcDevice == NULL)
+		{
+			LOGW("Embree device unavailable [%d], fallback to the builtin tracer", rtcGetDeviceError(NULL));
+		}
+	}
+
+	EmbreeScene::~EmbreeScene()
+	{
+		if (rtcScene != NULL)
+			rtcReleaseScene(rtcScene);
+
+		if (rtcDevice != NULL)
+			rtcReleaseDevice(rtcDevice);
+	}
+
+	RTCGeometry EmbreeScene::NewGeometry(Entity* pEntity, const Vertex* pVertex, int numVertices, const Triangle* pTriangle, int numTriangles, bool alphaTest)
+	{
+		RTCGeometry geom = rtcNewGeometry(rtcDevice, RTC_GEOMETRY_TYPE_TRIANGLE);
+
+		float* verts = (float*)rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, 3 * sizeof(float), numVertices);
+		for (int j = 0; j < numVertices; ++j)
+		{
+			*verts++ = pVertex[j].Position.x;
+			*verts++ = pVertex[j].Position.y;
+			*verts++ = pVertex[j].Position.z;
+		}
+
+		unsigned int* indices = (unsigned int*)rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, 3 * sizeof(unsigned int), numTriangles);
+		for (int j = 0; j < numTriangles; ++j)
+		{
+			*indices++ = pTriangle[j].Index0;
+			*indices++ = pTriangle[j].Index1;
+			*indices++ = pTriangle[j].Index2;
+		}
+
+		rtcSetGeometryMask(geom, pEntity->GetType());
+		rtcSetGeometryUserData(geom, pEntity);
+		if (alphaTest || pEntity->GetType() == LFX_TERRAIN)
+		{
+			rtcSetGeometryIntersectFilterFunction(geom, EmbreeFilterFunc);
+			rtcSetGeometryOccludedFilterFunction(geom, EmbreeFilterFunc);
+		}
+		rtcCommitGeometry(geom);
+
+		return geom;
+	}
+
+	void EmbreeScene::AttachGeometry(Entity* pEntity, RTCGeometry geom)
+	{
+		rtcAttachGeometryByID(rtcScene, geom, (unsigned int)mEntityMap.size());
+		rtcReleaseGeometry(geom);
+
+		mEntityMap.push_back(pEntity);
+	}
+
+	RTCGeometry EmbreeScene::NewMeshGeometry(Mesh* mesh)
+	{
+		bool alphaTest = false;
+		for (const auto& m : mesh->_getMaterialBuffer())
+		{
+			alphaTest |= m.DiffuseMap != NULL;
+		}
+
+		return NewGeometry(mesh,
+			mesh->_getVertexBuffer().data(), mesh->NumOfVertices(),
+			mesh->_getTriangleBuffer().data(), mesh->NumOfTriangles(),
+			alphaTest);
+	}
+
+	RTCGeometry EmbreeScene::NewInstanceGeometry(Mesh* mesh, RTCScene prototype)
+	{
+		const Mat4& m = mesh->GetTransform();
+		const float xfm[12] = {
+			m._11, m._12, m._13,
+			m._21, m._22, m._23,
+			m._31, m._32, m._33,
+			m._41, m._42, m._43,
+		};
+
+		RTCGeometry geom = rtcNewGeometry(rtcDevice, RTC_GEOMETRY_TYPE_INSTANCE);
+		rtcSetGeometryInstancedScene(geom, prototype);
+		rtcSetGeometryTransform(geom, 0, RTC_FORMAT_FLOAT3X4_COLUMN_MAJOR, xfm);
+		rtcSetGeometryMask(geom, LFX_MESH);
+		rtcCommitGeometry(geom);
+
+		return geom;
+	}
+
+	void EmbreeScene::Build()
+	{
+		Scene::Build();
+
+		if (rtcDevice == NULL)
+			return;
+
+		if (rtcScene != NULL)
+			rtcReleaseScene(rtcScene);
+		mEntityMap.clear();
+
+		rtcScene = rtcNewScene(rtcDevice);
+		rtcSetSceneBuildQuality(rtcScene, RTC_BUILD_QUALITY_HIGH);
+
+		// meshes with instances are built once into a prototype scene,
+		// the source and its instances reference it by transform
+		std::map<Mesh*, RTCScene> prototypes;
+		for (auto* mesh : World::Instance()->GetMeshes())
+		{
+			if (mesh->IsInstance() && prototypes.find(mesh->GetSource()) == prototypes.end())
+			{
+				RTCScene prototype = rtcNewScene(rtcDevice);
+				rtcSetSceneBuildQuality(prototype, RTC_BUILD_QUALITY_HIGH);
+				RTCGeometry geom = NewMeshGeometry(mesh->GetSource());
+				rtcAttachGeometryByID(prototype, geom, 0);
+				rtcReleaseGeometry(geom);
+				rtcCommitScene(prototype);
+
+				prototypes[mesh->GetSource()] = prototype;
+			}
+		}
+
+		for (auto* mesh : World::Instance()->GetMeshes())
+		{
+			auto it = prototypes.find(mesh->IsInstance() ? mesh->GetSource() : mesh);
+			if (it != prototypes.end())
+				AttachGeometry(mesh, NewInstanceGeometry(mesh, it->second));
+			else
+				AttachGeometry(mesh, NewMeshGeometry(mesh));
+		}
+
+		for (auto* pTerrain : World::Instance()->GetTerrains())
+		{
+			// the terrain does not store its triangles
+			std::vector<Triangle> triangles(pTerrain->NumOfTriangles());
+			for (int j = 0; j < (int)triangles.size(); ++j)
+			{
+				triangles[j] = pTerrain->_getTriangle(j);
+			}
+
+			AttachGeometry(pTerrain, NewGeometry(pTerrain,
+				pTerrain->_getVertexBuffer().data(), (int)pTerrain->_getVertexBuffer().size(),
+				triangles.data(), (int)triangles.size(),
+				false));
+		}
+
+		// the instances hold references to the prototypes
+		for (auto it : prototypes)
+		{
+			rtcReleaseScene(it.second);
+		}
+
+		rtcCommitScene(rtcScene);
+
+		RTCError embreeError = rtcGetDeviceError(rtcDevice);
+		assert(embreeError == RTC_ERROR_NONE);
+		if (embreeError != RTC_ERROR_NONE)
+		{
+			LOGE("Build embree scene failed [%d]", embreeError);
+		}
+	}
+
+	bool EmbreeScene::RayCheck(Contact& contact, const Ray& ray, float len, int mask)
+	{
+		if (rtcDevice == NULL)
+			return _RayCheckImp(contact, ray, len, mask);
+
+		RTCRayHit rayhit;
+		EmbreeInitRay(rayhit.ray, ray, len, mask);
+		rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+		rayhit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+		EmbreeIntersect1(rtcScene, rayhit);
+
+		if (rayhit.hit.geomID == RTC_INVALID_GEOMETRY_ID)
+		{
+			contact.td = FLT_MAX;
+			contact.triIndex = -1;
+			contact.entity = NULL;
+			contact.facing = false;
+			return false;
+		}
+
+		// instanced meshes are identified by the instance
+		const unsigned int entityID = rayhit.hit.instID[0] != RTC_INVALID_GEOMETRY_ID ? rayhit.hit.instID[0] : rayhit.hit.geomID;
+		FillContact(contact, ray, entityID, rayhit.hit.primID, rayhit.hit.u, rayhit.hit.v, rayhit.ray.tfar);
+		return true;
+	}
+
+	bool EmbreeScene::Occluded(const Ray& ray, float len, int mask)
+	{
+		if (rtcDevice == NULL)
+			return _OccludedImp(ray, len, mask);
+
+		RTCRay r;
+		EmbreeInitRay(r, ray, len, mask);
+		EmbreeOccluded1(rtcScene, r);
+
+		// tfar is set to -inf on hit
+		return r.tfar < 0;
+	}
+
+	void EmbreeScene::RayCheckBatch(Contact* contacts, bool* hits, const Ray* rays, const float* lens, int count, int mask)
+	{
+		if (rtcDevice == NULL)
+		{
+			Scene::RayCheckBatch(contacts, hits, rays, lens, count, mask);
+			return;
+		}
+
+		for (int base = 0; base < count; base += 8)
+		{
+			const int n = std::min(8, count - base);
+
+			alignas(32) int valid[8];
+			alignas(32) RTCRayHit8 rayhit;
+			for (int k = 0; k < 8; ++k)
+			{
+				valid[k] = k < n ? -1 : 0;
+				EmbreeInitRay8(rayhit.ray, k, rays[base + std::min(k, n - 1)], lens[base + std::min(k, n - 1)], mask);
+				rayhit.hit.geomID[k] = RTC_INVALID_GEOMETRY_ID;
+				rayhit.hit.instID[0][k] = RTC_INVALID_GEOMETRY_ID;
+			}
+
+			EmbreeIntersect8(valid, rtcScene, rayhit);
+
+			for (int k = 0; k < n; ++k)
+			{
+				Contact& contact = contacts[base + k];
+				hits[base + k] = rayhit.hit.geomID[k] != RTC_INVALID_GEOMETRY_ID;
+				if (hits[base + k])
+				{
+					const unsigned int entityID = rayhit.hit.instID[0][k] != RTC_INVALID_GEOMETRY_ID ? rayhit.hit.instID[0][k] : rayhit.hit.geomID[k];
+					FillContact(contact, rays[base + k], entityID, rayhit.hit.primID[k], rayhit.hit.u[k], rayhit.hit.v[k], rayhit.ray.tfar[k]);
+				}
+				else
+				{
+					contact.td = FLT_MAX;
+					contact.triIndex = -1;
+					contact.entity = NULL;
+					contact.facing = false;
+				}
+			}
+		}
+	}
+
+	void EmbreeScene::OccludedBatch(bool* results, const Ray* rays, const float* lens, int count, int mask)
+	{
+		if (rtcDevice == NULL)
+		{
+			Scene::OccludedBatch(results, rays, lens, count, mask);
+			return;
+		}
+
+		for (int base = 0; base < count; base += 8)
+		{
+			const int n = std::min(8, count - base);
+
+			alignas(32) int valid[8];
+			alignas(32) RTCRay8 r;
+			for (int k = 0; k < 8; ++k)
+			{
+				valid[k] = k < n ? -1 : 0;
+				EmbreeInitRay8(r, k, rays[base + std::min(k, n - 1)], lens[base + std::min(k, n - 1)], mask);
+			}
+
+			EmbreeOccluded8(valid, rtcScene, r);
+
+			for (int k = 0; k < n; ++k)
+			{
+				results[base + k] = r.tfar[k] < 0;
+			}
+		}
+	}
+
+#else
 	EmbreeScene::EmbreeScene()
 	{
 		rtcDevice = NULL;
@@ -50,35 +463,22 @@ namespace LFX {
 
 			rtcSetMask(rtcScene, geoID, LFX_MESH);
 
+			// instances are flattened to world space
 			Float4* meshVerts = reinterpret_cast<Float4*>(rtcMapBuffer(rtcScene, geoID, RTC_VERTEX_BUFFER));
+			for (int j = 0; j < mesh->NumOfVertices(); ++j)
 			{
-				Vertex * pVertex = NULL;
-				Triangle * pTriangle = NULL;
-				Material * pMaterial = NULL;
-
-				mesh->Lock(&pVertex, &pTriangle, &pMaterial);
-				for (int j = 0; j < mesh->NumOfVertices(); ++j)
-				{
-					*meshVerts++ = Float4(pVertex[j].Position.x, pVertex[j].Position.y, pVertex[j].Position.z, 0);
-				}
-				mesh->Unlock();
+				const Float3 position = mesh->_getPosition(j);
+				*meshVerts++ = Float4(position.x, position.y, position.z, 0);
 			}
 			rtcUnmapBuffer(rtcScene, geoID, RTC_VERTEX_BUFFER);
 
 			unsigned int * meshTriangles = reinterpret_cast<unsigned int*>(rtcMapBuffer(rtcScene, geoID, RTC_INDEX_BUFFER));
+			for (int j = 0; j < mesh->NumOfTriangles(); ++j)
 			{
-				Vertex * pVertex = NULL;
-				Triangle * pTriangle = NULL;
-				Material * pMaterial = NULL;
-
-				mesh->Lock(&pVertex, &pTriangle, &pMaterial);
-				for (int j = 0; j < mesh->NumOfTriangles(); ++j)
-				{
-					*meshTriangles++ = pTriangle[j].Index0;
-					*meshTriangles++ = pTriangle[j].Index1;
-					*meshTriangles++ = pTriangle[j].Index2;
-				}
-				mesh->Unlock();
+				const Triangle & triangle = mesh->_getTriangle(j);
+				*meshTriangles++ = triangle.Index0;
+				*meshTriangles++ = triangle.Index1;
+				*meshTriangles++ = triangle.Index2;
 			}
 			rtcUnmapBuffer(rtcScene, geoID, RTC_INDEX_BUFFER);
 
@@ -90,8 +490,7 @@ namespace LFX {
 		{
 			for (auto* pTerrain : World::Instance()->GetTerrains()) {
 				std::vector<Vertex> & pVertex = pTerrain->_getVertexBuffer();
-				std::vector<Triangle> & pTriangle = pTerrain->_getTriBuffer();
-				int totalNumTriangles = pTerrain->_getTriBuffer().size();
+				int totalNumTriangles = pTerrain->NumOfTriangles();
 				int totalNumVertices = pTerrain->_getVertexBuffer().size();
 
 				unsigned int geoID = rtcNewTriangleMesh(rtcScene, RTC_GEOMETRY_STATIC, totalNumTriangles, totalNumVertices);
@@ -106,11 +505,12 @@ namespace LFX {
 				rtcUnmapBuffer(rtcScene, geoID, RTC_VERTEX_BUFFER);
 
 				unsigned int * meshTriangles = reinterpret_cast<unsigned int*>(rtcMapBuffer(rtcScene, geoID, RTC_INDEX_BUFFER));
-				for (int j = 0; j < pTerrain->_getTriBuffer().size(); ++j)
+				for (int j = 0; j < totalNumTriangles; ++j)
 				{
-					*meshTriangles++ = pTriangle[j].Index0;
-					*meshTriangles++ = pTriangle[j].Index1;
-					*meshTriangles++ = pTriangle[j].Index2;
+					const Triangle triangle = pTerrain->_getTriangle(j);
+					*meshTriangles++ = triangle.Index0;
+					*meshTriangles++ = triangle.Index1;
+					*meshTriangles++ = triangle.Index2;
 				}
 				rtcUnmapBuffer(rtcScene, geoID, RTC_INDEX_BUFFER);
 
@@ -180,7 +580,7 @@ namespace LFX {
 				if (entity != NULL && entity->GetType() == LFX_MESH)
 				{
 					Mesh * mesh = (Mesh *)entity;
-					Material * m = GetMaterial(entity, r.primID);
+					const Material * m = GetMaterial(entity, r.primID);
 					if (m->DiffuseMap != NULL)
 					{
 						const Triangle & triangle = mesh->_getTriangle(r.primID);
@@ -200,42 +600,7 @@ namespace LFX {
 					}
 				}
 
-				contact.td = r.tfar;
-				contact.tu = r.u;
-				contact.tv = r.v;
-				contact.triIndex = r.primID;
-				contact.entity = mEntityMap[r.geomID];
-				contact.mtl = GetMaterial(contact.entity, r.primID);
-				TriangleLerp(contact.vhit, contact.entity, r.primID, r.u, r.v);
-
-				if (contact.entity != NULL)
-				{
-					Vertex a, b, c;
-					if (contact.entity->GetType() == LFX_TERRAIN)
-					{
-						Terrain * terrain = (Terrain *)contact.entity;
-
-						Triangle tri = terrain->_getTriangle(contact.triIndex);
-						a = terrain->_getVertex(tri.Index0);
-						b = terrain->_getVertex(tri.Index1);
-						c = terrain->_getVertex(tri.Index2);
-					}
-					else
-					{
-						Mesh * mesh = (Mesh *)contact.entity;
-
-						Triangle tri = mesh->_getTriangle(contact.triIndex);
-						a = mesh->_getVertex(tri.Index0);
-						b = mesh->_getVertex(tri.Index1);
-						c = mesh->_getVertex(tri.Index2);
-					}
-
-#if 0
-					Float3 triNml = Float3::Normalize(Float3::Cross(c.Position - a.Position, b.Position - a.Position));
-					contact.backFacing = Float3::Dot(triNml, ray.dir) >= 0.0f;
-#endif
-					contact.facing = Float3::Dot(contact.vhit.Normal, -ray.dir) >= 0.0f;
-				}
+				FillContact(contact, ray, r.geomID, r.primID, r.u, r.v, r.tfar);
 
 				return true;
 			}
@@ -267,7 +632,7 @@ namespace LFX {
 				if (entity != NULL && entity->GetType() == LFX_MESH)
 				{
 					Mesh * mesh = (Mesh *)entity;
-					Material * m = GetMaterial(entity, r.primID);
+					const Material * m = GetMaterial(entity, r.primID);
 					if (m->DiffuseMap != NULL)
 					{
 						const Triangle & triangle = mesh->_getTriangle(r.primID);
@@ -298,41 +663,34 @@ namespace LFX {
 		}
 	}
 
-	void EmbreeScene::TriangleLerp(Vertex & vout, Entity * pEntity, int triIndex, float u, float v)
-	{
-		Vertex * pVertexBuffer;
-		Triangle * pTrangleBuffer;
+#endif
 
-		if (pEntity->GetType() == LFX_TERRAIN)
-		{
-			Terrain * terrain = (Terrain *)pEntity;
-			std::vector<Vertex> & pVertex = terrain->_getVertexBuffer();
-			std::vector<Triangle> & pTriangle = terrain->_getTriBuffer();
+	void EmbreeScene::FillContact(Contact& contact, const Ray& ray, unsigned int geomID, unsigned int primID, float u, float v, float t)
+	{
+		contact.td = t;
+		contact.tu = u;
+		contact.tv = v;
+		contact.triIndex = primID;
+		contact.entity = mEntityMap[geomID];
+		contact.mtl = GetMaterial(contact.entity, primID);
+		TriangleLerp(contact.vhit, contact.entity, primID, u, v);
+		contact.facing = Float3::Dot(contact.vhit.Normal, -ray.dir) >= 0.0f;
+	}
 
-			pVertexBuffer = &pVertex[0];
-			pTrangleBuffer = &pTriangle[0];
-		}
-		else
+	void EmbreeScene::TriangleLerp(Vertex & vout, Entity * pEntity, int triIndex, float u, float v)
+	{
+		if (pEntity->GetType() == LFX_MESH)
 		{
-			Mesh * mesh = (Mesh *)pEntity;
-			Vertex * pVertex = NULL;
-			Triangle * pTriangle = NULL;
-			Material * pMaterial = NULL;
-
-			mesh->Lock(&pVertex, &pTriangle, &pMaterial);
-			mesh->Unlock();
-
-			pVertexBuffer = pVertex;
-			pTrangleBuffer = pTriangle;
+			((Mesh *)pEntity)->_getHitVertex(vout, triIndex, u, v);
+			return;
 		}
 
-		int ia = pTrangleBuffer[triIndex].Index0;
-		int ib = pTrangleBuffer[triIndex].Index1;
-		int ic = pTrangleBuffer[triIndex].Index2;
+		Terrain * terrain = (Terrain *)pEntity;
+		const Triangle triangle = terrain->_getTriangle(triIndex);
 
-		const Vertex & va = pVertexBuffer[ia];
-		const Vertex & vb = pVertexBuffer[ib];
-		const Vertex & vc = pVertexBuffer[ic];
+		const Vertex & va = terrain->_getVertex(triangle.Index0);
+		const Vertex & vb = terrain->_getVertex(triangle.Index1);
+		const Vertex & vc = terrain->_getVertex(triangle.Index2);
 		
 		vout = va + (vb - va) * u + (vc - va) * v;
 		vout.Normal.normalize();
@@ -340,7 +698,7 @@ namespace LFX {
 		vout.Binormal.normalize();
 	}
 
-	Material * EmbreeScene::GetMaterial(Entity * pEntity, int triIndex)
+	const Material * EmbreeScene::GetMaterial(Entity * pEntity, int triIndex)
 	{
 		if (pEntity->GetType() == LFX_TERRAIN)
 		{
@@ -351,16 +709,8 @@ namespace LFX {
 		else
 		{
 			Mesh * mesh = (Mesh *)pEntity;
-			Vertex * pVertex = NULL;
-			Triangle * pTriangle = NULL;
-			Material * pMaterial = NULL;
-			int mtlId;
-
-			mesh->Lock(&pVertex, &pTriangle, &pMaterial);
-			mtlId = pTriangle[triIndex].MaterialId;
-			mesh->Unlock();
 
-			return &pMaterial[mtlId];
+			return &mesh->_getMaterial(mesh->_getTriangle(triIndex).MaterialId);
 		}
 	}
 }
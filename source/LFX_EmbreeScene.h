@@ -4,11 +4,19 @@
 
 #ifdef LFX_USE_EMBREE_SCENE
 
+#if LFX_EMBREE_VERSION >= 4
+#include "embree4/rtcore.h"
+#elif LFX_EMBREE_VERSION >= 3
+#include "embree3/rtcore.h"
+#else
 #include "embree2/rtcore.h"
 #include "embree2/rtcore_ray.h"
+#endif
 
 namespace LFX {
 
+#if LFX_EMBREE_VERSION < 3
+
 	struct LFX_ENTRY EmbreeRay : public RTCRay
 	{
 		EmbreeRay(const Float3& origin, const Float3& direction, float len = FLT_MAX, int flags = 0xFFFFFFFF)
@@ -46,6 +54,7 @@ namespace LFX {
 
 #define StaticAssert_(x) static_assert(x, #x);
 	StaticAssert_(sizeof(EmbreeRay) == sizeof(RTCRay));
+#endif
 
 	class EmbreeScene : public Scene
 	{
@@ -57,10 +66,21 @@ namespace LFX {
 
 		bool RayCheck(Contact& contact, const Ray& ray, float len, int mask) override;
 		bool Occluded(const Ray& ray, float len, int mask) override;
+#if LFX_EMBREE_VERSION >= 3
+		void RayCheckBatch(Contact* contacts, bool* hits, const Ray* rays, const float* lens, int count, int mask) override;
+		void OccludedBatch(bool* results, const Ray* rays, const float* lens, int count, int mask) override;
+#endif
 
 	protected:
 		void TriangleLerp(Vertex& vout, Entity* pEntity, int triIndex, float u, float v);
-		Material* GetMaterial(Entity* pEntity, int triIndex);
+		const Material* GetMaterial(Entity* pEntity, int triIndex);
+		void FillContact(Contact& contact, const Ray& ray, unsigned int geomID, unsigned int primID, float u, float v, float t);
+#if LFX_EMBREE_VERSION >= 3
+		RTCGeometry NewGeometry(Entity* pEntity, const Vertex* pVertex, int numVertices, const Triangle* pTriangle, int numTriangles, bool alphaTest);
+		RTCGeometry NewMeshGeometry(Mesh* mesh);
+		RTCGeometry NewInstanceGeometry(Mesh* mesh, RTCScene prototype);
+		void AttachGeometry(Entity* pEntity, RTCGeometry geom);
+#endif
 
 	protected:
 		RTCDevice rtcDevice;
@@ -385,6 +385,11 @@ namespace LFX {
 		node.extensions["lightMapSize"] = tinygltf::Value(mesh->GetLightingMapSize());
 		node.extensions["castShadow"] = tinygltf::Value(mesh->GetCastShadow());
 		node.extensions["recieveShadow"] = tinygltf::Value(mesh->GetRecieveShadow());
+		if (mesh->IsInstance() && !useLightmap) {
+			// the vertices are shared with the source, place them by the node
+			const float* m = &mesh->GetTransform()._11;
+			node.matrix.assign(m, m + 16);
+		}
 		model.nodes.push_back(node);
 		return (int)model.nodes.size() - 1;
 	}
@@ -0,0 +1,72 @@
+#include "LFX_HeightMip.h"
+
+namespace LFX {
+
+	HeightMip::HeightMip()
+		: mOrigin(0, 0, 0)
+		, mGridSize(1)
+	{
+	}
+
+	HeightMip::~HeightMip()
+	{
+	}
+
+	void HeightMip::Clear()
+	{
+		mLevels.clear();
+	}
+
+	void HeightMip::Build(const std::vector<float>& heights, const Int2& cells, const Float3& origin, float gridSize)
+	{
+		Clear();
+		if (cells.x <= 0 || cells.y <= 0)
+			return;
+
+		mOrigin = origin;
+		mGridSize = gridSize;
+
+		const int stride = cells.x + 1;
+		Level base;
+		base.size = cells;
+		base.bounds.resize(cells.x * cells.y);
+		for (int j = 0; j < cells.y; ++j) {
+			for (int i = 0; i < cells.x; ++i) {
+				const float a = heights[j * stride + i];
+				const float b = heights[j * stride + i + 1];
+				const float c = heights[(j + 1) * stride + i];
+				const float d = heights[(j + 1) * stride + i + 1];
+
+				base.bounds[j * cells.x + i] = Float2(
+					std::min(std::min(a, b), std::min(c, d)),
+					std::max(std::max(a, b), std::max(c, d)));
+			}
+		}
+		mLevels.push_back(base);
+
+		while (mLevels.back().size.x > 1 || mLevels.back().size.y > 1) {
+			const Level& below = mLevels.back();
+
+			Level level;
+			level.size = Int2((below.size.x + 1) / 2, (below.size.y + 1) / 2);
+			level.bounds.resize(level.size.x * level.size.y);
+			for (int j = 0; j < level.size.y; ++j) {
+				for (int i = 0; i < level.size.x; ++i) {
+					Float2 bound(FLT_MAX, -FLT_MAX);
+					for (int z = j * 2; z < std::min(j * 2 + 2, below.size.y); ++z) {
+						for (int x = i * 2; x < std::min(i * 2 + 2, below.size.x); ++x) {
+							const Float2& child = below.bounds[z * below.size.x + x];
+							bound.x = std::min(bound.x, child.x);
+							bound.y = std::max(bound.y, child.y);
+						}
+					}
+
+					level.bounds[j * level.size.x + i] = bound;
+				}
+			}
+
+			mLevels.push_back(level);
+		}
+	}
+
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "LFX_Math.h"
+
+namespace LFX {
+
+	// Min/max height pyramid of a regular grid. Level 0 bounds the heights of every grid cell,
+	// a cell of level l bounds the 2x2 cells below it, the top level is a single cell.
+	// The rays descend the quadtree, only the grid cells reached are intersected.
+	class HeightMip
+	{
+	public:
+		static const int kStackSize = 128;
+
+		struct Level
+		{
+			Int2 size;
+			std::vector<Float2> bounds; // x: min height, y: max height
+		};
+
+	public:
+		HeightMip();
+		~HeightMip();
+
+		void Clear();
+		// heights are the (cells.x + 1) * (cells.y + 1) grid vertices, origin is the world position of vertex 0
+		void Build(const std::vector<float>& heights, const Int2& cells, const Float3& origin, float gridSize);
+
+		bool Valid() const { return !mLevels.empty(); }
+
+		// Closest hit traversal, the nearer cells are visited first and the far ones are culled
+		// once tmax shrinks. leaf(x, z) intersects the grid cell and returns the new tmax.
+		template <class LeafFunc>
+		void RayCheck(const Ray& ray, float tmax, LeafFunc leaf) const;
+
+		// Any hit traversal, leaf(x, z) returns true if the grid cell occludes the ray.
+		template <class LeafFunc>
+		bool Occluded(const Ray& ray, float tmax, LeafFunc leaf) const;
+
+	protected:
+		struct Entry { int level, x, z; float tnear; };
+
+		bool _intersect(int level, int x, int z, const Float3& orig, const Float3& invDir, float tmax, float& tnear) const;
+		// children of the entry hit by the ray, returns the number of children
+		int _children(Entry* children, const Entry& entry, const Float3& orig, const Float3& invDir, float tmax) const;
+
+	protected:
+		std::vector<Level> mLevels;
+		Float3 mOrigin;
+		float mGridSize;
+	};
+
+	inline bool HeightMip::_intersect(int level, int x, int z, const Float3& orig, const Float3& invDir, float tmax, float& tnear) const
+	{
+		const Level& lv = mLevels[level];
+		const Float2& bound = lv.bounds[z * lv.size.x + x];
+		const float size = mGridSize * (1 << level);
+
+		const Float3 minimum(mOrigin.x + x * size, bound.x, mOrigin.z + z * size);
+		const Float3 maximum(minimum.x + size, bound.y, minimum.z + size);
+
+		float t0 = 0, t1 = tmax;
+		for (int k = 0; k < 3; ++k) {
+			float tn = (minimum[k] - orig[k]) * invDir[k];
+			float tf = (maximum[k] - orig[k]) * invDir[k];
+			if (tn > tf)
+				std::swap(tn, tf);
+
+			t0 = tn > t0 ? tn : t0;
+			t1 = tf < t1 ? tf : t1;
+			if (t0 > t1)
+				return false;
+		}
+
+		tnear = t0;
+		return true;
+	}
+
+	inline int HeightMip::_children(Entry* children, const Entry& entry, const Float3& orig, const Float3& invDir, float tmax) const
+	{
+		const int level = entry.level - 1;
+		const Int2& size = mLevels[level].size;
+
+		int count = 0;
+		for (int b = 0; b < 2; ++b) {
+			for (int a = 0; a < 2; ++a) {
+				const int x = entry.x * 2 + a;
+				const int z = entry.z * 2 + b;
+
+				float tnear;
+				if (x < size.x && z < size.y && _intersect(level, x, z, orig, invDir, tmax, tnear))
+					children[count++] = { level, x, z, tnear };
+			}
+		}
+
+		return count;
+	}
+
+	template <class LeafFunc>
+	void HeightMip::RayCheck(const Ray& ray, float tmax, LeafFunc leaf) const
+	{
+		const Float3 invDir(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+
+		Entry stack[kStackSize];
+		int top = 0;
+
+		const int root = (int)mLevels.size() - 1;
+		float tnear;
+		if (mLevels.empty() || !_intersect(root, 0, 0, ray.orig, invDir, tmax, tnear))
+			return;
+
+		stack[top++] = { root, 0, 0, tnear };
+		while (top > 0) {
+			const Entry entry = stack[--top];
+			if (entry.tnear > tmax)
+				continue;
+
+			if (entry.level == 0) {
+				tmax = leaf(entry.x, entry.z);
+				continue;
+			}
+
+			Entry children[4];
+			const int count = _children(children, entry, ray.orig, invDir, tmax);
+
+			// the farthest child is pushed first so the nearest one is visited next
+			for (int i = 1; i < count; ++i) {
+				for (int j = i; j > 0 && children[j].tnear > children[j - 1].tnear; --j)
+					std::swap(children[j], children[j - 1]);
+			}
+			for (int i = 0; i < count; ++i)
+				stack[top++] = children[i];
+		}
+	}
+
+	template <class LeafFunc>
+	bool HeightMip::Occluded(const Ray& ray, float tmax, LeafFunc leaf) const
+	{
+		const Float3 invDir(1.0f / ray.dir.x, 1.0f / ray.dir.y, 1.0f / ray.dir.z);
+
+		Entry stack[kStackSize];
+		int top = 0;
+
+		const int root = (int)mLevels.size() - 1;
+		float tnear;
+		if (mLevels.empty() || !_intersect(root, 0, 0, ray.orig, invDir, tmax, tnear))
+			return false;
+
+		stack[top++] = { root, 0, 0, tnear };
+		while (top > 0) {
+			const Entry entry = stack[--top];
+			if (entry.level == 0) {
+				if (leaf(entry.x, entry.z))
+					return true;
+				continue;
+			}
+
+			top += _children(stack + top, entry, ray.orig, invDir, tmax);
+		}
+
+		return false;
+	}
+
+}
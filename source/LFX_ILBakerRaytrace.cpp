@@ -2,6 +2,7 @@
 #include "LFX_ILBakerRaytrace.h"
 #include "LFX_ILPathTrace.h"
 #include "LFX_EmbreeScene.h"
+#include <chrono>
 
 namespace LFX {
 
@@ -106,47 +107,74 @@ namespace LFX {
 		return kl;
 	}
 
-	void RTGetLightList(std::vector<Light*>& lights, const Float3& point)
-	{
-		for (auto* light : World::Instance()->GetLights()) {
-			if (!light->GIEnable) {
-				continue;
-			}
-
-			if (IsLightVisible(light, point)) {
-				lights.push_back(light);
-			}
-		}
-	}
-
-	bool RTPathTraceFunc(Float3& result, const PathTraceParams& params, const Ray& from, const Vertex& vtx, const Material* mtl, bool hitSky)
+	bool RTPathTraceFunc(Float3& result, const PathTraceParams& params, const Ray& from, const Vertex& vtx, const Material* mtl, bool hitSky, Random& rand)
 	{
 		if (hitSky) {
 			result += params.skyRadiance;
 			return true;
 		}
 
-		float kl = 0;
 		Float3 lighting(0, 0, 0);
-
-		std::vector<Light*> lights;
-		RTGetLightList(lights, vtx.Position);
-		for (size_t i = 0; i < lights.size(); ++i) {
+		const bool exact = World::Instance()->GetLightIndex()->ForEachLight(vtx.Position, rand, [&](Light* light, float weight) {
 			Float3 diffuse;
-			kl += RTCalcuLighting(diffuse, from.orig, vtx, lights[i], mtl);
-			lighting += diffuse * params.diffuseScale;
-		}
+			RTCalcuLighting(diffuse, from.orig, vtx, light, mtl);
+			lighting += diffuse * (params.diffuseScale * weight);
+		});
 
 		lighting += mtl->GetSurfaceEmissive(vtx.UV.x, vtx.UV.y);
 		result += lighting;
-		return lighting.lenSqr() > 0;
+		// a sampled vertex may miss its lights by chance, don't end the path on it
+		return lighting.lenSqr() > 0 || !exact;
 	}
 
-	Float4 ILBakerRaytrace::_doLighting(const Vertex& bakePoint, int texelIdxX, int texelIdxY)
+	double ILBakerRaytrace::sDeadline = 0;
+
+	void ILBakerRaytrace::SetDeadline(double seconds)
+	{
+		sDeadline = seconds;
+	}
+
+	double ILBakerRaytrace::GetSeconds()
+	{
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::duration<double>>(now).count();
+	}
+
+	Float3 ILBakerRaytrace::_traceSample(const Vertex& bakePoint, const Mat3& tangentToWorld, uint32 texelSeed, int sampleIdx, Float3& rayDirTS, bool& hitSky, float& hitDist)
+	{
+		Random& rand = _ctx.Random;
+		IntegrationSampleSet sampleSet;
+		sampleSet.Init(texelSeed, sampleIdx);
+
+		// Create a random ray direction in tangent space, then convert to world space
+		Float3 rayStart = bakePoint.Position;
+		rayDirTS = SampleCosineHemisphere(sampleSet.Pixel());
+		Float3 rayDir = Mat3::Transform(rayDirTS, tangentToWorld);
+		rayDir = Float3::Normalize(rayDir);
+
+		PathTraceParams params;
+		params.entity = _ctx.entity;
+		params.sampleSet = &sampleSet;
+		params.rayDir = rayDir;
+		params.rayStart = rayStart + 0.001f * rayDir;
+		params.rayLen = DEFAULT_RAYTRACE_MAX_LENGHT;
+		params.maxPathLength = _ctx.MaxPathLength;
+		params.russianRouletteDepth = _ctx.RussianRouletteDepth;
+		params.russianRouletteProbability = _ctx.RussianRouletteProbability;
+		params.skyRadiance = _ctx.SkyRadiance;
+		params.diffuseScale = _ctx.LightingScale;
+		if (World::Instance()->GetSetting()->GIRadianceCache) {
+			params.radianceCache = World::Instance()->GetRadianceCache();
+		}
+
+		hitSky = false;
+		PathTraceResult sampleResult = PathTrace(params, RTPathTraceFunc, rand, hitSky);
+		hitDist = sampleResult.hitDist;
+		return sampleResult.color;
+	}
+
+	Float4 ILBakerRaytrace::_doLighting(const Vertex& bakePoint, int texelIdxX, int texelIdxY, IrradianceRecord* record)
 	{
-		const int groupTexelIdxX = texelIdxX % BakeGroupSizeX;
-		const int groupTexelIdxY = texelIdxY % BakeGroupSizeY;
-		const int groupTexelIdx = groupTexelIdxX * groupTexelIdxY;
 		const int samplesPerTexel = _ctx.NumSqrtSamples * _ctx.NumSqrtSamples;
 
 		const int texelIdx = texelIdxY * _ctx.MapWidth + texelIdxX;
@@ -154,6 +182,8 @@ namespace LFX {
 			return Float4(0, 0, 0, 0);
 		}
 
+		const uint32 texelSeed = HashSeed(texelIdx);
+
 		Mat3 tangentToWorld;
 		tangentToWorld.SetXBasis(bakePoint.Tangent);
 		tangentToWorld.SetYBasis(bakePoint.Binormal);
@@ -162,35 +192,37 @@ namespace LFX {
 		DiffuseBaker baker;
 		baker.Init(samplesPerTexel);
 
-		// Loop over all texels in the 8x8 group, and compute 1 sample for each
+		Float3 gradient[3] = { Float3(0, 0, 0), Float3(0, 0, 0), Float3(0, 0, 0) };
+		float invDistSum = 0;
+
 		for (int sampleIdx = 0; sampleIdx < samplesPerTexel; ++sampleIdx)
 		{
-			Random& rand = _ctx.Random;
-			IntegrationSampleSet sampleSet;
-			sampleSet.Init(_ctx.Samples, groupTexelIdx, sampleIdx);
-
-			// Create a random ray direction in tangent space, then convert to world space
-			Float3 rayStart = bakePoint.Position;
-			//Float3 rayDirTS = SampleCosineHemisphere(sampleSet.Pixel());
-			Float3 rayDirTS = SampleCosineHemisphere(rand.RandomFloat2());
-			Float3 rayDir = Mat3::Transform(rayDirTS, tangentToWorld);
-			rayDir = Float3::Normalize(rayDir);
-
-			PathTraceParams params;
-			params.entity = _ctx.entity;
-			params.sampleSet = &sampleSet;
-			params.rayDir = rayDir;
-			params.rayStart = rayStart + 0.001f * rayDir;
-			params.rayLen = DEFAULT_RAYTRACE_MAX_LENGHT;
-			params.maxPathLength = _ctx.MaxPathLength;
-			//params.russianRouletteDepth = _ctx.RussianRouletteDepth;
-			//params.russianRouletteProbability = 0.5f;
-			params.skyRadiance = _ctx.SkyRadiance;
-			params.diffuseScale = _ctx.LightingScale;
-
+			Float3 rayDirTS;
 			bool hitSky = false;
-			PathTraceResult sampleResult = PathTrace(params, RTPathTraceFunc, rand, hitSky);
-			baker.AddSample(rayDirTS, sampleIdx, sampleResult.color, hitSky);
+			float hitDist = FLT_MAX;
+			Float3 sample = _traceSample(bakePoint, tangentToWorld, texelSeed, sampleIdx, rayDirTS, hitSky, hitDist);
+			baker.AddSample(rayDirTS, sampleIdx, sample, hitSky);
+
+			if (record != nullptr) {
+				// rotating the normal by the vector r changes cos(theta) by r.(n x d), divided by the cosine pdf
+				Float3 axis = Float3(-rayDirTS.y, rayDirTS.x, 0) / std::max(rayDirTS.z, 0.1f);
+				axis = Mat3::Transform(axis, tangentToWorld);
+				gradient[0] += axis * sample.x;
+				gradient[1] += axis * sample.y;
+				gradient[2] += axis * sample.z;
+				invDistSum += hitDist < FLT_MAX ? 1.0f / std::max(hitDist, 0.0001f) : 0.0f;
+			}
+		}
+
+		if (record != nullptr) {
+			const float factor = CosineWeightedMonteCarloFactor(samplesPerTexel);
+			record->Position = bakePoint.Position;
+			record->Normal = bakePoint.Normal;
+			record->Value = baker.ResultSum * factor;
+			for (int c = 0; c < 3; ++c) {
+				record->Gradient[c] = gradient[c] * factor;
+			}
+			record->Radius = invDistSum > 0 ? samplesPerTexel / invDistSum : FLT_MAX;
 		}
 
 		Float4 texelResults[1];
@@ -198,7 +230,219 @@ namespace LFX {
 		return texelResults[0];
 	}
 
-	void ILBakerRaytrace::Run(Entity* entity, int w, int h, const std::vector<RVertex>& rchart)
+	void ILBakerRaytrace::_doProgressiveLighting(const std::vector<RVertex>& rchart, const Rectangle<int>& rect)
+	{
+		struct TexelState
+		{
+			DiffuseBaker baker;
+			Mat3 tangentToWorld;
+			uint32 texelSeed;
+			// running mean and M2 of the sample luminance (Welford)
+			double mean;
+			double m2;
+			bool active;
+		};
+
+		const auto* settings = World::Instance()->GetSetting();
+		const int maxSamples = _ctx.NumSqrtSamples * _ctx.NumSqrtSamples;
+		const float threshold = settings->GINoiseThreshold;
+		// dark texels converge on an absolute error
+		const double minLuminance = 0.01;
+
+		std::vector<TexelState> texels(rchart.size());
+		int numActive = 0;
+		for (int v = rect.y, index = 0; v < rect.bottom(); ++v)
+		{
+			for (int u = rect.x; u < rect.right(); ++u, ++index)
+			{
+				TexelState& texel = texels[index];
+				const RVertex& bakePoint = rchart[index];
+
+				texel.baker.Init(0);
+				texel.tangentToWorld.SetXBasis(bakePoint.Tangent);
+				texel.tangentToWorld.SetYBasis(bakePoint.Binormal);
+				texel.tangentToWorld.SetZBasis(bakePoint.Normal);
+				texel.texelSeed = HashSeed(v * _ctx.MapWidth + u);
+				texel.mean = 0;
+				texel.m2 = 0;
+				texel.active = bakePoint.MaterialId != -1 && u < _ctx.MapWidth && v < _ctx.MapHeight;
+				numActive += texel.active ? 1 : 0;
+			}
+		}
+
+		for (int pass = 0; numActive > 0; ++pass)
+		{
+			const bool timeout = sDeadline > 0 && pass >= MinProgressivePasses && GetSeconds() > sDeadline;
+
+			for (size_t i = 0; i < texels.size(); ++i)
+			{
+				TexelState& texel = texels[i];
+				if (!texel.active) {
+					continue;
+				}
+
+				DiffuseBaker& baker = texel.baker;
+				if (!timeout) {
+					const int first = baker.NumSamples;
+					const int last = std::min(first + ProgressivePassSamples, maxSamples);
+					for (int sampleIdx = first; sampleIdx < last; ++sampleIdx)
+					{
+						Float3 rayDirTS;
+						bool hitSky = false;
+						float hitDist = FLT_MAX;
+						Float3 sample = _traceSample(rchart[i], texel.tangentToWorld, texel.texelSeed, sampleIdx, rayDirTS, hitSky, hitDist);
+						baker.AddSample(rayDirTS, sampleIdx, sample, hitSky);
+						baker.NumSamples = sampleIdx + 1;
+
+						const double lum = ILBaker::ComputeLuminance(sample);
+						const double delta = lum - texel.mean;
+						texel.mean += delta / baker.NumSamples;
+						texel.m2 += delta * (lum - texel.mean);
+					}
+
+					baker.FinalResult(&_ctx.BakeOutput[i]);
+				}
+
+				// the standard error of the mean against the noise threshold
+				const int n = baker.NumSamples;
+				bool converged = n >= maxSamples || timeout;
+				if (!converged && pass + 1 >= MinProgressivePasses && n > 1) {
+					const double stdError = sqrt(texel.m2 / (n - 1) / n);
+					converged = stdError <= threshold * std::max(texel.mean, minLuminance);
+				}
+
+				if (converged) {
+					texel.active = false;
+					--numActive;
+				}
+			}
+
+			if (_ctx.OnPass) {
+				_ctx.OnPass();
+			}
+		}
+	}
+
+	bool ILBakerRaytrace::_interpolate(const std::vector<IrradianceRecord>& records, const Vertex& bakePoint, float texelSize, Float4& result)
+	{
+		const float maxError = World::Instance()->GetSetting()->GIIrradianceCacheError;
+
+		Float3 sum = Float3(0, 0, 0);
+		float weightSum = 0;
+		for (const auto& record : records) {
+			const Float3 d = bakePoint.Position - record.Position;
+
+			// the record is in front of the texel
+			if (Float3::Dot(d, record.Normal + bakePoint.Normal) * 0.5f < -0.1f * texelSize) {
+				continue;
+			}
+
+			// [Ward 1988] error of the translation and the rotation
+			const float error = d.len() / record.Radius + std::sqrt(std::max(0.0f, 1.0f - Float3::Dot(bakePoint.Normal, record.Normal)));
+			if (error >= maxError) {
+				continue;
+			}
+
+			const Float3 r = Float3::Cross(record.Normal, bakePoint.Normal);
+			Float3 value = record.Value + Float3(r.dot(record.Gradient[0]), r.dot(record.Gradient[1]), r.dot(record.Gradient[2]));
+			value.x = std::max(value.x, 0.0f);
+			value.y = std::max(value.y, 0.0f);
+			value.z = std::max(value.z, 0.0f);
+
+			const float weight = 1.0f / std::max(error, 0.001f) - 1.0f / maxError;
+			sum += value * weight;
+			weightSum += weight;
+		}
+
+		if (weightSum <= 0) {
+			return false;
+		}
+
+		sum /= weightSum;
+		result.x = Clamp<float>(sum.x, 0.0f, FP16Max);
+		result.y = Clamp<float>(sum.y, 0.0f, FP16Max);
+		result.z = Clamp<float>(sum.z, 0.0f, FP16Max);
+		result.w = 1;
+		return true;
+	}
+
+	void ILBakerRaytrace::_doCachedLighting(const std::vector<RVertex>& rchart, const Rectangle<int>& rect)
+	{
+		const float maxError = World::Instance()->GetSetting()->GIIrradianceCacheError;
+
+		auto valid = [&](int u, int v) {
+			return rchart[(v - rect.y) * rect.w + (u - rect.x)].MaterialId != -1 && u < _ctx.MapWidth && v < _ctx.MapHeight;
+		};
+
+		// world size of a texel, the median distance of the neighbors
+		std::vector<float> distances;
+		for (int v = rect.y; v < rect.bottom(); ++v)
+		{
+			for (int u = rect.x; u < rect.right(); ++u)
+			{
+				const int index = (v - rect.y) * rect.w + (u - rect.x);
+				if (!valid(u, v)) {
+					continue;
+				}
+				if (u + 1 < rect.right() && valid(u + 1, v)) {
+					distances.push_back((rchart[index + 1].Position - rchart[index].Position).len());
+				}
+				if (v + 1 < rect.bottom() && valid(u, v + 1)) {
+					distances.push_back((rchart[index + rect.w].Position - rchart[index].Position).len());
+				}
+			}
+		}
+
+		float texelSize = 0;
+		if (!distances.empty()) {
+			std::nth_element(distances.begin(), distances.begin() + distances.size() / 2, distances.end());
+			texelSize = distances[distances.size() / 2];
+		}
+
+		// the records of isolated texels are used by themselves only
+		const float minRadius = std::max(texelSize * MinRecordTexels / maxError, 0.0001f);
+		const float maxRadius = std::max(texelSize * MaxRecordTexels / maxError, minRadius);
+
+		std::vector<IrradianceRecord> records;
+		std::vector<bool> done(rchart.size(), false);
+		auto bake = [&](int u, int v) {
+			const int index = (v - rect.y) * rect.w + (u - rect.x);
+
+			IrradianceRecord record;
+			_ctx.BakeOutput[index] = _doLighting(rchart[index], u, v, &record);
+			record.Radius = Clamp<float>(record.Radius, minRadius, maxRadius);
+			records.push_back(record);
+			done[index] = true;
+		};
+
+		// sparse records first, then the texels between them are interpolated if the records are close enough
+		for (int v = rect.y; v < rect.bottom(); v += RecordSpacing)
+		{
+			for (int u = rect.x; u < rect.right(); u += RecordSpacing)
+			{
+				if (valid(u, v)) {
+					bake(u, v);
+				}
+			}
+		}
+
+		for (int v = rect.y; v < rect.bottom(); ++v)
+		{
+			for (int u = rect.x; u < rect.right(); ++u)
+			{
+				const int index = (v - rect.y) * rect.w + (u - rect.x);
+				if (done[index] || !valid(u, v)) {
+					continue;
+				}
+
+				if (!_interpolate(records, rchart[index], texelSize, _ctx.BakeOutput[index])) {
+					bake(u, v);
+				}
+			}
+		}
+	}
+
+	void ILBakerRaytrace::Run(Entity* entity, int w, int h, const std::vector<RVertex>& rchart, const Rectangle<int>& rect)
 	{
 		_ctx.entity = entity;
 		_ctx.MapWidth = w;
@@ -206,18 +450,31 @@ namespace LFX {
 		_ctx.LightingScale = World::Instance()->GetSetting()->GIScale;
 		_ctx.NumSqrtSamples = World::Instance()->GetSetting()->GISamples;
 		_ctx.MaxPathLength = World::Instance()->GetSetting()->GIPathLength;
+		_ctx.RussianRouletteDepth = World::Instance()->GetSetting()->GIRussianRouletteDepth;
+		_ctx.RussianRouletteProbability = World::Instance()->GetSetting()->GIRussianRouletteProbability;
 		_ctx.SkyRadiance = World::Instance()->GetSetting()->SkyRadiance;
-		_ctx.BakeOutput.resize(w * h);
+		_ctx.BakeOutput.resize(rect.w * rect.h);
 		for (size_t i = 0; i < _ctx.BakeOutput.size(); ++i) {
 			_ctx.BakeOutput[i] = Float4(0, 0, 0, 0);
 		}
 
-		GenerateIntegrationSamples(_ctx.Samples, _ctx.NumSqrtSamples, BakeGroupSize, 1, 5, _ctx.Random);
+		// decorrelate the tiles
+		_ctx.Random.SetSeed(rect.y * w + rect.x);
+
+		if (World::Instance()->GetSetting()->GIProgressive) {
+			_doProgressiveLighting(rchart, rect);
+			return;
+		}
+
+		if (World::Instance()->GetSetting()->GIIrradianceCache && World::Instance()->GetSetting()->GIIrradianceCacheError > 0) {
+			_doCachedLighting(rchart, rect);
+			return;
+		}
 
 		int index = 0;
-		for (int v = 0; v < _ctx.MapHeight; ++v)
+		for (int v = rect.y; v < rect.bottom(); ++v)
 		{
-			for (int u = 0; u < _ctx.MapWidth; ++u)
+			for (int u = rect.x; u < rect.right(); ++u)
 			{
 				Float4 color = Float4(0, 0, 0, 0);
 				
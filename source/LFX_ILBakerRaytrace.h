@@ -3,6 +3,8 @@
 #include "LFX_ILBakerRandom.h"
 #include "LFX_ILBakerSampling.h"
 #include "LFX_ILBakerSamples.h"
+#include "LFX_ILPathTrace.h"
+#include <functional>
 
 namespace LFX {
 
@@ -10,10 +12,13 @@ namespace LFX {
 	{
 	public:
 		static const int TileSize = 16;
-		static const int BakeGroupSizeX = 8;
-		static const int BakeGroupSizeY = 8;
-		static const int BakeGroupSize = BakeGroupSizeX * BakeGroupSizeY;
-		static const int NumIntegrationTypes = 5;
+		// ģʽÿÿصĲ, ٲMinProgressivePassesֲж
+		static const int ProgressivePassSamples = 16;
+		static const int MinProgressivePasses = 2;
+		// նȻ: ȰRecordSpacingü¼, ¼Ч뾶[Min, Max]RecordTexels
+		static const int RecordSpacing = 4;
+		static constexpr float MinRecordTexels = 1.5f;
+		static constexpr float MaxRecordTexels = 8.0f;
 
 	public:
 		struct Config
@@ -40,21 +45,50 @@ namespace LFX {
 			int MapWidth = 0;
 			int MapHeight = 0;
 			int MaxPathLength = 0;
+			int RussianRouletteDepth = -1; // ʼ̶ĵ, -1ر
+			float RussianRouletteProbability = 0; // 
 			int NumSqrtSamples = 0;
 			float LightingScale = 0;
 			Float3 SkyRadiance;
 			ILBaker::Random Random;
-			ILBaker::IntegrationSamples Samples;
 			std::vector<Float4> BakeOutput;
+			// ģʽÿֽ, BakeOutputΪǰĽ
+			std::function<void()> OnPass;
 		};
 
 		Context _ctx;
 
 	public:
-		void Run(Entity* entity, int w, int h, const std::vector<RVertex>& rchart);
+		// rectڵ(w * hĹͼ)rchartBakeOutputСΪrect.w * rect.h
+		void Run(Entity* entity, int w, int h, const std::vector<RVertex>& rchart, const Rectangle<int>& rect);
+
+		// ģʽĽֹʱ(, steady clock), ʱزMinProgressivePasses־ͽ, 0ʾ
+		static void SetDeadline(double seconds);
+		static double GetSeconds();
 
 	protected:
-		Float4 _doLighting(const Vertex & bakerPoint, int texelIdxX, int texelIdxY);
+		// նȻ¼, GradientΪÿͨתݶ
+		struct IrradianceRecord
+		{
+			Float3 Position;
+			Float3 Normal;
+			Float3 Value;
+			Float3 Gradient[3];
+			float Radius; // оĵƽ
+		};
+
+		// recordΪʱͬʱ㻺¼
+		Float4 _doLighting(const Vertex & bakerPoint, int texelIdxX, int texelIdxY, IrradianceRecord* record = nullptr);
+		void _doProgressiveLighting(const std::vector<RVertex>& rchart, const Rectangle<int>& rect);
+		void _doCachedLighting(const std::vector<RVertex>& rchart, const Rectangle<int>& rect);
+		// øļ¼ֵ, ûЧ¼false
+		bool _interpolate(const std::vector<IrradianceRecord>& records, const Vertex& bakePoint, float texelSize, Float4& result);
+		Float3 _traceSample(const Vertex& bakePoint, const Mat3& tangentToWorld, uint32 texelSeed, int sampleIdx, Float3& rayDirTS, bool& hitSky, float& hitDist);
+
+		static double sDeadline;
 	};
 
+	// ·Ĺ, ͼ̽·ʹ, ԿԹȻ
+	bool RTPathTraceFunc(Float3& result, const ILBaker::PathTraceParams& params, const Ray& from, const Vertex& vtx, const Material* mtl, bool hitSky, ILBaker::Random& rand);
+
 }
\ No newline at end of file
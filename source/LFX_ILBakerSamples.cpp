@@ -99,4 +99,63 @@ namespace LFX { namespace ILBaker {
 		}
 	}
 
+	static uint32 ReverseBits(uint32 x)
+	{
+		x = (x << 16) | (x >> 16);
+		x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+		x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+		x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+		x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+		return x;
+	}
+
+	// Owen scrambling of the reversed bits [Laine and Karras 2011, Burley 2020]
+	static uint32 LaineKarrasPermutation(uint32 x, uint32 seed)
+	{
+		x += seed;
+		x ^= x * 0x6c50b47c;
+		x ^= x * 0xb82f1e52;
+		x ^= x * 0xc7afe638;
+		x ^= x * 0x8d22f6e6;
+		return x;
+	}
+
+	static uint32 NestedUniformScramble(uint32 x, uint32 seed)
+	{
+		x = ReverseBits(x);
+		x = LaineKarrasPermutation(x, seed);
+		return ReverseBits(x);
+	}
+
+	// the second Sobol dimension, the first one is the bit reversed index
+	static uint32 Sobol1(uint32 index)
+	{
+		uint32 result = 0;
+		for (uint32 v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+			if (index & 1)
+				result ^= v;
+		}
+		return result;
+	}
+
+	uint32 HashSeed(uint32 a, uint32 b)
+	{
+		uint32 x = a ^ (b * 0x9e3779b9);
+		x ^= x >> 16; x *= 0x7feb352d;
+		x ^= x >> 15; x *= 0x846ca68b;
+		x ^= x >> 16;
+		return x;
+	}
+
+	Float2 SampleSobol2D(uint32 index, uint32 seed)
+	{
+		// shuffle the sequence, then scramble every dimension with its own seed
+		index = NestedUniformScramble(index, seed);
+		uint32 x = NestedUniformScramble(ReverseBits(index), HashSeed(seed, 1));
+		uint32 y = NestedUniformScramble(Sobol1(index), HashSeed(seed, 2));
+
+		// 24 bits so the result stays below 1
+		return Float2((x >> 8) * (1.0f / (1 << 24)), (y >> 8) * (1.0f / (1 << 24)));
+	}
+
 }}
\ No newline at end of file
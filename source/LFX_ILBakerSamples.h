@@ -65,4 +65,11 @@ namespace LFX { namespace ILBaker {
 	void GenerateIntegrationSamples(IntegrationSamples& samples, int sqrtNumSamples,
 		int tileSizeX, int tileSizeY, int numIntegrationTypes, Random & rdm);
 
+	// Hashes the values into a seed for SampleSobol2D, e.g. the texel index
+	uint32 HashSeed(uint32 a, uint32 b = 0);
+
+	// Returns sample index of the Owen scrambled 2D Sobol sequence [Burley 2020]. Every prefix of
+	// the sequence is well stratified, the seed decorrelates the sequences of different texels.
+	Float2 SampleSobol2D(uint32 index, uint32 seed);
+
 }}
\ No newline at end of file
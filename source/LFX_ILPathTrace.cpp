@@ -4,6 +4,23 @@
 
 namespace LFX { namespace ILBaker {
 
+	void PathCacheRecorder::Flush(const PathTraceParams& params, const Float3& color)
+	{
+		if (params.radianceCache == nullptr) {
+			return;
+		}
+
+		for (int i = 0; i < count; ++i) {
+			const Entry& e = entries[i];
+			const Float3 c = color - e.colorBefore;
+			Float3 radiance;
+			radiance.x = e.throughput.x > 0 ? c.x / e.throughput.x : 0;
+			radiance.y = e.throughput.y > 0 ? c.y / e.throughput.y : 0;
+			radiance.z = e.throughput.z > 0 ? c.z / e.throughput.z : 0;
+			params.radianceCache->Add(e.position, e.normal, radiance);
+		}
+	}
+
 	PathTraceResult ILBaker::PathTrace(const PathTraceParams& params, PathTraceFunc func, Random& rand, bool& hitSky)
 	{
 		PathTraceResult result;
@@ -15,28 +32,42 @@ namespace LFX { namespace ILBaker {
 		// Keep tracing paths until we reach the specified max
 		Float3 throughput = Float3(1.0f, 1.0f, 1.0f);
 		Entity* traceEntity = params.entity;
+		PathCacheRecorder recorder;
 		const int maxPathLength = params.maxPathLength;
 		for (; result.pathLen <= maxPathLength || maxPathLength == -1; ++result.pathLen) {
-#if 0 // Disable russian roulette
-			// See if we should randomly terminate this path using Russian Roullete
-			const int rouletteDepth = params.RussianRouletteDepth;
-			if (pathLength >= rouletteDepth && rouletteDepth != -1) {
-				float continueProbability = std::min<float>(params.RussianRouletteProbability, ComputeLuminance(throughput));
-				if (randomGenerator.RandomFloat() > continueProbability) {
+			// See if we should randomly terminate this path using Russian Roullete, the surviving
+			// paths are divided by the continue probability so the estimate stays unbiased
+			const int rouletteDepth = params.russianRouletteDepth;
+			if (result.pathLen > rouletteDepth && rouletteDepth != -1) {
+				float continueProbability = std::min<float>(params.russianRouletteProbability, ComputeLuminance(throughput));
+				if (continueProbability <= 0 || rand.RandomFloat() > continueProbability) {
 					break;
 				}
 				throughput /= continueProbability;
-				irrThroughput /= continueProbability;
 			}
-#endif
 
 			// Set this to true to keep the loop going
 			bool continueTracing = false;
 
 			// Check for intersection with the scene
 			Contact contact;
-			if (World::Instance()->GetScene()->RayCheck(contact, ray, params.rayLen, LFX_TERRAIN | LFX_MESH)) {
+			bool hit = false;
+			// the first segment is traced by the caller
+			if (result.pathLen == 1 && params.primaryContact != nullptr) {
+				hit = params.primaryHit;
+				if (hit) {
+					contact = *params.primaryContact;
+				}
+			}
+			else {
+				hit = World::Instance()->GetScene()->RayCheck(contact, ray, params.rayLen, LFX_TERRAIN | LFX_MESH);
+			}
+
+			if (hit) {
 				traceEntity = contact.entity;
+				if (result.pathLen == 1) {
+					result.hitDist = contact.td;
+				}
 
 				// back facing
 				if (!contact.facing) {
@@ -46,12 +77,19 @@ namespace LFX { namespace ILBaker {
 				Vertex vtx = contact.vhit;
 				Material* mtl = (Material*)contact.mtl;
 
+				Float3 cached;
+				if (params.radianceCache && result.pathLen >= 2 && params.radianceCache->Lookup(vtx.Position, vtx.Normal, cached)) {
+					result.color += cached * throughput;
+					break;
+				}
+
 				Float3 diffuse;
-				if (!func(diffuse, params, ray, vtx, mtl, false)) {
+				if (!func(diffuse, params, ray, vtx, mtl, false, rand)) {
 					break;
 				}
 
 				float lenSq = (vtx.Position - ray.orig).lenSqr();
+				recorder.Push(vtx, throughput, result.color);
 				result.color += (diffuse * throughput) * mtl->GIWeight;
 				throughput = throughput * mtl->GetSurfaceDiffuse(vtx.UV.x, vtx.UV.y);
 
@@ -63,17 +101,13 @@ namespace LFX { namespace ILBaker {
 					tangentToWorld.SetZBasis(vtx.Normal);
 
 					Float2 sample;
-#if 0
-					// Randomly select if we should sample our diffuse BRDF, or our specular BRDF
-					if (result.pathLen <= 1) {
+					// the first bounce takes the stratified BRDF sample of the texel
+					if (params.sampleSet && result.pathLen <= 1) {
 						sample = params.sampleSet->BRDF();
 					}
 					else {
 						sample = rand.RandomFloat2();
 					}
-#else
-					sample = rand.RandomFloat2();
-#endif
 
 					// We're sampling the diffuse BRDF, so sample a cosine-weighted hemisphere
 					Float3 sampleDir;
@@ -90,7 +124,7 @@ namespace LFX { namespace ILBaker {
 			}
 			else {
 				Float3 diffuse;
-				if (func(diffuse, params, ray, Vertex(), nullptr, true)) {
+				if (func(diffuse, params, ray, Vertex(), nullptr, true, rand)) {
 					result.color += diffuse * throughput;
 				}
 				hitSky = true;
@@ -99,6 +133,7 @@ namespace LFX { namespace ILBaker {
 			if (continueTracing == false) break;
 		}
 
+		recorder.Flush(params, result.color);
 		return result;
 	}
 
@@ -9,6 +9,7 @@
 #include "LFX_Entity.h"
 #include "LFX_ILBakerMath.h"
 #include "LFX_ILBakerSamples.h"
+#include "LFX_RadianceCache.h"
 
 namespace LFX { namespace ILBaker {
 
@@ -37,6 +38,13 @@ namespace LFX { namespace ILBaker {
 			samples.GetSampleSet(pixelIdx, sampleIdx, Samples.data());
 		}
 
+		// every type takes its own Sobol sequence of the texel
+		void Init(uint32 texelSeed, int sampleIdx)
+		{
+			for (int typeIdx = 0; typeIdx < EIntegrationTypes::NumValues; ++typeIdx)
+				Samples[typeIdx] = SampleSobol2D(sampleIdx, HashSeed(texelSeed, typeIdx));
+		}
+
 		Float2 Pixel() const { return Samples[EIntegrationTypes::Pixel]; }
 		Float2 Lens() const { return Samples[EIntegrationTypes::Lens]; }
 		Float2 BRDF() const { return Samples[EIntegrationTypes::BRDF]; }
@@ -52,17 +60,54 @@ namespace LFX { namespace ILBaker {
 		Float3 rayDir;
 		float rayLen = 0.0f;
 		int maxPathLength = -1;
+		// bounces traced before the roulette starts, -1 disables it
 		int russianRouletteDepth = 4;
 		float russianRouletteProbability = 0.5f;
 
 		float diffuseScale;
 		Float3 skyRadiance;
+
+		// vertices after the first bounce end the path with the cached radiance if there is one
+		RadianceCache* radianceCache = nullptr;
+
+		// result of the first ray when it was traced in a batch already
+		const Contact* primaryContact = nullptr;
+		bool primaryHit = false;
+	};
+
+	// Collects the path vertices, their outgoing radiance is added to the radiance cache
+	// once the path is done: (color at the end - color before the vertex) / throughput
+	struct PathCacheRecorder
+	{
+		static const int kMaxVertices = 8;
+
+		struct Entry
+		{
+			Float3 position;
+			Float3 normal;
+			Float3 throughput;
+			Float3 colorBefore;
+		};
+
+		Entry entries[kMaxVertices];
+		int count = 0;
+
+		void Push(const Vertex& vtx, const Float3& throughput, const Float3& color)
+		{
+			if (count < kMaxVertices) {
+				entries[count++] = { vtx.Position, vtx.Normal, throughput, color };
+			}
+		}
+
+		void Flush(const PathTraceParams& params, const Float3& color);
 	};
 
 	struct PathTraceResult
 	{
 		int pathLen = 1;
 		Float3 color = Float3(0, 0, 0);
+		// distance to the first hit, FLT_MAX if the ray escapes
+		float hitDist = FLT_MAX;
 	};
 
 	typedef bool (*PathTraceFunc)(Float3& diffuse,
@@ -70,7 +115,8 @@ namespace LFX { namespace ILBaker {
 								const Ray& from,
 								const Vertex& vtx,
 								const Material* mtl,
-								bool hitSky);
+								bool hitSky,
+								Random& rand);
 
 	PathTraceResult PathTrace(const PathTraceParams& params, PathTraceFunc func, Random& rand, bool& hitSky);
 
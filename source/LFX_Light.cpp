@@ -31,10 +31,9 @@ namespace LFX {
 		return true;
 	}
 
-	float CalcShadowMask(const Float3& pos, Light* pLight, int queryFlags)
+	static float _ShadowRay(Ray& ray, const Float3& pos, Light* pLight)
 	{
 		float len = 0;
-		Ray ray;
 
 		if (pLight->Type != Light::DIRECTION) {
 			ray.dir = pLight->Position - pos;
@@ -48,6 +47,14 @@ namespace LFX {
 
 		ray.orig = pos + ray.dir * UNIT_LEN * 0.01f;
 
+		return len;
+	}
+
+	float CalcShadowMask(const Float3& pos, Light* pLight, int queryFlags)
+	{
+		Ray ray;
+		float len = _ShadowRay(ray, pos, pLight);
+
 		if (len > 0.01f * UNIT_LEN) {
 			if (World::Instance()->GetScene()->Occluded(ray, len, queryFlags)) {
 				return pLight->ShadowMask;
@@ -57,4 +64,105 @@ namespace LFX {
 		return 1.0f;
 	}
 
+	void CalcShadowMaskBatch(float* masks, const Float3* positions, int count, Light* pLight, int queryFlags)
+	{
+		static const int kBatchSize = 256;
+
+		Aabb bound;
+		bound.Invalid();
+		for (int i = 0; i < count; ++i) {
+			bound.Merge(positions[i]);
+		}
+
+		// 10 bits per axis
+		const Float3 extent = bound.Size();
+		const Float3 scale(
+			extent.x > 0 ? 1023.0f / extent.x : 0,
+			extent.y > 0 ? 1023.0f / extent.y : 0,
+			extent.z > 0 ? 1023.0f / extent.z : 0);
+
+		std::vector<std::pair<uint32, int>> order(count);
+		for (int i = 0; i < count; ++i) {
+			const Float3 p = (positions[i] - bound.minimum) * scale;
+			order[i].first = (MortonExpand((uint32)p.x) << 2) | (MortonExpand((uint32)p.y) << 1) | MortonExpand((uint32)p.z);
+			order[i].second = i;
+			masks[i] = 1.0f;
+		}
+		std::sort(order.begin(), order.end());
+
+		Ray rays[kBatchSize];
+		float lens[kBatchSize];
+		bool results[kBatchSize];
+		int indices[kBatchSize];
+		int n = 0;
+
+		Scene* scene = World::Instance()->GetScene();
+		auto flush = [&]() {
+			scene->OccludedBatch(results, rays, lens, n, queryFlags);
+			for (int k = 0; k < n; ++k) {
+				if (results[k]) {
+					masks[indices[k]] = pLight->ShadowMask;
+				}
+			}
+			n = 0;
+		};
+
+		for (int i = 0; i < count; ++i) {
+			const int index = order[i].second;
+			lens[n] = _ShadowRay(rays[n], positions[index], pLight);
+			if (lens[n] > 0.01f * UNIT_LEN) {
+				indices[n++] = index;
+				if (n == kBatchSize) {
+					flush();
+				}
+			}
+		}
+
+		if (n > 0) {
+			flush();
+		}
+	}
+
+	void CalcDirectLightingBatch(Float3* colors, float* shadowMasks, const Vertex* verts,
+		const Material* const* mtls, int count, Light* pLight, bool receiveShadow, int queryFlags)
+	{
+		if (pLight->DirectScale <= 0 && !pLight->SaveShadowMask) {
+			return;
+		}
+
+		std::vector<Float3> lit(count);
+		std::vector<float> kls(count, 0.0f);
+		std::vector<int> shadowed;
+		std::vector<Float3> positions;
+		for (int i = 0; i < count; ++i) {
+			World::Instance()->GetShader()->DoLighting(
+				lit[i], kls[i], Float3(0, 0, 0), verts[i], pLight, mtls[i], false, false
+			);
+			if (kls[i] >= 0 && pLight->CastShadow && receiveShadow) {
+				shadowed.push_back(i);
+				positions.push_back(verts[i].Position);
+			}
+		}
+
+		if (!shadowed.empty()) {
+			std::vector<float> masks(shadowed.size());
+			CalcShadowMaskBatch(&masks[0], &positions[0], (int)shadowed.size(), pLight, queryFlags);
+
+			for (size_t k = 0; k < shadowed.size(); ++k) {
+				const int i = shadowed[k];
+				kls[i] *= masks[k];
+				lit[i] *= masks[k];
+				if (shadowMasks != NULL) {
+					shadowMasks[i] = masks[k];
+				}
+			}
+		}
+
+		for (int i = 0; i < count; ++i) {
+			if (kls[i] > 0) {
+				colors[i] += lit[i] * pLight->DirectScale;
+			}
+		}
+	}
+
 }
\ No newline at end of file
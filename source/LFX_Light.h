@@ -6,6 +6,8 @@
 
 namespace LFX {
 
+	struct Material;
+
 	struct LFX_ENTRY LightmapValue
 	{
 		Float3 Diffuse;
@@ -98,6 +100,13 @@ namespace LFX {
 	LFX_ENTRY bool IsLightVisible(Light* pLight, const Aabb& bound);
 	LFX_ENTRY bool IsLightVisible(Light* pLight, const Float3& point);
 	LFX_ENTRY float CalcShadowMask(const Float3& pos, Light* pLight, int queryFlags);
+	// masks[i] = CalcShadowMask(positions[i]), the rays are sorted along a morton curve
+	// and traced in batches so the scene can use packet queries.
+	LFX_ENTRY void CalcShadowMaskBatch(float* masks, const Float3* positions, int count, Light* pLight, int queryFlags);
+	// Adds the direct lighting of pLight to colors[i], shadowMasks (optional) receives the
+	// shadow mask of the points that traced a shadow ray.
+	LFX_ENTRY void CalcDirectLightingBatch(Float3* colors, float* shadowMasks, const Vertex* verts,
+		const Material* const* mtls, int count, Light* pLight, bool receiveShadow, int queryFlags);
 
 	struct LFX_ENTRY SkyLight
 	{
@@ -0,0 +1,157 @@
+#include "LFX_LightIndex.h"
+#include "LFX_ILBakerMath.h"
+
+namespace LFX {
+
+	static Aabb _LightBound(Light* light)
+	{
+		const Float3 extend = Float3(light->AttenEnd, light->AttenEnd, light->AttenEnd);
+		return Aabb(light->Position - extend, light->Position + extend);
+	}
+
+	static float _DistSqr(const Float3& point, const Aabb& bound)
+	{
+		float d = 0;
+		for (int k = 0; k < 3; ++k) {
+			const float v = Clamp<float>(point[k], bound.minimum[k], bound.maximum[k]) - point[k];
+			d += v * v;
+		}
+		return d;
+	}
+
+	LightIndex::LightIndex()
+	{
+		Clear();
+	}
+
+	LightIndex::~LightIndex()
+	{
+	}
+
+	void LightIndex::Clear()
+	{
+		mGlobalLights.clear();
+		mLocalLights.clear();
+		mBound.Invalid();
+		mGridSize = Int3(0, 0, 0);
+		mInvCellSize = Float3(0, 0, 0);
+		mCells.clear();
+		mCellLights.clear();
+		mCellCdfs.clear();
+	}
+
+	void LightIndex::Build(const std::vector<Light*>& lights)
+	{
+		Clear();
+
+		for (auto* light : lights) {
+			if (!light->GIEnable) {
+				continue;
+			}
+
+			if (light->Type == Light::DIRECTION) {
+				mGlobalLights.push_back(light);
+			}
+			else {
+				mLocalLights.push_back(light);
+				mBound.Merge(_LightBound(light));
+			}
+		}
+
+		if (mLocalLights.empty()) {
+			return;
+		}
+
+		const Float3 size = mBound.Size();
+		const float cellSize = std::max(std::max(size.x, size.y), std::max(size.z, 0.01f)) / kMaxGridSize;
+		for (int k = 0; k < 3; ++k) {
+			mGridSize[k] = Clamp<int>((int)std::ceil(size[k] / cellSize), 1, kMaxGridSize);
+			mInvCellSize[k] = mGridSize[k] / std::max(size[k], 0.01f);
+		}
+
+		const Float3 cellExtent = Float3(1.0f / mInvCellSize.x, 1.0f / mInvCellSize.y, 1.0f / mInvCellSize.z);
+		const float minDistSqr = (cellExtent * 0.5f).lenSqr();
+
+		std::vector<std::vector<int>> cellLights(mGridSize.x * mGridSize.y * mGridSize.z);
+		for (int i = 0; i < (int)mLocalLights.size(); ++i) {
+			const Aabb bound = _LightBound(mLocalLights[i]);
+
+			Int3 first, last;
+			for (int k = 0; k < 3; ++k) {
+				first[k] = Clamp<int>((int)((bound.minimum[k] - mBound.minimum[k]) * mInvCellSize[k]), 0, mGridSize[k] - 1);
+				last[k] = Clamp<int>((int)((bound.maximum[k] - mBound.minimum[k]) * mInvCellSize[k]), 0, mGridSize[k] - 1);
+			}
+
+			for (int z = first.z; z <= last.z; ++z) {
+				for (int y = first.y; y <= last.y; ++y) {
+					for (int x = first.x; x <= last.x; ++x) {
+						cellLights[(z * mGridSize.y + y) * mGridSize.x + x].push_back(i);
+					}
+				}
+			}
+		}
+
+		mCells.resize(cellLights.size());
+		for (int z = 0; z < mGridSize.z; ++z) {
+			for (int y = 0; y < mGridSize.y; ++y) {
+				for (int x = 0; x < mGridSize.x; ++x) {
+					const int index = (z * mGridSize.y + y) * mGridSize.x + x;
+					const auto& list = cellLights[index];
+
+					Aabb cellBound;
+					cellBound.minimum = mBound.minimum + Float3(x * cellExtent.x, y * cellExtent.y, z * cellExtent.z);
+					cellBound.maximum = cellBound.minimum + cellExtent;
+
+					mCells[index].offset = (int)mCellLights.size();
+					mCells[index].count = (int)list.size();
+
+					// estimated contribution: power over the squared distance to the cell, never zero
+					// so every light overlapping the cell can be picked
+					float sum = 0;
+					for (int i : list) {
+						Light* light = mLocalLights[i];
+						const float power = std::max(ILBaker::ComputeLuminance(light->Color) * light->IndirectScale, 1e-6f);
+						sum += power / std::max(_DistSqr(light->Position, cellBound), minDistSqr);
+						mCellLights.push_back(i);
+						mCellCdfs.push_back(sum);
+					}
+
+					for (int i = 0; i < (int)list.size(); ++i) {
+						mCellCdfs[mCells[index].offset + i] /= sum;
+					}
+					if (!list.empty()) {
+						mCellCdfs.back() = 1.0f;
+					}
+				}
+			}
+		}
+	}
+
+	const LightIndex::Cell* LightIndex::GetCell(const Float3& point) const
+	{
+		if (mCells.empty()) {
+			return nullptr;
+		}
+
+		Int3 coord;
+		for (int k = 0; k < 3; ++k) {
+			if (point[k] < mBound.minimum[k] || point[k] > mBound.maximum[k]) {
+				return nullptr;
+			}
+
+			coord[k] = std::min((int)((point[k] - mBound.minimum[k]) * mInvCellSize[k]), mGridSize[k] - 1);
+		}
+
+		return &mCells[(coord.z * mGridSize.y + coord.y) * mGridSize.x + coord.x];
+	}
+
+	int LightIndex::_sample(const Cell& cell, float u, float& pdf) const
+	{
+		const float* cdf = &mCellCdfs[cell.offset];
+		const int index = std::min((int)(std::upper_bound(cdf, cdf + cell.count, u) - cdf), cell.count - 1);
+
+		pdf = index > 0 ? cdf[index] - cdf[index - 1] : cdf[0];
+		return index;
+	}
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "LFX_Light.h"
+#include "LFX_ILBakerRandom.h"
+
+namespace LFX {
+
+	// Uniform grid of the GI lights for next event estimation on path vertices. Every cell
+	// keeps the local lights whose range overlaps it with a cdf of their estimated contribution,
+	// direction lights are global and evaluated everywhere.
+	class LFX_ENTRY LightIndex
+	{
+	public:
+		// cells with more lights than this are sampled instead of evaluated
+		static const int kMaxExactLights = 4;
+		static const int kNumLightSamples = 2;
+		static const int kMaxGridSize = 32;
+
+		struct Cell
+		{
+			int offset;
+			int count;
+		};
+
+	public:
+		LightIndex();
+		~LightIndex();
+
+		void Clear();
+		void Build(const std::vector<Light*>& lights);
+
+		const std::vector<Light*>& GetGlobalLights() const { return mGlobalLights; }
+		const Cell* GetCell(const Float3& point) const;
+
+		// Calls func(light, weight) for the lights reaching point, the weight is 1 for the lights
+		// which are evaluated and 1 / (pdf * kNumLightSamples) for the sampled ones.
+		// Returns false if the lights were sampled.
+		template <class Func>
+		bool ForEachLight(const Float3& point, ILBaker::Random& rand, Func func) const;
+
+	protected:
+		int _sample(const Cell& cell, float u, float& pdf) const;
+
+	protected:
+		std::vector<Light*> mGlobalLights;
+		std::vector<Light*> mLocalLights;
+
+		Aabb mBound;
+		Int3 mGridSize;
+		Float3 mInvCellSize;
+		std::vector<Cell> mCells;
+		// per cell light indices and the normalized cdf of their weights
+		std::vector<int> mCellLights;
+		std::vector<float> mCellCdfs;
+	};
+
+	template <class Func>
+	bool LightIndex::ForEachLight(const Float3& point, ILBaker::Random& rand, Func func) const
+	{
+		for (auto* light : mGlobalLights) {
+			func(light, 1.0f);
+		}
+
+		const Cell* cell = GetCell(point);
+		if (cell == nullptr || cell->count == 0) {
+			return true;
+		}
+
+		if (cell->count <= kMaxExactLights) {
+			for (int i = 0; i < cell->count; ++i) {
+				Light* light = mLocalLights[mCellLights[cell->offset + i]];
+				if (IsLightVisible(light, point)) {
+					func(light, 1.0f);
+				}
+			}
+			return true;
+		}
+
+		for (int i = 0; i < kNumLightSamples; ++i) {
+			float pdf = 0;
+			const int index = _sample(*cell, rand.RandomFloat(), pdf);
+			Light* light = mLocalLights[mCellLights[cell->offset + index]];
+			if (pdf > 0 && IsLightVisible(light, point)) {
+				func(light, 1.0f / (pdf * kNumLightSamples));
+			}
+		}
+
+		return false;
+	}
+
+}
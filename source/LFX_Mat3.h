@@ -97,6 +97,61 @@ namespace LFX {
 			r.z = v.x * m._13 + v.y * m._23 + v.z * m._33;
 			return r;
 		}
+
+		static Mat4 Identity()
+		{
+			Mat4 m;
+			m.SetXBasis(Float3(1, 0, 0));
+			m.SetYBasis(Float3(0, 1, 0));
+			m.SetZBasis(Float3(0, 0, 1));
+			m.SetTranslate(Float3(0, 0, 0));
+			return m;
+		}
+
+		// a then b, row vectors
+		static Mat4 Multiply(const Mat4& a, const Mat4& b)
+		{
+			const float* A = &a._11;
+			const float* B = &b._11;
+
+			Mat4 r;
+			float* R = &r._11;
+			for (int i = 0; i < 4; ++i) {
+				for (int j = 0; j < 4; ++j) {
+					R[i * 4 + j] = A[i * 4 + 0] * B[0 * 4 + j] + A[i * 4 + 1] * B[1 * 4 + j]
+						+ A[i * 4 + 2] * B[2 * 4 + j] + A[i * 4 + 3] * B[3 * 4 + j];
+				}
+			}
+			return r;
+		}
+
+		// inverse of an affine transform (the last column is 0, 0, 0, 1)
+		static Mat4 InverseAffine(const Mat4& m)
+		{
+			const float c11 = m._22 * m._33 - m._23 * m._32;
+			const float c12 = m._23 * m._31 - m._21 * m._33;
+			const float c13 = m._21 * m._32 - m._22 * m._31;
+			const float det = m._11 * c11 + m._12 * c12 + m._13 * c13;
+			const float invDet = det != 0 ? 1.0f / det : 0.0f;
+
+			Mat4 r;
+			r._11 = c11 * invDet;
+			r._12 = (m._13 * m._32 - m._12 * m._33) * invDet;
+			r._13 = (m._12 * m._23 - m._13 * m._22) * invDet;
+			r._14 = 0;
+			r._21 = c12 * invDet;
+			r._22 = (m._11 * m._33 - m._13 * m._31) * invDet;
+			r._23 = (m._13 * m._21 - m._11 * m._23) * invDet;
+			r._24 = 0;
+			r._31 = c13 * invDet;
+			r._32 = (m._12 * m._31 - m._11 * m._32) * invDet;
+			r._33 = (m._11 * m._22 - m._12 * m._21) * invDet;
+			r._34 = 0;
+
+			const Float3 t = TransformN(Float3(m._41, m._42, m._43), r);
+			r.SetTranslate(Float3(-t.x, -t.y, -t.z));
+			return r;
+		}
 	};
 
 }
\ No newline at end of file
@@ -179,6 +179,17 @@ namespace LFX {
 		return 0;
 	}
 
+	// spreads the lower 10 bits of x to every third bit, for 30 bit morton codes
+	inline uint32 MortonExpand(uint32 x)
+	{
+		x &= 0x3FF;
+		x = (x | (x << 16)) & 0x030000FF;
+		x = (x | (x << 8)) & 0x0300F00F;
+		x = (x | (x << 4)) & 0x030C30C3;
+		x = (x | (x << 2)) & 0x09249249;
+		return x;
+	}
+
 	inline float Saturate(float r)
 	{
 		return Clamp<float>(r, 0, 1);
@@ -5,6 +5,7 @@
 #include "LFX_RasterizerScan2.h"
 //#include "LFX_RasterizerZSpan.h"
 #include "LFX_ILBakerRaytrace.h"
+#include "LFX_Denoiser.h"
 #include "LFX_EmbreeScene.h"
 
 namespace LFX {
@@ -14,6 +15,9 @@ namespace LFX {
 		mCastShadow = true;
 		mReceiveShadow = true;
 		mLightingMapSize = 0;
+		mSource = NULL;
+		mTransform = Mat4::Identity();
+		mInvTransform = Mat4::Identity();
 	}
 
 	Mesh::~Mesh()
@@ -22,7 +26,7 @@ namespace LFX {
 		mTriBuffer.clear();
 		mMtlBuffer.clear();
 
-		mBSPTree.Clear();
+		mBVH.Clear();
 	}
 
 	void Mesh::SetName(const String& name)
@@ -54,11 +58,41 @@ namespace LFX {
 	{
 	}
 
+	void Mesh::SetInstance(Mesh* source, const Mat4& transform)
+	{
+		assert(source != NULL && !source->IsInstance());
+
+		mSource = source;
+		mTransform = transform;
+		mInvTransform = Mat4::InverseAffine(transform);
+	}
+
 	void Mesh::Build()
 	{
-		if (mVertexBuffer.size() == 0)
-			return;
+		if (mSource != NULL)
+		{
+			_buildInstance();
+		}
+		else
+		{
+			if (mVertexBuffer.size() == 0)
+				return;
+
+			_buildGeometry();
+		}
 
+		if (mLightingMapSize > 0)
+		{
+			mLightingMap.resize(mLightingMapSize * mLightingMapSize);
+			for (int i = 0; i < mLightingMapSize * mLightingMapSize; ++i)
+			{
+				mLightingMap[i] = LightmapValue();
+			}
+		}
+	}
+
+	void Mesh::_buildGeometry()
+	{
 		Aabb bound;
 		bound.minimum = mVertexBuffer[0].Position;
 		bound.maximum = mVertexBuffer[0].Position;
@@ -74,48 +108,137 @@ namespace LFX {
 			mUVMax = Maximum(mVertexBuffer[i].LUV, mUVMax);
 		}
 
-		mBSPTree.Build(bound, 8);
+		mBound = bound;
 
+		std::vector<Aabb> triBounds(mTriBuffer.size());
 		for (int i = 0; i < mTriBuffer.size(); ++i)
 		{
-			bool hr = _addTri(mBSPTree.RootNode(), i);
-			assert(hr);
+			const Triangle & triangle = mTriBuffer[i];
+
+			triBounds[i].Invalid();
+			triBounds[i].Merge(mVertexBuffer[triangle.Index0].Position);
+			triBounds[i].Merge(mVertexBuffer[triangle.Index1].Position);
+			triBounds[i].Merge(mVertexBuffer[triangle.Index2].Position);
 		}
+		mBVH.Build(triBounds);
 
 		_generateTangent();
-		_optimize(mBSPTree.RootNode());
+	}
+
+	void Mesh::_buildInstance()
+	{
+		// the source is built first, it is loaded before its instances
+		assert(mSource->Valid());
+
+		mUVMin = mSource->mUVMin;
+		mUVMax = mSource->mUVMax;
 
+		Float3 corners[8];
+		mSource->GetBound().GetCorner(corners);
+		mBound.Invalid();
+		for (int i = 0; i < 8; ++i)
+		{
+			mBound.Merge(Mat4::Transform(corners[i], mTransform));
+		}
+
+		// the lighting map is rasterized from world space geometry, the triangles and materials
+		// are still shared with the source
 		if (mLightingMapSize > 0)
 		{
-			mLightingMap.resize(mLightingMapSize * mLightingMapSize);
-			for (int i = 0; i < mLightingMapSize * mLightingMapSize; ++i)
+			mVertexBuffer.resize(mSource->mVertexBuffer.size());
+			for (int i = 0; i < mVertexBuffer.size(); ++i)
 			{
-				mLightingMap[i] = LightmapValue();
+				mVertexBuffer[i] = _toWorld(mSource->mVertexBuffer[i]);
 			}
 		}
 	}
 
+	void Mesh::ApplyTransform(const Mat4& transform)
+	{
+		if (mSource != NULL)
+		{
+			SetInstance(mSource, Mat4::Multiply(mTransform, transform));
+			return;
+		}
+
+		const Mat4 inv = Mat4::InverseAffine(transform);
+		for (int i = 0; i < mVertexBuffer.size(); ++i)
+		{
+			mVertexBuffer[i] = _transformVertex(mVertexBuffer[i], transform, inv);
+		}
+	}
+
+	Vertex Mesh::_toWorld(const Vertex& v)
+	{
+		return _transformVertex(v, mTransform, mInvTransform);
+	}
+
+	Vertex Mesh::_transformVertex(const Vertex& v, const Mat4& m, const Mat4& inv)
+	{
+		Vertex r = v;
+		r.Position = Mat4::Transform(v.Position, m);
+		// normals are transformed by the inverse transpose
+		r.Normal = Float3(
+			v.Normal.dot(Float3(inv._11, inv._12, inv._13)),
+			v.Normal.dot(Float3(inv._21, inv._22, inv._23)),
+			v.Normal.dot(Float3(inv._31, inv._32, inv._33)));
+		r.Tangent = Mat4::TransformN(v.Tangent, m);
+		r.Binormal = Mat4::TransformN(v.Binormal, m);
+		r.Normal.normalize();
+		r.Tangent.normalize();
+		r.Binormal.normalize();
+
+		return r;
+	}
+
+	Ray Mesh::_toLocal(const Ray& ray)
+	{
+		// the direction is not normalized, so the hit distances are the same in both spaces
+		Ray r;
+		r.orig = Mat4::Transform(ray.orig, mInvTransform);
+		r.dir = Mat4::TransformN(ray.dir, mInvTransform);
+
+		return r;
+	}
+
+	Float3 Mesh::_getPosition(int i)
+	{
+		if (mSource != NULL && mVertexBuffer.empty())
+			return Mat4::Transform(mSource->mVertexBuffer[i].Position, mTransform);
+
+		return mVertexBuffer[i].Position;
+	}
+
+	void Mesh::_getHitVertex(Vertex& v, int triIndex, float tu, float tv)
+	{
+		const Triangle& triangle = _getTriangle(triIndex);
+		const std::vector<Vertex>& vertices = _getVertexBuffer();
+
+		Vertex::Lerp(v, vertices[triangle.Index0], vertices[triangle.Index1], vertices[triangle.Index2], tu, tv);
+		if (mSource != NULL && mVertexBuffer.empty())
+		{
+			v = _toWorld(v);
+		}
+	}
+
 	bool Mesh::Valid()
 	{
-		return mBSPTree.RootNode() != NULL;
+		return mSource != NULL ? mSource->Valid() : mBVH.Valid();
 	}
 
 	const Aabb & Mesh::GetBound()
 	{
 		assert(Valid());
-		return mBSPTree.RootNode()->aabb;
+		return mBound;
 	}
 
-	void Mesh::_rayCheckImp(Contact & contract, BSPTree<int>::Node * node, const Ray & ray, float length)
+	void Mesh::_rayCheckImp(Contact & contract, int first, int count, const Ray & ray, float length)
 	{
 		float dist = 0;
 
-		if (!Intersect(ray, &dist, node->aabb) || dist >= contract.td || dist >= length)
-			return;
-
-		for (int i = 0; i < node->elems.size(); ++i)
+		for (int i = first; i < first + count; ++i)
 		{
-			int triIndex = node->elems[i];
+			int triIndex = mBVH.GetPrimitive(i);
 			const Triangle & triangle = mTriBuffer[triIndex];
 
 			const Float3 & a = mVertexBuffer[triangle.Index0].Position;
@@ -154,23 +277,15 @@ namespace LFX {
 				Vertex::Lerp(contract.vhit, v0, v1, v2, tu, tv);
 			}
 		}
-
-		if (node->child[0] != NULL)
-			_rayCheckImp(contract, node->child[0], ray, length);
-
-		if (node->child[1] != NULL)
-			_rayCheckImp(contract, node->child[1], ray, length);
 	}
 
-	bool Mesh::_occludedImp(BSPTree<int>::Node * node, const Ray & ray, float length)
+	bool Mesh::_occludedImp(int first, int count, const Ray & ray, float length)
 	{
 		float dist = 0;
-		if (!Intersect(ray, &dist, node->aabb) || dist >= length)
-			return false;
 
-		for (int i = 0; i < node->elems.size(); ++i)
+		for (int i = first; i < first + count; ++i)
 		{
-			int triIndex = node->elems[i];
+			int triIndex = mBVH.GetPrimitive(i);
 			const Triangle & triangle = mTriBuffer[triIndex];
 
 			const Float3 & a = mVertexBuffer[triangle.Index0].Position;
@@ -202,14 +317,6 @@ namespace LFX {
 			}
 		}
 
-		if (node->child[0] != NULL && _occludedImp(node->child[0], ray, length)) {
-			return true;
-		}
-
-		if (node->child[1] != NULL && _occludedImp(node->child[1], ray, length)) {
-			return true;
-		}
-
 		return false;
 	}
 
@@ -217,46 +324,50 @@ namespace LFX {
 	{
 		assert(Valid());
 
-		if (mCastShadow)
-		{
-			_rayCheckImp(contract, mBSPTree.RootNode(), ray, length);
-		}
-	}
-
-	bool Mesh::Occluded(const Ray & ray, float length)
-	{
-		assert(Valid());
+		if (!mCastShadow)
+			return;
 
-		if (mCastShadow)
+		if (mSource != NULL)
 		{
-			return _occludedImp(mBSPTree.RootNode(), ray, length);
+			const float td = contract.td;
+			mSource->_rayCheckBVH(contract, _toLocal(ray), length);
+			if (contract.td < td)
+			{
+				contract.entity = this;
+				contract.vhit = _toWorld(contract.vhit);
+			}
+			return;
 		}
 
-		return false;
+		_rayCheckBVH(contract, ray, length);
 	}
 
-	bool Mesh::_addTri(BSPTree<int>::Node * node, int t)
+	void Mesh::_rayCheckBVH(Contact & contract, const Ray & ray, float length)
 	{
-		const Triangle & triangle = mTriBuffer[t];
-
-		const Float3 & a = mVertexBuffer[triangle.Index0].Position;
-		const Float3 & b = mVertexBuffer[triangle.Index1].Position;
-		const Float3 & c = mVertexBuffer[triangle.Index2].Position;
+		mBVH.RayCheck(ray, std::min(contract.td, length), [&](int first, int count) {
+			_rayCheckImp(contract, first, count, ray, length);
+			return std::min(contract.td, length);
+		});
+	}
 
-		if (node->aabb.Contain(a) && node->aabb.Contain(b) && node->aabb.Contain(c))
-		{
-			if (node->child[0] != NULL && _addTri(node->child[0], t))
-				return true;
+	bool Mesh::Occluded(const Ray & ray, float length)
+	{
+		assert(Valid());
 
-			if (node->child[1] != NULL && _addTri(node->child[1], t))
-				return true;
+		if (!mCastShadow)
+			return false;
 
-			node->elems.push_back(t);
+		if (mSource != NULL)
+			return mSource->_occludedBVH(_toLocal(ray), length);
 
-			return true;
-		}
+		return _occludedBVH(ray, length);
+	}
 
-		return false;
+	bool Mesh::_occludedBVH(const Ray & ray, float length)
+	{
+		return mBVH.Occluded(ray, length, [&](int first, int count) {
+			return _occludedImp(first, count, ray, length);
+		});
 	}
 
 	void Mesh::_generateTangent()
@@ -361,187 +472,195 @@ namespace LFX {
 		delete[] faceSts;
 	}
 
-	Aabb Mesh::_optimize(BSPTree<int>::Node * node)
+	void Mesh::BeginLighting(bool direct, bool indirect, bool ao)
 	{
-		if (node->child[0] == NULL)
-		{
-			if (node->elems.size() > 0)
+		assert(mLightingMapSize > 0);
+
+		const int width = mLightingMapSize;
+		const int height = mLightingMapSize;
+		const int border = LMAP_BORDER;
+		const int tileSize = ILBakerRaytrace::TileSize;
+		const int tiles = (mLightingMapSize + tileSize - 1) / tileSize;
+
+		mTileTriangles.clear();
+		mTileTriangles.resize(tiles * tiles);
+
+		// bin the triangles to the tiles they cover
+		if (direct || ao) {
+			for (int i = 0; i < NumOfTriangles(); ++i)
 			{
-				Aabb bound;
-				bound.Invalid();
+				const Triangle& tri = _getTriangle(i);
+				const Vertex& a = _getVertex(tri.Index0);
+				const Vertex& b = _getVertex(tri.Index1);
+				const Vertex& c = _getVertex(tri.Index2);
 
-				for (int i = 0; i < node->elems.size(); ++i)
-				{
-					const Triangle & triangle = mTriBuffer[node->elems[i]];
-					const Float3 & a = mVertexBuffer[triangle.Index0].Position;
-					const Float3 & b = mVertexBuffer[triangle.Index1].Position;
-					const Float3 & c = mVertexBuffer[triangle.Index2].Position;
-
-					bound.Merge(a);
-					bound.Merge(b);
-					bound.Merge(c);
+				if (a.LUV == b.LUV && a.LUV == c.LUV) {
+					continue;
 				}
 
-				node->aabb = bound;
+				Float2 A = Rasterizer::Texel(a.LUV, width, height, border);
+				Float2 B = Rasterizer::Texel(b.LUV, width, height, border);
+				Float2 C = Rasterizer::Texel(c.LUV, width, height, border);
+
+				int x0 = Clamp<int>((int)Min(A.x, B.x, C.x), 0, width - 1) / tileSize;
+				int y0 = Clamp<int>((int)Min(A.y, B.y, C.y), 0, height - 1) / tileSize;
+				int x1 = Clamp<int>((int)Max(A.x, B.x, C.x), 0, width - 1) / tileSize;
+				int y1 = Clamp<int>((int)Max(A.y, B.y, C.y), 0, height - 1) / tileSize;
+				for (int y = y0; y <= y1; ++y) {
+					for (int x = x0; x <= x1; ++x) {
+						mTileTriangles[y * tiles + x].push_back(i);
+					}
+				}
+			}
+		}
+
+		mLightingMutex.Lock();
+		if (direct) {
+			mDirectMap.resize(width * height);
+			mShadowMap.resize(width * height);
+			for (int i = 0; i < width * height; ++i) {
+				mDirectMap[i] = Float4(0, 0, 0, 0);
+				mShadowMap[i] = 0.0f;
 			}
 		}
-		else
-		{
-			Aabb bound = _optimize(node->child[0]);
-			bound.Merge(_optimize(node->child[1]));
 
-			node->aabb = bound;
+		if (indirect) {
+			RasterizerSoft rasterizer(this, width, height);
+			rasterizer.DoRasterize();
+			mGIChart.swap(rasterizer._rchart);
+
+			mIndirectMap.resize(width * height);
+			for (int i = 0; i < width * height; ++i) {
+				mIndirectMap[i] = Float4(0, 0, 0, 0);
+			}
 		}
+		mLightingMutex.Unlock();
 
-		return node->aabb;
+		if (ao) {
+			mAOMap.resize(width * height);
+			for (int i = 0; i < width * height; ++i) {
+				mAOMap[i] = Float4(0, 0, 0, 0);
+			}
+		}
 	}
 
-	void Mesh::CalcuDirectLighting(const std::vector<Light *> & lights)
+	int Mesh::NumOfLightingTiles()
 	{
-		assert(mLightingMapSize > 0);
+		return (int)mTileTriangles.size();
+	}
 
+	Rectangle<int> Mesh::GetLightingTile(int tile)
+	{
+		const int tileSize = ILBakerRaytrace::TileSize;
+		const int tiles = (mLightingMapSize + tileSize - 1) / tileSize;
+
+		Rectangle<int> rect;
+		rect.x = (tile % tiles) * tileSize;
+		rect.y = (tile / tiles) * tileSize;
+		rect.w = std::min(tileSize, mLightingMapSize - rect.x);
+		rect.h = std::min(tileSize, mLightingMapSize - rect.y);
+		return rect;
+	}
+
+	void Mesh::CalcuDirectLighting(int tile, const std::vector<Light *> & lights)
+	{
 		const int width = mLightingMapSize;
 		const int height = mLightingMapSize;
 		const int msaa = World::Instance()->GetSetting()->MSAA;
 		const int border = LMAP_BORDER;
 
-		std::vector<Float4> lmap(width * height);
-		std::vector<float> mmap(width * height);
+		auto& lmap = mDirectMap;
+		auto& mmap = mShadowMap;
 
-		for (int i = 0; i < mmap.size(); ++i) {
-			mmap[i] = 0.0f;
-		}
+		// record the samples first, the shadow rays of each light are traced in batches
+		std::vector<int> texels;
+		std::vector<Vertex> verts;
+		std::vector<const Material*> mtls;
 
 		RasterizerScan2 rs(this, width, height, msaa, border);
-		rs.F = [this, &lmap, &mmap, width, &lights](const Float2& texel, const Vertex& v, int mtlId) {
+		rs.F = [this, &texels, &verts, &mtls, width](const Float2& texel, const Vertex& v, int mtlId) {
 			int x = static_cast<int>(texel.x);
 			int y = static_cast<int>(texel.y);
 
-			float shadowMask = 1.0f;
-			Float3 color = Float3(0, 0, 0);
-			for (auto* light : lights)
-			{
+			texels.push_back(y * width + x);
+			verts.push_back(v);
+			mtls.push_back(&_getMaterial(mtlId));
+		};
+		rs.DoRasterize(mTileTriangles[tile], GetLightingTile(tile));
+
+		const int count = (int)verts.size();
+		if (count == 0)
+			return;
+
+		std::vector<Float3> colors(count, Float3(0, 0, 0));
+		std::vector<float> shadowMasks(count, 1.0f);
+		for (auto* light : lights)
+		{
 #ifndef LFX_DEBUG_LUV
-				color += _doDirectLighting(v, mtlId, light, shadowMask);
+			CalcDirectLightingBatch(&colors[0], &shadowMasks[0], &verts[0], &mtls[0], count,
+				light, mReceiveShadow, LFX_MESH | LFX_TERRAIN);
 #else
+			for (auto& color : colors)
 				color += Float3(0.5f, 0.5f, 0.5f);
 #endif
-				//color += Float3::ONE;
-			}
+		}
 
-			lmap[y * width + x] += Float4(color.x, color.y, color.z, 1/*samples*/);
+		mLightingMutex.Lock();
+		for (int i = 0; i < count; ++i)
+		{
+			const Float3& color = colors[i];
+			lmap[texels[i]] += Float4(color.x, color.y, color.z, 1/*samples*/);
 #ifdef LFX_DEBUG_LUV
-			lmap[y * width + x].w = 1;
+			lmap[texels[i]].w = 1;
 #endif
-			mmap[y * width + x] += shadowMask;
-		};
-		rs.DoRasterize();
-
-		for (int y = 0; y < height; ++y)
-		{
-			for (int x = 0; x < width; ++x)
-			{
-				Float4& c = lmap[y * width + x];
-				float& m = mmap[y * width + x];
-				if (c.w > 1) {
-					float invSampels = 1.0f / c.w;
-					c.x *= invSampels;
-					c.y *= invSampels;
-					c.z *= invSampels;
-					m *= invSampels;
-				}
-			}
-		}
-
-		if (LMAP_OPTIMIZE_PX > 0) {
-			Rasterizer::Optimize(&lmap[0], width, height, LMAP_OPTIMIZE_PX);
+			mmap[texels[i]] += shadowMasks[i];
 		}
+		mLightingMutex.Unlock();
+	}
 
-		if (World::Instance()->GetSetting()->Filter) {
-			Rasterizer::Filter(&lmap[0], width, height, width, 2);
-			Rasterizer::Filter(&mmap[0], width, height, width, 2);
-		}
+	void Mesh::CalcuIndirectLighting(int tile)
+	{
+		const Rectangle<int> rect = GetLightingTile(tile);
 
-		for (int j = 0; j < height; ++j)
+		std::vector<RVertex> rchart(rect.w * rect.h);
+		for (int j = 0; j < rect.h; ++j)
 		{
-			for (int i = 0; i < width; ++i)
+			for (int i = 0; i < rect.w; ++i)
 			{
-				int index = j * width + i;
-				Float4 color = lmap[index];
-				float mask = mmap[index];
-				//color = Float4(1, 1, 1, 1);
-				mLightingMap[index].Diffuse = Float3(color.x, color.y, color.z);
-				mLightingMap[index].Shadow = mask;
+				rchart[j * rect.w + i] = mGIChart[(rect.y + j) * mLightingMapSize + (rect.x + i)];
 			}
 		}
-	}
-
-	void Mesh::CalcuIndirectLighting()
-	{
-#ifdef LFX_FEATURE_GI_MSAA
-		int msaa = World::Instance()->GetSetting()->RT_MSAA;
-#else
-		int msaa = 1;
-#endif
-		int lm_width = mLightingMapSize;
-		int lm_height = mLightingMapSize;
-		int width = msaa * mLightingMapSize;
-		int height = msaa * mLightingMapSize;
-
-		RasterizerSoft* rasterizer = new RasterizerSoft(this, width, height);
-		rasterizer->DoRasterize();
 
 		ILBakerRaytrace baker;
-		baker.Run(this, rasterizer->_width, rasterizer->_height, rasterizer->_rchart);
-
-		int index = 0;
-		auto& ilm = this->_getLightingMap();
-		for (int j = 0; j < lm_height; ++j)
-		{
-			for (int i = 0; i < lm_width; ++i)
+		// the progressive passes are written back so they can be previewed
+		auto writeBack = [this, &baker, &rect]() {
+			mLightingMutex.Lock();
+			for (int j = 0; j < rect.h; ++j)
 			{
-				Float3 color = Float3(0, 0, 0);
-				for (int y = 0; y < msaa; ++y)
+				for (int i = 0; i < rect.w; ++i)
 				{
-					for (int x = 0; x < msaa; ++x)
-					{
-						int u = i * msaa + x;
-						int v = j * msaa + y;
-
-						color.x += baker._ctx.BakeOutput[v * rasterizer->_width + u].x;
-						color.y += baker._ctx.BakeOutput[v * rasterizer->_width + u].y;
-						color.z += baker._ctx.BakeOutput[v * rasterizer->_width + u].z;
-					}
+					int index = (rect.y + j) * mLightingMapSize + (rect.x + i);
+					mIndirectMap[index] = baker._ctx.BakeOutput[j * rect.w + i];
 				}
-
-				color /= (float)msaa * msaa;
-
-				auto& outColor = ilm[index++];
-				outColor.Diffuse.x += color.x;
-				outColor.Diffuse.y += color.y;
-				outColor.Diffuse.z += color.z;
 			}
-		}
-
-		delete rasterizer;
+			mLightingMutex.Unlock();
+		};
+		baker._ctx.OnPass = writeBack;
+		baker.Run(this, mLightingMapSize, mLightingMapSize, rchart, rect);
+		writeBack();
 	}
 
-	void Mesh::CalcuAmbientOcclusion()
+	void Mesh::CalcuAmbientOcclusion(int tile)
 	{
 		AOBaker baker;
+		baker.SetSeed(tile);
 
-#if 0
-		const int msaa = World::Instance()->GetSetting()->MSAA;
-		const int width = msaa * mLightingMapSize;
-		const int height = msaa * mLightingMapSize;
-#else
 		const int msaa = 1;
 		const int width = mLightingMapSize;
 		const int height = mLightingMapSize;
 		const int border = LMAP_BORDER;
-#endif
 
-		std::vector<Float4> colorBuffer(width * height);
+		auto& colorBuffer = mAOMap;
 
 		RasterizerScan2 rs(this, width, height, msaa, border);
 		rs.F = [this, &baker, &colorBuffer, width, msaa](const Float2& texel, const Vertex& v, int mtlId) {
@@ -551,62 +670,154 @@ namespace LFX {
 			Float3 color = baker.Calc(v, LFX_MESH | LFX_TERRAIN, this);
 			colorBuffer[y * width + x] += Float4(color.x, color.y, color.z, 1/*samples*/);
 		};
-		rs.DoRasterize();
+		rs.DoRasterize(mTileTriangles[tile], GetLightingTile(tile));
+	}
 
-		for (int y = 0; y < height; ++y)
-		{
-			for (int x = 0; x < width; ++x)
+	void Mesh::EndLighting()
+	{
+		const int width = mLightingMapSize;
+		const int height = mLightingMapSize;
+
+		mLightingMutex.Lock();
+
+		if (!mDirectMap.empty()) {
+			auto& lmap = mDirectMap;
+			auto& mmap = mShadowMap;
+
+			for (int y = 0; y < height; ++y)
 			{
-				Float4 c = colorBuffer[y * width + x];
-				if (c.w > 1) {
-					float invSampels = 1.0f / c.w;
-					c.x *= invSampels;
-					c.y *= invSampels;
-					c.z *= invSampels;
-					colorBuffer[y * width + x] = c;
+				for (int x = 0; x < width; ++x)
+				{
+					Float4& c = lmap[y * width + x];
+					float& m = mmap[y * width + x];
+					if (c.w > 1) {
+						float invSampels = 1.0f / c.w;
+						c.x *= invSampels;
+						c.y *= invSampels;
+						c.z *= invSampels;
+						m *= invSampels;
+					}
+				}
+			}
+
+			if (LMAP_OPTIMIZE_PX > 0) {
+				Rasterizer::Optimize(&lmap[0], width, height, LMAP_OPTIMIZE_PX);
+			}
+
+			if (World::Instance()->GetSetting()->Filter) {
+				Rasterizer::Filter(&lmap[0], width, height, width, 2);
+				Rasterizer::Filter(&mmap[0], width, height, width, 2);
+			}
+
+			for (int j = 0; j < height; ++j)
+			{
+				for (int i = 0; i < width; ++i)
+				{
+					int index = j * width + i;
+					Float4 color = lmap[index];
+					float mask = mmap[index];
+					//color = Float4(1, 1, 1, 1);
+					mLightingMap[index].Diffuse = Float3(color.x, color.y, color.z);
+					mLightingMap[index].Shadow = mask;
 				}
 			}
 		}
 
-		if (LMAP_OPTIMIZE_PX > 0) {
-			Rasterizer::Optimize(&colorBuffer[0], width, height, LMAP_OPTIMIZE_PX);
+		if (!mIndirectMap.empty()) {
+			if (World::Instance()->GetSetting()->Denoise && mGIChart.size() == mIndirectMap.size()) {
+				Denoiser::Run(&mIndirectMap[0], &mGIChart[0], width, height, World::Instance()->GetSetting()->DenoiseIterations);
+			}
+
+			for (int i = 0; i < width * height; ++i)
+			{
+				const Float4& color = mIndirectMap[i];
+
+				auto& outColor = mLightingMap[i];
+				outColor.Diffuse.x += color.x;
+				outColor.Diffuse.y += color.y;
+				outColor.Diffuse.z += color.z;
+			}
 		}
 
-		for (int j = 0; j < mLightingMapSize; ++j)
-		{
-			for (int i = 0; i < mLightingMapSize; ++i)
+		if (!mAOMap.empty()) {
+			auto& colorBuffer = mAOMap;
+
+			for (int y = 0; y < height; ++y)
+			{
+				for (int x = 0; x < width; ++x)
+				{
+					Float4 c = colorBuffer[y * width + x];
+					if (c.w > 1) {
+						float invSampels = 1.0f / c.w;
+						c.x *= invSampels;
+						c.y *= invSampels;
+						c.z *= invSampels;
+						colorBuffer[y * width + x] = c;
+					}
+				}
+			}
+
+			if (LMAP_OPTIMIZE_PX > 0) {
+				Rasterizer::Optimize(&colorBuffer[0], width, height, LMAP_OPTIMIZE_PX);
+			}
+
+			for (int j = 0; j < mLightingMapSize; ++j)
 			{
-				const Float4& color = colorBuffer[j * mLightingMapSize + i];
+				for (int i = 0; i < mLightingMapSize; ++i)
+				{
+					const Float4& color = colorBuffer[j * mLightingMapSize + i];
 
-				auto& outColor = mLightingMap[j * mLightingMapSize + i];
-				outColor.Diffuse.x *= color.x;
-				outColor.Diffuse.y *= color.y;
-				outColor.Diffuse.z *= color.z;
-				outColor.AO = (color.x + color.y + color.z) / 3.0f;
+					auto& outColor = mLightingMap[j * mLightingMapSize + i];
+					outColor.Diffuse.x *= color.x;
+					outColor.Diffuse.y *= color.y;
+					outColor.Diffuse.z *= color.z;
+					outColor.AO = (color.x + color.y + color.z) / 3.0f;
+				}
 			}
 		}
+
+		mTileTriangles = std::vector<std::vector<int>>();
+		mDirectMap = std::vector<Float4>();
+		mShadowMap = std::vector<float>();
+		mGIChart = std::vector<RVertex>();
+		mIndirectMap = std::vector<Float4>();
+		mAOMap = std::vector<Float4>();
+		mLightingMutex.Unlock();
 	}
 
-	Float3 Mesh::_doDirectLighting(const Vertex& v, int mtlId, Light* pLight, float& shadowMask)
+	bool Mesh::GetPreview(std::vector<Float3>& colors)
 	{
-		float kl = 0.0f;
-		Float3 color;
+		mLightingMutex.Lock();
 
-		if (pLight->DirectScale > 0 || pLight->SaveShadowMask)
-		{
-			World::Instance()->GetShader()->DoLighting(
-				color, kl, Float3(0, 0, 0), v, pLight, &mMtlBuffer[mtlId], false, false
-			);
-			if (kl >= 0 && pLight->CastShadow && mReceiveShadow)
+		const int count = mLightingMapSize * mLightingMapSize;
+		bool valid = count > 0;
+		if (!mDirectMap.empty() || !mIndirectMap.empty()) {
+			colors.resize(count);
+			for (int i = 0; i < count; ++i)
 			{
-				float s = CalcShadowMask(v.Position, pLight, LFX_MESH | LFX_TERRAIN);
-				kl *= s;
-				color *= s;
-				shadowMask = s;
+				Float3 color(0, 0, 0);
+				if (!mDirectMap.empty() && mDirectMap[i].w > 0) {
+					color = Float3(mDirectMap[i].x, mDirectMap[i].y, mDirectMap[i].z) / mDirectMap[i].w;
+				}
+				if (!mIndirectMap.empty()) {
+					color += Float3(mIndirectMap[i].x, mIndirectMap[i].y, mIndirectMap[i].z);
+				}
+				colors[i] = color;
+			}
+		}
+		else if (mLightingMap.size() == count) {
+			colors.resize(count);
+			for (int i = 0; i < count; ++i)
+			{
+				colors[i] = mLightingMap[i].Diffuse;
 			}
 		}
+		else {
+			valid = false;
+		}
 
-		return kl > 0 ? color * pLight->DirectScale : Float3(0, 0, 0);
+		mLightingMutex.Unlock();
+		return valid;
 	}
 
 	void Mesh::GetLightingMap(std::vector<RGBE> & colors)
@@ -640,11 +851,12 @@ namespace LFX {
 			pVertex[i] = mVertexBuffer[i];
 		}
 		
-		for (int i = 0; i < mTriBuffer.size(); ++i)
+		const std::vector<Triangle>& triangles = _getTriangleBuffer();
+		for (int i = 0; i < triangles.size(); ++i)
 		{
-			pIndex[i * 3 + 0] = mTriBuffer[i].Index0;
-			pIndex[i * 3 + 1] = mTriBuffer[i].Index1;
-			pIndex[i * 3 + 2] = mTriBuffer[i].Index2;
+			pIndex[i * 3 + 0] = triangles[i].Index0;
+			pIndex[i * 3 + 1] = triangles[i].Index1;
+			pIndex[i * 3 + 2] = triangles[i].Index2;
 		}
 	}
 
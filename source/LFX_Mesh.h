@@ -1,8 +1,10 @@
 #pragma once
 
-#include "LFX_BSP.h"
+#include "LFX_BVH.h"
 #include "LFX_Light.h"
 #include "LFX_Entity.h"
+#include "LFX_Rasterizer.h"
+#include "LFX_Thread.h"
 
 namespace LFX {
 
@@ -28,6 +30,17 @@ namespace LFX {
 
 		void Alloc(int numVertex, int numTriangle, int numMaterial);
 
+		// An instance shares the triangles, materials and BVH of the source mesh and is placed by
+		// transform (relative to the source). Its vertices are only materialized in world space
+		// when it has a lighting map, otherwise _getVertex() returns the vertices of the source.
+		void SetInstance(Mesh* source, const Mat4& transform);
+		Mesh* GetSource() { return mSource; }
+		bool IsInstance() const { return mSource != NULL; }
+		const Mat4& GetTransform() const { return mTransform; }
+		// moves the mesh by transform (applied after its current placement), Build() it again
+		// afterwards. World::LoadDelta() keeps the instances of a moved source in place.
+		void ApplyTransform(const Mat4& transform);
+
 		void Lock(Vertex ** ppVertex, Triangle ** ppTriangle, Material ** ppMaterial);
 		void Unlock();
 
@@ -35,23 +48,34 @@ namespace LFX {
 		bool Valid();
 		const Aabb & GetBound();
 
-		int NumOfVertices() { return mVertexBuffer.size(); }
-		int NumOfTriangles() { return mTriBuffer.size(); }
-		int NumOfMaterial() { return mMtlBuffer.size(); }
-		const Vertex& _getVertex(int i) { return mVertexBuffer[i]; }
-		const Triangle& _getTriangle(int i) { return mTriBuffer[i]; }
-		const Material& _getMaterial(int i) { return mMtlBuffer[i]; }
-		const std::vector<Vertex>& _getVertexBuffer() { return mVertexBuffer; }
-		const std::vector<Triangle>& _getTriangleBuffer() { return mTriBuffer; }
-		const std::vector<Material>& _getMaterialBuffer() { return mMtlBuffer; }
+		int NumOfVertices() { return _getVertexBuffer().size(); }
+		int NumOfTriangles() { return _getTriangleBuffer().size(); }
+		int NumOfMaterial() { return _getMaterialBuffer().size(); }
+		const Vertex& _getVertex(int i) { return _getVertexBuffer()[i]; }
+		const Triangle& _getTriangle(int i) { return _getTriangleBuffer()[i]; }
+		const Material& _getMaterial(int i) { return _getMaterialBuffer()[i]; }
+		const std::vector<Vertex>& _getVertexBuffer() { return mVertexBuffer.empty() && mSource != NULL ? mSource->mVertexBuffer : mVertexBuffer; }
+		const std::vector<Triangle>& _getTriangleBuffer() { return mSource != NULL ? mSource->mTriBuffer : mTriBuffer; }
+		const std::vector<Material>& _getMaterialBuffer() { return mSource != NULL ? mSource->mMtlBuffer : mMtlBuffer; }
+		// world space position and interpolated vertex, valid for instances too
+		Float3 _getPosition(int i);
+		void _getHitVertex(Vertex& v, int triIndex, float tu, float tv);
 
 		void RayCheck(Contact & contract, const Ray & ray, float length);
 		bool Occluded(const Ray & ray, float length);
 
-		void CalcuDirectLighting(const std::vector<Light *> & lights);
-		void CalcuIndirectLighting();
-		void CalcuAmbientOcclusion();
-		Float3 _doDirectLighting(const Vertex& v, int mtlId, Light* pLight, float& shadowMask);
+		// The lighting map is baked by tiles, BeginLighting() prepares the shared buffers,
+		// the tiles can be calculated by different threads, EndLighting() resolves them.
+		void BeginLighting(bool direct, bool indirect, bool ao);
+		void EndLighting();
+		int NumOfLightingTiles();
+		Rectangle<int> GetLightingTile(int tile);
+
+		void CalcuDirectLighting(int tile, const std::vector<Light *> & lights);
+		void CalcuIndirectLighting(int tile);
+		void CalcuAmbientOcclusion(int tile);
+		// the current lighting map, the running result while baking, can be called by any thread
+		bool GetPreview(std::vector<Float3>& colors);
 
 		void GetLightingMap(std::vector<RGBE> & colors);
 		void GetLightingMap(std::vector<LightmapValue> & colors);
@@ -61,18 +85,27 @@ namespace LFX {
 		void GetLightList(std::vector<Light *> & lights, bool forGI);
 
 	protected:
-		bool _addTri(BSPTree<int>::Node * node, int triIndex);
 		void _generateTangent();
-		Aabb _optimize(BSPTree<int>::Node * node);
+		void _buildGeometry();
+		void _buildInstance();
+		Vertex _toWorld(const Vertex& v);
+		static Vertex _transformVertex(const Vertex& v, const Mat4& m, const Mat4& inv);
+		Ray _toLocal(const Ray& ray);
 
-		void _rayCheckImp(Contact & contract, BSPTree<int>::Node * node, const Ray & ray, float length);
-		bool _occludedImp(BSPTree<int>::Node * node, const Ray & ray, float length);
+		void _rayCheckBVH(Contact & contract, const Ray & ray, float length);
+		bool _occludedBVH(const Ray & ray, float length);
+		void _rayCheckImp(Contact & contract, int first, int count, const Ray & ray, float length);
+		bool _occludedImp(int first, int count, const Ray & ray, float length);
 
 	protected:
 		std::vector<Vertex> mVertexBuffer;
 		std::vector<Triangle> mTriBuffer;
 		std::vector<Material> mMtlBuffer;
-		BSPTree<int> mBSPTree;
+		BVH mBVH;
+		Aabb mBound;
+		Mesh* mSource;
+		Mat4 mTransform;
+		Mat4 mInvTransform;
 		Float2 mUVMin, mUVMax;
 
 		String mName;
@@ -80,6 +113,16 @@ namespace LFX {
 		bool mReceiveShadow;
 		int mLightingMapSize;
 		std::vector<LightmapValue> mLightingMap;
+
+		// tile baking buffers, valid between BeginLighting() and EndLighting()
+		std::vector<std::vector<int>> mTileTriangles;
+		std::vector<Float4> mDirectMap;
+		std::vector<float> mShadowMap;
+		std::vector<RVertex> mGIChart;
+		std::vector<Float4> mIndirectMap;
+		std::vector<Float4> mAOMap;
+		// guards the baking buffers against GetPreview()
+		Mutex mLightingMutex;
 	};
 
 }
\ No newline at end of file
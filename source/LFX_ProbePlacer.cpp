@@ -0,0 +1,219 @@
+#include "LFX_ProbePlacer.h"
+#include "LFX_World.h"
+
+namespace LFX {
+
+	static float _ProbeError(const SHProbe& p, const SHProbe& a, const SHProbe& b)
+	{
+		// relative error of the probe interpolated in the middle of its neighbors
+		float err = 0, len = 0;
+		for (size_t i = 0; i < p.coefficients.size(); ++i) {
+			const Float3 d = p.coefficients[i] - (a.coefficients[i] + b.coefficients[i]) * 0.5f;
+			err += d.lenSqr();
+			len += p.coefficients[i].lenSqr();
+		}
+
+		return std::sqrt(err) / std::max(std::sqrt(len), 1e-4f);
+	}
+
+	ProbePlacer::ProbePlacer()
+		: mOrigin(0, 0, 0)
+		, mSpacing(1)
+		, mSize(0, 0, 0)
+	{
+	}
+
+	ProbePlacer::~ProbePlacer()
+	{
+	}
+
+	void ProbePlacer::Clear()
+	{
+		mGrid.clear();
+		mCandidates.clear();
+	}
+
+	void ProbePlacer::Place(std::vector<SHProbe>& probes)
+	{
+		const auto* settings = World::Instance()->GetSetting();
+
+		Clear();
+		Aabb bound = _getSceneBound();
+		if (!bound.Valid()) {
+			LOGW("Place probes failed, the scene is empty");
+			return;
+		}
+
+		const Float3 size = bound.Size();
+		const float extent = std::max(size.x, std::max(size.y, size.z));
+		mSpacing = settings->ProbeSpacing > 0 ? settings->ProbeSpacing : std::max(extent, 1.0f) / kAutoGridSize;
+		for (;;) {
+			for (int k = 0; k < 3; ++k) {
+				mSize[k] = (int)(size[k] / mSpacing) + 1;
+			}
+
+			if ((int64)mSize.x * mSize.y * mSize.z <= kMaxCandidates) {
+				break;
+			}
+			mSpacing *= 1.25f;
+		}
+
+		// center the grid in the bound
+		for (int k = 0; k < 3; ++k) {
+			mOrigin[k] = bound.minimum[k] + (size[k] - (mSize[k] - 1) * mSpacing) * 0.5f;
+		}
+
+		probes.clear();
+		mGrid.assign(mSize.x * mSize.y * mSize.z, -1);
+		for (int z = 0; z < mSize.z; ++z) {
+			for (int y = 0; y < mSize.y; ++y) {
+				for (int x = 0; x < mSize.x; ++x) {
+					const Float3 point = mOrigin + Float3((float)x, (float)y, (float)z) * mSpacing;
+
+					bool nearGeometry = false;
+					if (!_classify(point, nearGeometry)) {
+						continue;
+					}
+
+					const bool even = (x % 2) == 0 && (y % 2) == 0 && (z % 2) == 0;
+					if (!nearGeometry && !even) {
+						continue;
+					}
+
+					mGrid[(z * mSize.y + y) * mSize.x + x] = (int)probes.size();
+					mCandidates.push_back({ Int3(x, y, z), nearGeometry ? 1 : 2, false, false });
+
+					SHProbe probe;
+					probe.position = point;
+					probe.normal = Float3(0, 1, 0);
+					probes.push_back(probe);
+				}
+			}
+		}
+		LOGI("-: Probe candidates %d, spacing %.2f", (int)probes.size(), mSpacing);
+
+		if (settings->ProbePruneError <= 0) {
+			Clear();
+		}
+	}
+
+	void ProbePlacer::Prune(std::vector<SHProbe>& probes)
+	{
+		if (probes.size() != mCandidates.size()) {
+			LOGW("Prune probes failed, the candidates changed");
+			Clear();
+			return;
+		}
+
+		const float tolerance = World::Instance()->GetSetting()->ProbePruneError;
+
+		int numRemoved = 0;
+		for (size_t i = 0; i < mCandidates.size(); ++i) {
+			Candidate& c = mCandidates[i];
+			if (c.locked) {
+				continue;
+			}
+
+			for (int axis = 0; axis < 3 && !c.removed; ++axis) {
+				Int3 lo = c.coord, hi = c.coord;
+				lo[axis] -= c.step;
+				hi[axis] += c.step;
+
+				const int a = _find(lo);
+				const int b = _find(hi);
+				if (a < 0 || b < 0 || mCandidates[a].removed || mCandidates[b].removed) {
+					continue;
+				}
+
+				if (_ProbeError(probes[i], probes[a], probes[b]) <= tolerance) {
+					c.removed = true;
+					mCandidates[a].locked = true;
+					mCandidates[b].locked = true;
+					++numRemoved;
+				}
+			}
+		}
+
+		std::vector<SHProbe> kept;
+		for (size_t i = 0; i < probes.size(); ++i) {
+			if (!mCandidates[i].removed) {
+				kept.push_back(probes[i]);
+				kept.back().coefficients.clear();
+			}
+		}
+		probes.swap(kept);
+		Clear();
+
+		LOGI("-: Probes pruned %d, placed %d", numRemoved, (int)probes.size());
+	}
+
+	Aabb ProbePlacer::_getSceneBound()
+	{
+		Aabb bound;
+		bound.Invalid();
+		for (auto* mesh : World::Instance()->GetMeshes()) {
+			bound.Merge(mesh->GetBound());
+		}
+
+		for (auto* terrain : World::Instance()->GetTerrains()) {
+			for (const auto& v : terrain->_getVertexBuffer()) {
+				bound.Merge(v.Position);
+			}
+		}
+
+		return bound;
+	}
+
+	bool ProbePlacer::_classify(const Float3& point, bool& nearGeometry)
+	{
+		static const Float3 kDirs[6] = {
+			Float3(1, 0, 0), Float3(-1, 0, 0),
+			Float3(0, 1, 0), Float3(0, -1, 0),
+			Float3(0, 0, 1), Float3(0, 0, -1),
+		};
+
+		for (auto* terrain : World::Instance()->GetTerrains()) {
+			const auto& desc = terrain->GetDesc();
+			const float x = point.x - desc.Position.x;
+			const float z = point.z - desc.Position.z;
+
+			float h = 0;
+			if (x >= 0 && z >= 0 && terrain->GetHeightAt(h, x, z) && point.y < h) {
+				return false;
+			}
+		}
+
+		Ray rays[6];
+		float lens[6];
+		bool hits[6];
+		Contact contacts[6];
+		for (int i = 0; i < 6; ++i) {
+			rays[i].orig = point;
+			rays[i].dir = kDirs[i];
+			lens[i] = mSpacing;
+		}
+		World::Instance()->GetScene()->RayCheckBatch(contacts, hits, rays, lens, 6, LFX_TERRAIN | LFX_MESH);
+
+		int front = 0, back = 0;
+		for (int i = 0; i < 6; ++i) {
+			if (hits[i]) {
+				contacts[i].facing ? ++front : ++back;
+			}
+		}
+
+		// a point inside a closed mesh mostly sees back faces
+		nearGeometry = front > 0;
+		return back <= front;
+	}
+
+	int ProbePlacer::_find(const Int3& coord) const
+	{
+		if (coord.x < 0 || coord.y < 0 || coord.z < 0 ||
+			coord.x >= mSize.x || coord.y >= mSize.y || coord.z >= mSize.z) {
+			return -1;
+		}
+
+		return mGrid[(coord.z * mSize.y + coord.y) * mSize.x + coord.x];
+	}
+
+}
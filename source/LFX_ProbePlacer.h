@@ -0,0 +1,54 @@
+#pragma once
+
+#include "LFX_SHBaker.h"
+
+namespace LFX {
+
+	// Places the light probes from the scene geometry. The candidates lie on a grid of ProbeSpacing,
+	// every grid point near the geometry is kept and every other one in open space. The candidates are
+	// baked with kPrepassSamples by the renderer first, the ones which their two neighbors along an axis
+	// interpolate within ProbePruneError are removed by Prune().
+	class ProbePlacer
+	{
+	public:
+		static const int kPrepassSamples = 64;
+		static const int kMaxCandidates = 1 << 20;
+		// grid size of the automatic spacing along the longest axis
+		static const int kAutoGridSize = 32;
+
+	public:
+		ProbePlacer();
+		~ProbePlacer();
+
+		void Clear();
+		// replaces the probes with the candidates, they are pruned once they are baked
+		void Place(std::vector<SHProbe>& probes);
+		// keeps the baked candidates which their neighbors don't interpolate, the coefficients are cleared
+		void Prune(std::vector<SHProbe>& probes);
+		// the placed candidates wait for Prune()
+		bool HasCandidates() const { return !mCandidates.empty(); }
+
+	protected:
+		struct Candidate
+		{
+			Int3 coord;
+			int step; // 1 near the geometry, 2 in open space
+			bool locked; // interpolates a removed candidate
+			bool removed;
+		};
+
+		Aabb _getSceneBound();
+		// returns false if the point is inside the geometry
+		bool _classify(const Float3& point, bool& nearGeometry);
+		int _find(const Int3& coord) const;
+
+	protected:
+		Float3 mOrigin;
+		float mSpacing;
+		Int3 mSize;
+		// candidate index of the grid points, -1 for none
+		std::vector<int> mGrid;
+		std::vector<Candidate> mCandidates;
+	};
+
+}
@@ -0,0 +1,86 @@
+#include "LFX_RadianceCache.h"
+
+namespace LFX {
+
+	RadianceCache::RadianceCache()
+		: mVoxelSize(1.0f)
+		, mInvVoxelSize(1.0f)
+	{
+	}
+
+	RadianceCache::~RadianceCache()
+	{
+	}
+
+	void RadianceCache::Clear()
+	{
+		for (int i = 0; i < kNumShards; ++i) {
+			mShards[i].mutex.Lock();
+			mShards[i].voxels.clear();
+			mShards[i].mutex.Unlock();
+		}
+	}
+
+	void RadianceCache::SetVoxelSize(float size)
+	{
+		Clear();
+
+		mVoxelSize = std::max(size, 0.0001f);
+		mInvVoxelSize = 1.0f / mVoxelSize;
+	}
+
+	uint64 RadianceCache::_key(const Float3& position, const Float3& normal) const
+	{
+		// 20 bits per axis and 3 bits for the normal axis
+		const uint64 x = (uint64)(int64_t)std::floor(position.x * mInvVoxelSize) & 0xFFFFF;
+		const uint64 y = (uint64)(int64_t)std::floor(position.y * mInvVoxelSize) & 0xFFFFF;
+		const uint64 z = (uint64)(int64_t)std::floor(position.z * mInvVoxelSize) & 0xFFFFF;
+
+		int axis = 0;
+		if (std::abs(normal.y) > std::abs(normal[axis]))
+			axis = 1;
+		if (std::abs(normal.z) > std::abs(normal[axis]))
+			axis = 2;
+		const uint64 face = axis * 2 + (normal[axis] < 0 ? 1 : 0);
+
+		return (x << 43) | (y << 23) | (z << 3) | face;
+	}
+
+	bool RadianceCache::Lookup(const Float3& position, const Float3& normal, Float3& radiance)
+	{
+		const uint64 key = _key(position, normal);
+		Shard& shard = mShards[(key ^ (key >> 29)) % kNumShards];
+
+		bool found = false;
+		shard.mutex.Lock();
+		auto it = shard.voxels.find(key);
+		if (it != shard.voxels.end() && it->second.count >= kMinSamples) {
+			radiance = it->second.sum / (float)it->second.count;
+			found = true;
+		}
+		shard.mutex.Unlock();
+
+		return found;
+	}
+
+	void RadianceCache::Add(const Float3& position, const Float3& normal, const Float3& radiance)
+	{
+		const uint64 key = _key(position, normal);
+		Shard& shard = mShards[(key ^ (key >> 29)) % kNumShards];
+
+		shard.mutex.Lock();
+		auto it = shard.voxels.find(key);
+		if (it == shard.voxels.end()) {
+			Voxel voxel;
+			voxel.sum = radiance;
+			voxel.count = 1;
+			shard.voxels[key] = voxel;
+		}
+		else {
+			it->second.sum += radiance;
+			it->second.count += 1;
+		}
+		shard.mutex.Unlock();
+	}
+
+}
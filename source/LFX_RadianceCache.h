@@ -0,0 +1,52 @@
+#pragma once
+
+#include "LFX_Math.h"
+#include "LFX_Thread.h"
+#include <unordered_map>
+
+namespace LFX {
+
+	// World space cache of the outgoing diffuse radiance of the path vertices, hashed by voxel
+	// and the dominant axis of the normal. It is filled by the paths as they are traced and
+	// shared by all baker threads, the voxels are split into shards with their own lock.
+	// The lightmap and probe paths use the same estimator, so they share the voxels.
+	class LFX_ENTRY RadianceCache
+	{
+	public:
+		static const int kNumShards = 64;
+		// a voxel answers lookups once it has this many samples
+		static const int kMinSamples = 16;
+
+	public:
+		RadianceCache();
+		~RadianceCache();
+
+		void Clear();
+		void SetVoxelSize(float size);
+		float GetVoxelSize() const { return mVoxelSize; }
+
+		bool Lookup(const Float3& position, const Float3& normal, Float3& radiance);
+		void Add(const Float3& position, const Float3& normal, const Float3& radiance);
+
+	protected:
+		uint64 _key(const Float3& position, const Float3& normal) const;
+
+	protected:
+		struct Voxel
+		{
+			Float3 sum;
+			int count;
+		};
+
+		struct Shard
+		{
+			Mutex mutex;
+			std::unordered_map<uint64, Voxel> voxels;
+		};
+
+		float mVoxelSize;
+		float mInvVoxelSize;
+		Shard mShards[kNumShards];
+	};
+
+}
@@ -5,7 +5,6 @@ namespace LFX {
 	Rasterizer::Rasterizer(int width, int height)
 	{
 		assert(width > 16 && height > 16);
-		_rmap.resize(width * height);
 	}
 
 	Float2 Rasterizer::Texel(const Float2& uv, int w, int h, int border)
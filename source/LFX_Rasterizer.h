@@ -29,9 +29,6 @@ namespace LFX {
 		static bool TexelIsOut(const Float2& texel, int w, int h);
 		static bool PointInTriangle(Float2 P, Float2 A, Float2 B, Float2 C, float& tu, float& tv);
 
-	public:
-		std::vector<Float3> _rmap;
-
 	public:
 		Rasterizer(int width, int height);
 		virtual ~Rasterizer() {}
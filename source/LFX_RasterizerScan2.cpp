@@ -19,31 +19,58 @@ namespace LFX {
 
 	void RasterizerScan2::DoRasterize()
 	{
+		_clip = Rectangle<int>(0, 0, _width, _height);
+
 		for (int i = 0; i < _mesh->NumOfTriangles(); ++i)
 		{
-			const Triangle& tri = _mesh->_getTriangle(i);
-			const Vertex& a = _mesh->_getVertex(tri.Index0);
-			const Vertex& b = _mesh->_getVertex(tri.Index1);
-			const Vertex& c = _mesh->_getVertex(tri.Index2);
+			_rasterize(i);
+		}
+	}
 
-			if (a.LUV == b.LUV && a.LUV == c.LUV) {
-				continue;
-			}
+	void RasterizerScan2::DoRasterize(const std::vector<int>& triangles, const Rectangle<int>& clip)
+	{
+		_clip = clip;
 
-			Vertex A(a), B(b), C(c);
-			A.LUV = Rasterizer::Texel(A.LUV, _width, _height, _border);
-			B.LUV = Rasterizer::Texel(B.LUV, _width, _height, _border);
-			C.LUV = Rasterizer::Texel(C.LUV, _width, _height, _border);
+		for (size_t i = 0; i < triangles.size(); ++i)
+		{
+			_rasterize(triangles[i]);
+		}
+	}
 
-			const float xmin = Min(A.LUV.x, B.LUV.x, C.LUV.x);
-			const float ymin = Min(A.LUV.y, B.LUV.y, C.LUV.y);
-			const float xmax = Max(A.LUV.x, B.LUV.x, C.LUV.x);
-			const float ymax = Max(A.LUV.y, B.LUV.y, C.LUV.y);
+	void RasterizerScan2::_rasterize(int triIndex)
+	{
+		const Triangle& tri = _mesh->_getTriangle(triIndex);
+		const Vertex& a = _mesh->_getVertex(tri.Index0);
+		const Vertex& b = _mesh->_getVertex(tri.Index1);
+		const Vertex& c = _mesh->_getVertex(tri.Index2);
 
-			for (float y = ymin; y <= ymax; y += 1.0f) {
-				for (float x = xmin; x <= xmax; x += 1.0f) {
-					_vout(Float2(x, y), A, B, C, tri.MaterialId);
-				}
+		if (a.LUV == b.LUV && a.LUV == c.LUV) {
+			return;
+		}
+
+		Vertex A(a), B(b), C(c);
+		A.LUV = Rasterizer::Texel(A.LUV, _width, _height, _border);
+		B.LUV = Rasterizer::Texel(B.LUV, _width, _height, _border);
+		C.LUV = Rasterizer::Texel(C.LUV, _width, _height, _border);
+
+		float xmin = Min(A.LUV.x, B.LUV.x, C.LUV.x);
+		float ymin = Min(A.LUV.y, B.LUV.y, C.LUV.y);
+		float xmax = Max(A.LUV.x, B.LUV.x, C.LUV.x);
+		float ymax = Max(A.LUV.y, B.LUV.y, C.LUV.y);
+
+		// skip the texels before the clip rect, keep the sample position
+		if (xmin < _clip.x) {
+			xmin += std::floor(_clip.x - xmin);
+		}
+		if (ymin < _clip.y) {
+			ymin += std::floor(_clip.y - ymin);
+		}
+		xmax = std::min(xmax, (float)_clip.right());
+		ymax = std::min(ymax, (float)_clip.bottom());
+
+		for (float y = ymin; y <= ymax; y += 1.0f) {
+			for (float x = xmin; x <= xmax; x += 1.0f) {
+				_vout(Float2(x, y), A, B, C, tri.MaterialId);
 			}
 		}
 	}
@@ -101,6 +128,12 @@ namespace LFX {
 			return;
 		}
 
+		const int x = static_cast<int>(texel.x);
+		const int y = static_cast<int>(texel.y);
+		if (x < _clip.x || x >= _clip.right() || y < _clip.y || y >= _clip.bottom()) {
+			return;
+		}
+
 		float tu, tv;
 		if (!CalcBarycentricCoord(texel, A.LUV, B.LUV, C.LUV, tu, tv)) {
 			return;
@@ -18,6 +18,7 @@ namespace LFX {
 		int _width, _height;
 		int _border;
 		int _samples;
+		Rectangle<int> _clip;
 		RandomEngine irand;
 		std::function<void(const Float2& texel, const Vertex& v, int mtlId)> F;
 
@@ -25,8 +26,11 @@ namespace LFX {
 		RasterizerScan2(Mesh* mesh, int w, int h, int s, int border);
 
 		void DoRasterize() override;
+		// rasterize the triangles, only the texels in the clip rect are output
+		void DoRasterize(const std::vector<int>& triangles, const Rectangle<int>& clip);
 
 	protected:
+		void _rasterize(int triIndex);
 		void _vout(const Float2& texel, const Vertex& A, const Vertex& B, const Vertex& C, int mtlId);
 		void _vfunc(const Float2& texel, const Vertex& A, const Vertex& B, const Vertex& C, int mtlId);
 	};
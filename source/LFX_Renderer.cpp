@@ -1,20 +1,38 @@
 #include "LFX_Renderer.h"
 #include "LFX_World.h"
 #include "LFX_DeviceStats.h"
+#include "LFX_ILBakerRaytrace.h"
+#include "LFX_Image.h"
+#include <chrono>
 
 namespace LFX {
 
+	static const char* LFX_CACHE_FILE = "output/lfx.cache";
+
+	static double GetSeconds()
+	{
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::duration<double>>(now).count();
+	}
+
 	CRenderer::CRenderer()
 	{
+		mProgress = 0;
+		mQueuedTasks = 0;
+		mTaskTiles = NULL;
+		mTotalCost = 0;
+		mCompletedCost = 0;
+		mStartTime = 0;
+		mPendingTasks = 0;
+		mStopping = false;
+		mPrepass = false;
+		mProbeSamples = 0;
 	}
 
 	CRenderer::~CRenderer()
 	{
-		for (auto i = 0; i < mThreads.size(); ++i) {
-			mThreads[i]->Stop();
-			delete mThreads[i];
-		}
-		mThreads.clear();
+		_stopThreads();
+		SAFE_DELETE_ARRAY(mTaskTiles);
 	}
 
 	void CRenderer::Build()
@@ -24,13 +42,20 @@ namespace LFX {
 
 	void CRenderer::Start()
 	{
-		for (size_t i = 0; i < mThreads.size(); ++i) {
-			delete[] mThreads[i];
-		}
-		mThreads.clear();
+		// the candidates of the automatic probe placement are baked with a few samples first,
+		// Update() prunes them and starts the bake
+		mPrepass = World::Instance()->_getProbePlacer()->HasCandidates();
+		_start();
+	}
+
+	void CRenderer::_start()
+	{
+		_stopThreads();
 
-		mTaskIndex = 0;
 		mProgress = 0;
+		mQueuedTasks = 0;
+		mPendingTasks = 0;
+		mStopping = false;
 
 		int threads = 1;
 #ifdef _DEBUG
@@ -50,12 +75,13 @@ namespace LFX {
 		const auto& probes = World::Instance()->GetSHProbes();
 
 		mTasks.clear();
-		if (World::Instance()->GetSetting()->BakeLightMap) {
+		mProbeSamples = mPrepass ? ProbePlacer::kPrepassSamples : 0;
+		if (World::Instance()->GetSetting()->BakeLightMap && !mPrepass) {
 			int numMeshTasks = 0;
 			for (size_t i = 0; i < meshes.size(); ++i) {
 				if (meshes[i]->GetLightingMapSize()) {
 					++numMeshTasks;
-					mTasks.push_back({ meshes[i], (int)i });
+					mTasks.push_back({ meshes[i], (int)i, -1, (int)mTasks.size() });
 				}
 			}
 			LOGI("-: Mesh tasks %d", numMeshTasks);
@@ -65,7 +91,7 @@ namespace LFX {
 				for (int i = 0; i < terrain->GetDesc().BlockCount.x * terrain->GetDesc().BlockCount.y; ++i) {
 					if (terrain->_getBlockValids()[i]) {
 						++numTerrainTasks;
-						mTasks.push_back({ terrain, i });
+						mTasks.push_back({ terrain, i, -1, (int)mTasks.size() });
 					}
 				}
 			}
@@ -74,9 +100,83 @@ namespace LFX {
 
 		if (World::Instance()->GetSetting()->BakeLightProbe) {
 			for (size_t i = 0; i < probes.size(); ++i) {
-				mTasks.push_back({ (SHProbe*)(&probes[i]), (int)i });
+				mTasks.push_back({ (SHProbe*)(&probes[i]), (int)i, -1, (int)mTasks.size() });
+			}
+			LOGI(mPrepass ? "-: Probe candidate tasks %d" : "-: Probe tasks %d", (int)probes.size());
+		}
+
+		// restore the tasks whose dependencies did not change since the last bake
+		if (!mPrepass) {
+			mCache.Prepare();
+			mCache.Load(LFX_CACHE_FILE);
+		}
+
+		std::vector<STBaker::Task> tasks;
+		std::vector<STBaker::Task> probeTasks;
+		std::vector<uint64> probeHashes;
+		tasks.swap(mTasks);
+		mTaskHashes.clear();
+		int numCachedTasks = 0;
+		for (auto& task : tasks) {
+			const uint64 hash = mPrepass ? 0 : mCache.GetTaskHash(task.entity, task.index);
+			if (!mPrepass && mCache.Restore(task.entity, task.index, hash)) {
+				++numCachedTasks;
+				continue;
+			}
+
+			if (task.entity->GetType() == LFX_SHPROBE) {
+				probeTasks.push_back(task);
+				probeHashes.push_back(hash);
+				continue;
 			}
-			LOGI("-: Probe tasks %d", (int)probes.size());
+
+			task.group = (int)mTasks.size();
+			mTasks.push_back(task);
+			mTaskHashes.push_back(hash);
+		}
+		LOGI("-: Cached tasks %d", numCachedTasks);
+
+		_batchProbes(probeTasks, probeHashes);
+		LOGI("-: Probe batches %d", (int)mProbeBatches.size());
+
+		SAFE_DELETE_ARRAY(mTaskTiles);
+		mTaskTiles = new std::atomic_int[mTasks.size()];
+		mTaskCosts.resize(mTasks.size());
+		mTaskCredits.resize(mTasks.size());
+		mTileCosts.resize(mTasks.size());
+		mTotalCost = 0;
+		mCompletedCost = 0;
+
+		std::vector<int> order(mTasks.size());
+		for (size_t i = 0; i < mTasks.size(); ++i) {
+			mTaskTiles[i] = 0;
+			mTaskCosts[i] = _estimateCost(mTasks[i]);
+			mTaskCredits[i] = 0;
+			mTileCosts[i] = 0;
+			mTotalCost += mTaskCosts[i];
+			order[i] = (int)i;
+		}
+		LOGI("-: Estimated cost %.0f", mTotalCost);
+
+		// largest first (LPT), the k-th largest task goes to thread k % N,
+		// each thread pops its own tasks from the back, so push the smaller ones first
+		std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+			return mTaskCosts[a] > mTaskCosts[b];
+		});
+
+		mPendingTasks = (int)mTasks.size();
+		for (int k = (int)order.size() - 1; k >= 0; --k) {
+			_pushTask(mThreads[k % mThreads.size()], mTasks[order[k]]);
+		}
+
+		mStartTime = GetSeconds();
+
+		const auto* setting = World::Instance()->GetSetting();
+		if (setting->GIProgressive && setting->GITimeBudget > 0) {
+			ILBakerRaytrace::SetDeadline(ILBakerRaytrace::GetSeconds() + setting->GITimeBudget);
+		}
+		else {
+			ILBakerRaytrace::SetDeadline(0);
 		}
 
 		for (size_t i = 0; i < mThreads.size(); ++i) {
@@ -92,54 +192,325 @@ namespace LFX {
 
 	void CRenderer::Update()
 	{
-		STBaker* thread = _getFreeThread();
-		if (thread == nullptr) {
+		if (mThreads.empty()) {
 			return;
 		}
 
-		STBaker::Task task;
-		if (_getNextTask(task)) {
-			thread->Enqueue(task.entity, task.index);
-			return;
+		// the threads dispatch tasks by themselves, just wait for them
+		mMutex.Lock();
+		if (mPendingTasks > 0) {
+			mDoneCondition.Wait(mMutex, 0.1f);
 		}
+		bool finished = (mPendingTasks == 0);
+		mMutex.Unlock();
 
-		// ensure all task finished
-		for (size_t i = 0; i < mThreads.size(); ++i) {
-			if (!mThreads[i]->IsCompeleted()) {
+		if (finished) {
+			_stopThreads();
+			if (mPrepass) {
+				mTasks.clear();
+				mProbeBatches.clear();
+				World::Instance()->_getProbePlacer()->Prune(World::Instance()->_getSHProbes());
+
+				mPrepass = false;
+				_start();
 				return;
 			}
+
+			_saveCache();
+			mTasks.clear();
+			mProbeBatches.clear();
 		}
+	}
 
-		// end
-		for (size_t i = 0; i < mThreads.size(); ++i) {
-			mThreads[i]->Stop();
-			delete mThreads[i];
+	bool CRenderer::_waitTask(STBaker* thread, STBaker::Task& task)
+	{
+		while (1) {
+			if (thread->_popTask(task) || _stealTask(thread, task)) {
+				--mQueuedTasks;
+				return true;
+			}
+
+			mMutex.Lock();
+			while (mQueuedTasks <= 0 && !mStopping) {
+				mWorkCondition.Wait(mMutex);
+			}
+			bool stopping = mStopping;
+			mMutex.Unlock();
+
+			if (stopping) {
+				return false;
+			}
 		}
-		mThreads.clear();
+	}
 
-		mTasks.clear();
-		mTaskIndex = 0;
+	void CRenderer::_pushTask(STBaker* thread, const STBaker::Task& task)
+	{
+		thread->Enqueue(task);
+
+		mMutex.Lock();
+		++mQueuedTasks;
+		mWorkCondition.Signal();
+		mMutex.Unlock();
+	}
+
+	float CRenderer::GetProgressRatio()
+	{
+		mMutex.Lock();
+		float ratio = mTotalCost > 0 ? (float)(mCompletedCost / mTotalCost) : 1.0f;
+		mMutex.Unlock();
+
+		return Clamp<float>(ratio, 0.0f, 1.0f);
+	}
+
+	float CRenderer::GetRemainingTime()
+	{
+		mMutex.Lock();
+		double completed = mCompletedCost;
+		double remaining = mTotalCost - mCompletedCost;
+		mMutex.Unlock();
+
+		double elapsed = GetSeconds() - mStartTime;
+		if (completed <= 0 || elapsed <= 0) {
+			return -1;
+		}
+
+		return (float)(std::max(0.0, remaining) * elapsed / completed);
+	}
+
+	void CRenderer::SavePreview(const String& path)
+	{
+		FileUtil::MakeDir(path);
+
+		const auto& meshes = World::Instance()->GetMeshes();
+		for (size_t i = 0; i < meshes.size(); ++i) {
+			std::vector<Float3> colors;
+			if (!meshes[i]->GetPreview(colors)) {
+				continue;
+			}
+
+			const int size = meshes[i]->GetLightingMapSize();
+			Image image;
+			image.width = size;
+			image.height = size;
+			image.channels = 4;
+			image.pixels.resize(size * size * 4);
+			for (int k = 0; k < size * size; ++k) {
+				Float3 color = Shader::ACESToneMap(colors[k]);
+				color.saturate();
+
+				image.pixels[k * 4 + 0] = (uint8_t)(color.x * 255);
+				image.pixels[k * 4 + 1] = (uint8_t)(color.y * 255);
+				image.pixels[k * 4 + 2] = (uint8_t)(color.z * 255);
+				image.pixels[k * 4 + 3] = 255;
+			}
+
+			char filename[256];
+			sprintf(filename, "%s/LFX_Preview_%04d.png", path.c_str(), (int)i);
+			Image::Save(image, filename);
+		}
+	}
+
+	void CRenderer::_batchProbes(const std::vector<STBaker::Task>& tasks, const std::vector<uint64>& hashes)
+	{
+		mProbeBatches.clear();
+		if (tasks.empty()) {
+			return;
+		}
+
+		Aabb bound;
+		bound.Invalid();
+		for (const auto& task : tasks) {
+			bound.Merge(((SHProbe*)task.entity)->position);
+		}
+
+		// 10 bits per axis
+		const Float3 extent = bound.Size();
+		const Float3 scale(
+			extent.x > 0 ? 1023.0f / extent.x : 0,
+			extent.y > 0 ? 1023.0f / extent.y : 0,
+			extent.z > 0 ? 1023.0f / extent.z : 0);
+
+		std::vector<std::pair<uint32, int>> order(tasks.size());
+		for (size_t i = 0; i < tasks.size(); ++i) {
+			const Float3 p = (((SHProbe*)tasks[i].entity)->position - bound.minimum) * scale;
+			order[i].first = (MortonExpand((uint32)p.x) << 2) | (MortonExpand((uint32)p.y) << 1) | MortonExpand((uint32)p.z);
+			order[i].second = (int)i;
+		}
+		std::sort(order.begin(), order.end());
+
+		for (size_t i = 0; i < order.size(); i += SHBaker::kBatchProbes) {
+			ProbeBatch batch;
+			for (size_t k = i; k < std::min(order.size(), i + SHBaker::kBatchProbes); ++k) {
+				const auto& task = tasks[order[k].second];
+				batch.probes.push_back((SHProbe*)task.entity);
+				batch.tasks.push_back(task);
+				batch.hashes.push_back(hashes[order[k].second]);
+			}
+
+			STBaker::Task task = { batch.probes[0], (int)mProbeBatches.size(), -1, (int)mTasks.size() };
+			mTasks.push_back(task);
+			mTaskHashes.push_back(0);
+			mProbeBatches.push_back(batch);
+		}
+	}
+
+	float CRenderer::_estimateCost(const STBaker::Task& task)
+	{
+		const auto* setting = World::Instance()->GetSetting();
+
+		bool hasLightForGI = false;
+		for (auto* light : World::Instance()->GetLights()) {
+			if (light->GIEnable) {
+				hasLightForGI = true;
+				break;
+			}
+		}
+
+		std::vector<Light*> lights;
+		bool hasGI = hasLightForGI && setting->GIScale > 0;
+		float texels = 0;
+		float samples = 0;
+		float pathLength = 0;
+		float aoSamples = 0;
+
+		if (task.entity->GetType() == LFX_TERRAIN) {
+			Terrain* pTerrain = (Terrain*)task.entity;
+			int xblock = task.index % pTerrain->GetDesc().BlockCount.x;
+			int yblock = task.index / pTerrain->GetDesc().BlockCount.x;
+			int mapSize = pTerrain->GetDesc().LMapSize - Terrain::kLMapBorder * 2;
+
+			pTerrain->GetLightList(lights, xblock, yblock, false);
+			texels = (float)mapSize * mapSize;
+			samples = (float)setting->GISamples * setting->GISamples;
+			pathLength = (float)setting->GIPathLength;
+		}
+		else if (task.entity->GetType() == LFX_MESH) {
+			Mesh* pMesh = (Mesh*)task.entity;
+
+			pMesh->GetLightList(lights, false);
+			texels = (float)pMesh->GetLightingMapSize() * pMesh->GetLightingMapSize();
+			samples = (float)setting->GISamples * setting->GISamples;
+			pathLength = (float)setting->GIPathLength;
+			aoSamples = setting->AOLevel == 0 ? 0 : (setting->AOLevel == 1 ? 15 * 15 : 25 * 25);
+		}
+		else if (task.entity->GetType() == LFX_SHPROBE) {
+			const auto& probes = mProbeBatches[task.index].probes;
+
+			// the lights reaching any probe of the batch
+			std::vector<Light*> probeLights;
+			for (auto* probe : probes) {
+				probeLights.clear();
+				SHGetLightList(probeLights, probe->position);
+				for (auto* light : probeLights) {
+					if (std::find(lights.begin(), lights.end(), light) == lights.end()) {
+						lights.push_back(light);
+					}
+				}
+			}
+			// the probe paths see the sky too, they are traced whenever GIProbeScale is set
+			hasGI = setting->GIProbeScale > 0;
+			texels = (float)probes.size();
+			samples = (float)(mProbeSamples > 0 ? mProbeSamples : setting->GIProbeSamples);
+			pathLength = (float)setting->GIProbePathLength;
+		}
+
+		const float numLights = (float)std::max<size_t>(1, lights.size());
+
+		float cost = texels * numLights;
+		if (hasGI) {
+			cost += texels * samples * std::max(1.0f, pathLength) * numLights;
+		}
+		cost += texels * aoSamples;
+
+		return cost;
+	}
+
+	void CRenderer::_pushTiles(STBaker* thread, const STBaker::Task& task, int tiles)
+	{
+		mTaskTiles[task.group] = tiles;
+		mTileCosts[task.group] = mTaskCosts[task.group] / tiles;
+
+		// the owner pops from the back, so it runs the tiles in order
+		for (int i = tiles - 1; i >= 0; --i) {
+			STBaker::Task tileTask = task;
+			tileTask.tile = i;
+			thread->Enqueue(tileTask);
+		}
+
+		mMutex.Lock();
+		mQueuedTasks += tiles;
+		mWorkCondition.Broadcast();
+		mMutex.Unlock();
+	}
+
+	bool CRenderer::_onTileCompeleted(const STBaker::Task& task)
+	{
+		mMutex.Lock();
+		mCompletedCost += mTileCosts[task.group];
+		mTaskCredits[task.group] += mTileCosts[task.group];
+		mMutex.Unlock();
+
+		return --mTaskTiles[task.group] == 0;
 	}
 
-	bool CRenderer::_getNextTask(STBaker::Task& task)
+	void CRenderer::_onTaskCompeleted(const STBaker::Task& task)
 	{
-		if (mTaskIndex < mTasks.size()) {
-			task = mTasks[mTaskIndex++];
-			return true;
+		mProgress += 1;
+
+		mMutex.Lock();
+		mCompletedCost += mTaskCosts[task.group] - mTaskCredits[task.group];
+		mTaskCredits[task.group] = mTaskCosts[task.group];
+		if (--mPendingTasks == 0) {
+			mDoneCondition.Broadcast();
+		}
+		mMutex.Unlock();
+	}
+
+	bool CRenderer::_stealTask(STBaker* thread, STBaker::Task& task)
+	{
+		const int count = (int)mThreads.size();
+		for (int i = 1; i < count; ++i) {
+			STBaker* victim = mThreads[(thread->GetId() + i) % count];
+			if (victim->_stealTask(task)) {
+				return true;
+			}
 		}
 
 		return false;
 	}
 
-	STBaker* CRenderer::_getFreeThread()
+	void CRenderer::_stopThreads()
 	{
+		mMutex.Lock();
+		mStopping = true;
+		mWorkCondition.Broadcast();
+		mMutex.Unlock();
+
 		for (size_t i = 0; i < mThreads.size(); ++i) {
-			if (mThreads[i]->IsCompeleted()) {
-				return mThreads[i];
+			mThreads[i]->Stop();
+			delete mThreads[i];
+		}
+		mThreads.clear();
+	}
+
+	void CRenderer::_saveCache()
+	{
+		for (size_t i = 0; i < mTasks.size(); ++i) {
+			if (mTasks[i].entity->GetType() == LFX_SHPROBE) {
+				const auto& batch = mProbeBatches[mTasks[i].index];
+				for (size_t k = 0; k < batch.tasks.size(); ++k) {
+					mCache.Store(batch.tasks[k].entity, batch.tasks[k].index, batch.hashes[k]);
+				}
+				continue;
 			}
+
+			mCache.Store(mTasks[i].entity, mTasks[i].index, mTaskHashes[i]);
 		}
 
-		return nullptr;
+		FileUtil::MakeDir("output");
+		if (!mCache.Save(LFX_CACHE_FILE)) {
+			LOGW("Save bake cache failed");
+		}
 	}
 
 }
\ No newline at end of file
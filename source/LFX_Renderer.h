@@ -8,6 +8,7 @@
 #include "LFX_Terrain.h"
 #include "LFX_Shader.h"
 #include "LFX_SHBaker.h"
+#include "LFX_BakeCache.h"
 
 namespace LFX {
 
@@ -20,7 +21,7 @@ namespace LFX {
 		virtual void Build() = 0;
 		// 
 		virtual void Start() = 0;
-		// º࣬ҪǷ
+		// º࣬ȴɣгʱ
 		virtual void Update() = 0;
 		// жǷ
 		virtual bool End() = 0;
@@ -28,6 +29,12 @@ namespace LFX {
 		virtual int GetProgress() = 0;
 		// 
 		virtual int GetTaskCount() = 0;
+		// ذƿȨĽ(0-1)
+		virtual float GetProgressRatio() = 0;
+		// عƵʣʱ()С0ʾδ֪
+		virtual float GetRemainingTime() = 0;
+		// 浱ǰ()ĹͼԤpath, ÿģһ
+		virtual void SavePreview(const String& path) = 0;
 	};
 
 	class CRenderer : public IRenderer
@@ -42,19 +49,71 @@ namespace LFX {
 		void Update() override;
 		int GetProgress() override { return mProgress; }
 		int GetTaskCount() override { return mTasks.size(); }
+		float GetProgressRatio() override;
+		float GetRemainingTime() override;
+		void SavePreview(const String& path) override;
 
 		STBaker* _getThread(int i) { return mThreads[i]; }
-		void _onThreadCompeleted() { mProgress += 1; }
+
+		// ̵߳ãȡ񣨱ضлȡʱfalseʾ˳
+		bool _waitTask(STBaker* thread, STBaker::Task& task);
+		void _pushTask(STBaker* thread, const STBaker::Task& task);
+		// ʵΪtiles񣬷trueʾһ
+		void _pushTiles(STBaker* thread, const STBaker::Task& task, int tiles);
+		bool _onTileCompeleted(const STBaker::Task& task);
+		void _onTaskCompeleted(const STBaker::Task& task);
+
+		// ̽ε̽
+		const std::vector<SHProbe*>& _getProbeBatch(int batch) { return mProbeBatches[batch].probes; }
+		// ̽Ĳ, 0ʹGIProbeSamples
+		int _getProbeSamples() const { return mProbeSamples; }
 
 	protected:
-		bool _getNextTask(STBaker::Task& task);
-		STBaker* _getFreeThread();
+		struct ProbeBatch
+		{
+			std::vector<SHProbe*> probes;
+			// ÿ̽ϣ, ڱ滺
+			std::vector<STBaker::Task> tasks;
+			std::vector<uint64> hashes;
+		};
+
+		// ߳, Ԥ׶ֻкѡ̽
+		void _start();
+		// ̽񰴿ռ(morton)˳ֳ, ÿһ, ߿һ׷
+		void _batchProbes(const std::vector<STBaker::Task>& tasks, const std::vector<uint64>& hashes);
+		// :  * Դ * (1 + GI * ·) + AO
+		float _estimateCost(const STBaker::Task& task);
+		bool _stealTask(STBaker* thread, STBaker::Task& task);
+		void _stopThreads();
+		// 汾κĽ, ´ֻ仯
+		void _saveCache();
 
 	public:
 		std::vector<STBaker::Task> mTasks;
-		int mTaskIndex;
-		int mProgress;
+		// ̽indexε
+		std::vector<ProbeBatch> mProbeBatches;
+		// Զõĺѡ̽, ɺ޳ʽ
+		bool mPrepass;
+		int mProbeSamples;
+		std::atomic_int mProgress;
 		std::vector<STBaker*> mThreads;
+
+		Mutex mMutex;
+		Condition mWorkCondition;
+		Condition mDoneCondition;
+		std::atomic_int mQueuedTasks;
+		std::atomic_int* mTaskTiles;
+		std::vector<float> mTaskCosts;
+		std::vector<float> mTaskCredits;
+		std::vector<float> mTileCosts;
+		double mTotalCost;
+		double mCompletedCost;
+		double mStartTime;
+		int mPendingTasks;
+		bool mStopping;
+
+		BakeCache mCache;
+		std::vector<uint64> mTaskHashes;
 	};
 
 }
\ No newline at end of file
@@ -36,25 +36,100 @@ std::vector<Float3> LightProbeSampler::uniformSampleSphereAll(uint32_t sampleCou
     return samples;
 }
 
-std::vector<SH::BasisFunction> SH::_basisFunctions = {
-    [](const Float3& v) -> float { return 0.282095F; },                             // 0.5F * std::sqrtf(InvPi)
-    [](const Float3& v) -> float { return 0.488603F * v.y; },                       // 0.5F * std::sqrtf(3.0F * InvPi) * v.y
-    [](const Float3& v) -> float { return 0.488603F * v.z; },                       // 0.5F * std::sqrtf(3.0F * InvPi) * v.z
-    [](const Float3& v) -> float { return 0.488603F * v.x; },                       // 0.5F * std::sqrtf(3.0F * InvPi) * v.x
-    [](const Float3& v) -> float { return 1.09255F * v.y * v.x; },                  // 0.5F * std::sqrtf(15.0F * InvPi) * v.y * v.x
-    [](const Float3& v) -> float { return 1.09255F * v.y * v.z; },                  // 0.5F * std::sqrtf(15.0F * InvPi) * v.y * v.z
-    [](const Float3& v) -> float { return 0.946175F * (v.z * v.z - 1.0F / 3.0F); }, // 0.75F * std::sqrtf(5.0F * InvPi) * (v.z * v.z - 1.0F / 3.0F)
-    [](const Float3& v) -> float { return 1.09255F * v.z * v.x; },                  // 0.5F * std::sqrtf(15.0F * InvPi) * v.z * v.x
-    [](const Float3& v) -> float { return 0.546274F * (v.x * v.x - v.y * v.y); },   // 0.25F * std::sqrtf(15.0F * InvPi) * (v.x * v.x - v.y * v.y)
-};
+OctahedralAccumulator::OctahedralAccumulator(uint32_t size)
+    : _size(size)
+    , _sampleCount(0) {
+    assert(size > 0U);
+
+    _directions.resize(size * size);
+    _sums.resize(size * size, Float3(0.0F, 0.0F, 0.0F));
+    _lobes.resize(size * size, Float3(0.0F, 0.0F, 0.0F));
+    for (auto j = 0U; j < size; j++) {
+        for (auto i = 0U; i < size; i++) {
+            const auto u = (static_cast<float>(i) + 0.5F) / static_cast<float>(size);
+            const auto v = (static_cast<float>(j) + 0.5F) / static_cast<float>(size);
+            _directions[j * size + i] = decode(u, v);
+        }
+    }
+}
+
+void OctahedralAccumulator::add(const Float3& dir, const Float3& value) {
+    const auto count = _directions.size();
+    for (auto i = 0U; i < count; i++) {
+        const auto w = _directions[i].dot(dir);
+        if (w > 0.0F) {
+            _sums[i] += value * w;
+        }
+    }
+
+    _sampleCount++;
+}
+
+void OctahedralAccumulator::addCosineLobe(const Float3& dir, const Float3& value) {
+    const auto count = _directions.size();
+    for (auto i = 0U; i < count; i++) {
+        // integral of the product of two clamped cosines whose axes are gamma apart
+        const auto cosGamma = Clamp(_directions[i].dot(dir), -1.0F, 1.0F);
+        const auto gamma = std::acos(cosGamma);
+        const auto sinGamma = std::sqrt(std::max(0.0F, 1.0F - cosGamma * cosGamma));
+
+        _lobes[i] += value * (2.0F / 3.0F * ((Pi - gamma) * cosGamma + sinGamma));
+    }
+}
+
+std::vector<Float3> OctahedralAccumulator::getTexels() const {
+    std::vector<Float3> texels = _lobes;
+    if (_sampleCount == 0) {
+        return texels;
+    }
+
+    // integral using Monte Carlo method
+    const auto scale = 1.0F / (LightProbeSampler::uniformSpherePdf() * static_cast<float>(_sampleCount));
+    for (auto i = 0U; i < _sums.size(); i++) {
+        texels[i] += _sums[i] * scale;
+    }
+
+    return texels;
+}
+
+Float3 OctahedralAccumulator::decode(float u, float v) {
+    const auto x = u * 2.0F - 1.0F;
+    const auto y = v * 2.0F - 1.0F;
+
+    // the lower hemisphere is folded over the diagonals
+    Float3 dir(x, y, 1.0F - std::fabs(x) - std::fabs(y));
+    if (dir.z < 0.0F) {
+        dir.x = (1.0F - std::fabs(y)) * (x >= 0.0F ? 1.0F : -1.0F);
+        dir.y = (1.0F - std::fabs(x)) * (y >= 0.0F ? 1.0F : -1.0F);
+    }
+
+    return Float3::Normalize(dir);
+}
+
+Float2 OctahedralAccumulator::encode(const Float3& dir) {
+    const auto invL1 = 1.0F / (std::fabs(dir.x) + std::fabs(dir.y) + std::fabs(dir.z));
+
+    auto x = dir.x * invL1;
+    auto y = dir.y * invL1;
+    if (dir.z < 0.0F) {
+        const auto fx = (1.0F - std::fabs(y)) * (x >= 0.0F ? 1.0F : -1.0F);
+        const auto fy = (1.0F - std::fabs(x)) * (y >= 0.0F ? 1.0F : -1.0F);
+        x = fx;
+        y = fy;
+    }
+
+    return Float2(x * 0.5F + 0.5F, y * 0.5F + 0.5F);
+}
 
 Float3 SH::evaluate(const Float3& sample, const std::vector<Float3>& coefficients) {
     Float3 result{0.0F, 0.0F, 0.0F};
 
-    const auto size = coefficients.size();
-    for (auto i = 0; i < size; i++) {
-        const Float3& c = coefficients[i];
-        result += c * evaluateBasis(i, sample);
+    float basis[SH_BASIS_COUNT];
+    SHBasis<SH_ORDER>::evaluate(basis, 1, sample.x, sample.y, sample.z);
+
+    const auto size = std::min(coefficients.size(), static_cast<size_t>(SH_BASIS_COUNT));
+    for (auto i = 0U; i < size; i++) {
+        result += coefficients[i] * basis[i];
     }
 
     return result;
@@ -64,30 +139,19 @@ std::vector<Float3> SH::project(const std::vector<Float3>& samples, const std::v
     assert(samples.size() > 0 && samples.size() == values.size());
 
     // integral using Monte Carlo method
-    const auto basisCount = getBasisCount();
-    const auto sampleCount = samples.size();
-    const auto scale = 1.0F / (LightProbeSampler::uniformSpherePdf() * static_cast<float>(sampleCount));
-
-    std::vector<Float3> coefficients;
-    coefficients.reserve(basisCount);
-
-    for (auto i = 0U; i < basisCount; i++) {
-        Float3 coefficient{0.0F, 0.0F, 0.0F};
-
-        for (auto k = 0; k < sampleCount; k++) {
-            coefficient += values[k] * evaluateBasis(i, samples[k]);
-        }
-
-        coefficient *= scale;
-        coefficients.push_back(coefficient);
+    SHAccumulator<SH_ORDER> accumulator;
+    for (auto k = 0U; k < samples.size(); k++) {
+        accumulator.add(samples[k], values[k]);
     }
 
-    return coefficients;
+    return accumulator.getCoefficients();
 }
 
 std::vector<Float3> SH::convolveCosine(const std::vector<Float3>& radianceCoefficients) {
-    static const float COSTHETA[3] = {0.8862268925F, 1.0233267546F, 0.4954159260F};    
-    const auto lmax = 2;
+    // the odd bands above 1 of the clamped cosine are zero
+    static const float COSTHETA[4] = {0.8862268925F, 1.0233267546F, 0.4954159260F, 0.0F};
+    const auto lmax = static_cast<int32_t>(std::sqrt(static_cast<float>(radianceCoefficients.size()))) - 1;
+    assert(lmax >= 0 && lmax <= 3);
 
     std::vector<Float3> irradianceCoefficients;
 
@@ -3,11 +3,11 @@
 #include "LFX_Math.h"
 #include "LFX_Vec3.h"
 #include <cmath>
-#include <functional>
 #include <vector>
 
 namespace LFX {
 
+#define SH_ORDER 2
 #define SH_BASIS_COUNT 9
 
 class LightProbeSampler {
@@ -28,13 +28,216 @@ public:
     static inline float uniformSpherePdf() { return 1.0F / (4.0F * Pi); }
 };
 
+/**
+ * SH bases of the bands 0 to L, unrolled per order. The bases are written to out[index * stride]
+ * so a loop over many directions evaluates into SoA arrays and can be vectorized
+ */
+template <int L>
+struct SHBasis;
+
+template <>
+struct SHBasis<1> {
+    static constexpr int Count = 4;
+
+    static inline void evaluate(float* out, int stride, float x, float y, float z) {
+        out[0 * stride] = 0.282095F;     // 0.5F * std::sqrtf(InvPi)
+        out[1 * stride] = 0.488603F * y; // 0.5F * std::sqrtf(3.0F * InvPi) * v.y
+        out[2 * stride] = 0.488603F * z; // 0.5F * std::sqrtf(3.0F * InvPi) * v.z
+        out[3 * stride] = 0.488603F * x; // 0.5F * std::sqrtf(3.0F * InvPi) * v.x
+    }
+};
+
+template <>
+struct SHBasis<2> {
+    static constexpr int Count = 9;
+
+    static inline void evaluate(float* out, int stride, float x, float y, float z) {
+        SHBasis<1>::evaluate(out, stride, x, y, z);
+        out[4 * stride] = 1.09255F * y * x;                  // 0.5F * std::sqrtf(15.0F * InvPi) * v.y * v.x
+        out[5 * stride] = 1.09255F * y * z;                  // 0.5F * std::sqrtf(15.0F * InvPi) * v.y * v.z
+        out[6 * stride] = 0.946175F * (z * z - 1.0F / 3.0F); // 0.75F * std::sqrtf(5.0F * InvPi) * (v.z * v.z - 1.0F / 3.0F)
+        out[7 * stride] = 1.09255F * z * x;                  // 0.5F * std::sqrtf(15.0F * InvPi) * v.z * v.x
+        out[8 * stride] = 0.546274F * (x * x - y * y);       // 0.25F * std::sqrtf(15.0F * InvPi) * (v.x * v.x - v.y * v.y)
+    }
+};
+
+template <>
+struct SHBasis<3> {
+    static constexpr int Count = 16;
+
+    static inline void evaluate(float* out, int stride, float x, float y, float z) {
+        SHBasis<2>::evaluate(out, stride, x, y, z);
+        out[9 * stride] = 0.590044F * y * (3.0F * x * x - y * y);          // 0.25F * std::sqrtf(35.0F / 2.0F * InvPi)
+        out[10 * stride] = 2.890611F * x * y * z;                          // 0.5F * std::sqrtf(105.0F * InvPi)
+        out[11 * stride] = 0.457046F * y * (4.0F * z * z - x * x - y * y); // 0.25F * std::sqrtf(21.0F / 2.0F * InvPi)
+        out[12 * stride] = 0.373176F * z * (2.0F * z * z - 3.0F * x * x - 3.0F * y * y); // 0.25F * std::sqrtf(7.0F * InvPi)
+        out[13 * stride] = 0.457046F * x * (4.0F * z * z - x * x - y * y); // 0.25F * std::sqrtf(21.0F / 2.0F * InvPi)
+        out[14 * stride] = 1.445306F * z * (x * x - y * y);                // 0.25F * std::sqrtf(105.0F * InvPi)
+        out[15 * stride] = 0.590044F * x * (x * x - 3.0F * y * y);         // 0.25F * std::sqrtf(35.0F / 2.0F * InvPi)
+    }
+};
+
+/**
+ * Streaming Monte Carlo projection to the bands 0 to L of samples uniformly distributed on the sphere.
+ * The samples are buffered in SoA batches which are projected together, no sample is kept after its batch
+ */
+template <int L>
+class SHAccumulator {
+public:
+    static constexpr int Count = SHBasis<L>::Count;
+    static constexpr int BatchSize = 64;
+
+    SHAccumulator() {
+        reset();
+    }
+
+    void reset() {
+        _pending = 0;
+        _sampleCount = 0;
+        for (auto i = 0; i < Count; i++) {
+            _sums[i] = Float3(0.0F, 0.0F, 0.0F);
+            _lobes[i] = Float3(0.0F, 0.0F, 0.0F);
+        }
+    }
+
+    /**
+     * add the function value * max(0, dot(dir, w)) analytically, its projection is the clamped cosine
+     * lobe rotated to dir
+     */
+    void addCosineLobe(const Float3& dir, const Float3& value) {
+        // sqrt(4 * Pi / (2 * l + 1)) times the zonal coefficients of the clamped cosine
+        static const float LOBE[4] = {Pi, 2.0F * Pi / 3.0F, Pi / 4.0F, 0.0F};
+
+        float basis[Count];
+        SHBasis<L>::evaluate(basis, 1, dir.x, dir.y, dir.z);
+        for (auto l = 0; l <= L; l++) {
+            for (auto i = l * l; i < (l + 1) * (l + 1); i++) {
+                _lobes[i] += value * (LOBE[l] * basis[i]);
+            }
+        }
+    }
+
+    /**
+     * add the value of the function in direction dir
+     */
+    inline void add(const Float3& dir, const Float3& value) {
+        _x[_pending] = dir.x;
+        _y[_pending] = dir.y;
+        _z[_pending] = dir.z;
+        _r[_pending] = value.x;
+        _g[_pending] = value.y;
+        _b[_pending] = value.z;
+        if (++_pending == BatchSize) {
+            flush();
+        }
+    }
+
+    /**
+     * project the buffered samples
+     */
+    void flush() {
+        const auto count = _pending;
+        if (count == 0) {
+            return;
+        }
+
+        float basis[Count][BatchSize];
+        for (auto k = 0; k < count; k++) {
+            SHBasis<L>::evaluate(&basis[0][k], BatchSize, _x[k], _y[k], _z[k]);
+        }
+
+        for (auto i = 0; i < Count; i++) {
+            float r = 0.0F, g = 0.0F, b = 0.0F;
+            for (auto k = 0; k < count; k++) {
+                r += basis[i][k] * _r[k];
+                g += basis[i][k] * _g[k];
+                b += basis[i][k] * _b[k];
+            }
+            _sums[i] += Float3(r, g, b);
+        }
+
+        _sampleCount += count;
+        _pending = 0;
+    }
+
+    /**
+     * return the coefficients of the samples added so far
+     */
+    std::vector<Float3> getCoefficients() {
+        flush();
+
+        std::vector<Float3> coefficients(_lobes, _lobes + Count);
+        if (_sampleCount == 0) {
+            return coefficients;
+        }
+
+        const auto scale = 1.0F / (LightProbeSampler::uniformSpherePdf() * static_cast<float>(_sampleCount));
+        for (auto i = 0; i < Count; i++) {
+            coefficients[i] += _sums[i] * scale;
+        }
+
+        return coefficients;
+    }
+
+    inline uint32_t getSampleCount() const {
+        return _sampleCount + _pending;
+    }
+
+private:
+    float _x[BatchSize], _y[BatchSize], _z[BatchSize];
+    float _r[BatchSize], _g[BatchSize], _b[BatchSize];
+    int _pending;
+    uint32_t _sampleCount;
+    Float3 _sums[Count];
+    Float3 _lobes[Count];
+};
+
+/**
+ * Streaming irradiance of the texels of a size x size octahedral map, the samples are uniformly
+ * distributed on the sphere and every texel gathers them with the cosine to its center direction
+ */
+class OctahedralAccumulator {
+public:
+    explicit OctahedralAccumulator(uint32_t size);
+
+    /**
+     * add the radiance arriving from direction dir
+     */
+    void add(const Float3& dir, const Float3& value);
+
+    /**
+     * add the radiance value * max(0, dot(dir, w)) analytically
+     */
+    void addCosineLobe(const Float3& dir, const Float3& value);
+
+    /**
+     * return the irradiance of the texels, row by row
+     */
+    std::vector<Float3> getTexels() const;
+
+    /**
+     * direction of the point (u, v) in [0, 1] of the map
+     */
+    static Float3 decode(float u, float v);
+
+    /**
+     * point in [0, 1] of the map of a normalized direction
+     */
+    static Float2 encode(const Float3& dir);
+
+private:
+    uint32_t _size;
+    uint32_t _sampleCount;
+    std::vector<Float3> _directions;
+    std::vector<Float3> _sums;
+    std::vector<Float3> _lobes;
+};
+
 /**
  * Spherical Harmonics utility class
  */
 class SH {
 public:
-    using BasisFunction = std::function<float(const Float3& v)>;
-
     /**
      * recreate a function from sh coefficients
      */
@@ -62,9 +265,11 @@ public:
      */
     static inline float evaluateBasis(uint32_t index, const Float3& sample) {
         assert(index < getBasisCount());
-        const auto& func = _basisFunctions[index];
 
-        return func(sample);
+        float basis[SH_BASIS_COUNT];
+        SHBasis<SH_ORDER>::evaluate(basis, 1, sample.x, sample.y, sample.z);
+
+        return basis[index];
     }
 
 private:
@@ -75,8 +280,6 @@ private:
     static inline int32_t toIndex(int32_t l, int32_t m) {
         return l * l + l + m;
     }
-
-    static std::vector<BasisFunction> _basisFunctions;
 };
 
 }
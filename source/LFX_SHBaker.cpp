@@ -2,6 +2,7 @@
 #include "LFX_ILBakerSampling.h"
 #include "LFX_ILPathTrace.h"
 #include "LFX_World.h"
+#include "LFX_ILBakerRaytrace.h"
 
 namespace LFX {
 
@@ -19,19 +20,14 @@ namespace LFX {
 		result += kl > 0 ? color * L->DirectScale : Float3(0, 0, 0);
 	}
 
-	float SHCalcIndirectLighting(Float3& result, const Ray& from, const Vertex& V, Light* L, const Material* M)
+	Float3 SHGetLightDirection(const Light* L, const Float3& point)
 	{
-		float kl = 0;
-		Float3 color;
-		World::Instance()->GetShader()->DoLighting(color, kl, from.orig, V, L, M, true, true);
-		if (kl > 0 && L->CastShadow) {
-			float s = CalcShadowMask(V.Position, L, LFX_MESH | LFX_TERRAIN);
-			kl *= s;
-			color *= s;
+		// the direction Shader::DoLighting uses for the light
+		if (L->Type == Light::POINT) {
+			return Float3::Normalize(L->Position - point);
 		}
 
-		result += kl > 0 ? color * L->IndirectScale : Float3(0, 0, 0);
-		return kl;
+		return -L->Direction;
 	}
 
 	void SHGetLightList(std::vector<Light*>& lights, const Float3& point)
@@ -49,196 +45,188 @@ namespace LFX {
 
 	using namespace ILBaker;
 
-	bool SHPathTraceFunc(Float3& result, const PathTraceParams& params, const Ray& ray, const Vertex& vtx, const Material* mtl, bool hitSky)
+	template <int L>
+	static std::vector<Float3> _SHResolve(SHAccumulator<L>& accumulator)
 	{
-		if (hitSky) {
-			result += params.skyRadiance;
-			return true;
-		}
-
-		float kl = 0;
-		std::vector<Light*> lights;
-		SHGetLightList(lights, vtx.Position);
-		for (size_t i = 0; i < lights.size(); ++i) {
-			Float3 diffuse;
-			kl += SHCalcIndirectLighting(diffuse, ray, vtx, lights[i], mtl);
-			result += diffuse * params.diffuseScale;
-		}
+		return SH::convolveCosine(accumulator.getCoefficients());
+	}
 
-		result += mtl->GetSurfaceEmissive(vtx.UV.x, vtx.UV.y);
+	// the clamped cosine has no band 3, L3 is kept as radiance and the runtime convolves it
+	static std::vector<Float3> _SHResolve(SHAccumulator<3>& accumulator)
+	{
+		return accumulator.getCoefficients();
+	}
 
-		return kl > 0;
+	static std::vector<Float3> _SHResolve(OctahedralAccumulator& accumulator)
+	{
+		return accumulator.getTexels();
 	}
 
-	PathTraceResult SHPathTrace(const PathTraceParams& params, Random& rand, bool& hitSky)
+	template <class Accumulator>
+	void SHBaker::_bake(const std::vector<SHProbe*>& probes, const Accumulator& prototype)
 	{
-		PathTraceResult result;
-
-		Ray ray;
-		ray.orig = params.rayStart;
-		ray.dir = params.rayDir;
-
-		// Keep tracing paths until we reach the specified max
-		float throughput = 1.0f;
-		Entity* traceEntity = params.entity;
-		const int maxPathLength = params.maxPathLength;
-		for (; result.pathLen <= maxPathLength || maxPathLength == -1; ++result.pathLen) {
-#if 0 // Disable russian roulette
-			// See if we should randomly terminate this path using Russian Roullete
-			const int rouletteDepth = params.RussianRouletteDepth;
-			if (pathLength >= rouletteDepth && rouletteDepth != -1) {
-				float continueProbability = std::min<float>(params.RussianRouletteProbability, ComputeLuminance(throughput));
-				if (randomGenerator.RandomFloat() > continueProbability) {
-					break;
+		const int numProbes = (int)probes.size();
+		std::vector<Accumulator> accumulators(numProbes, prototype);
+
+		// Calculate direct lightings
+		for (int i = 0; i < numProbes; ++i) {
+			const Float3 position = probes[i]->position;
+
+			// the lights and their shadows only depend on the probe position, every light is a clamped
+			// cosine lobe towards the light which the accumulator adds analytically
+			std::vector<Light*> lights;
+			SHGetLightList(lights, position);
+			for (auto* light : lights) {
+#if 0
+				if (light->Type == Light::DIRECTION) {
+					continue;
 				}
-				throughput /= continueProbability;
-				irrThroughput /= continueProbability;
-			}
 #endif
-
-			// Set this to true to keep the loop going
-			bool continueTracing = false;
-
-			// Check for intersection with the scene
-			Contact contact;
-			if (World::Instance()->GetScene()->RayCheck(contact, ray, params.rayLen, LFX_TERRAIN | LFX_MESH)) {
-				traceEntity = contact.entity;
-
-				// back facing
-				if (!contact.facing) {
-					break;
+				if (light->DirectScale <= 0) {
+					continue;
 				}
 
-				Vertex vtx = contact.vhit;
-				Material* mtl = (Material*)contact.mtl;
+				Vertex vtx;
+				Material mat;
 
-				Float3 diffuse;
-				if (!SHPathTraceFunc(diffuse, params, ray, vtx, mtl, false)) {
-					break;
-				}
+				vtx.Position = position;
+				vtx.Normal = SHGetLightDirection(light, position);
 
-				float lenSq = (vtx.Position - ray.orig).lenSqr();
-				//throughput *= 1.0f / (lenSq + 1.0f);
-				throughput *= 1.0f / Pi;
-				result.color += (diffuse * throughput);
+				Float3 color;
+				SHCalcDirectLighting(color, vtx, light, &mat);
+				if (color.x > 0 || color.y > 0 || color.z > 0) {
+					accumulators[i].addCosineLobe(vtx.Normal, color);
+				}
+			}
+		}
 
-				// Pick a new path, using MIS to sample both our diffuse and specular BRDF's
-				if (1) {
-					Mat3 tangentToWorld;
-					tangentToWorld.SetXBasis(vtx.Tangent);
-					tangentToWorld.SetYBasis(vtx.Binormal);
-					tangentToWorld.SetZBasis(vtx.Normal);
+		// Calculate indirect lightings
+		if (_ctx.LightingScale > 0) {
+			// the cached radiance is lit with GIScale, it is only shared when the probes use the same scale
+			const auto* settings = World::Instance()->GetSetting();
+			const bool shareCache = settings->GIRadianceCache && settings->GIProbeScale == settings->GIScale;
+
+			struct ProbeRay
+			{
+				uint32 key;
+				int probe;
+				int sample;
+				Float3 dir;
+			};
+
+			// decorrelate the probes by their position
+			std::vector<uint32> seeds(numProbes);
+			for (int i = 0; i < numProbes; ++i) {
+				uint32 bits[3];
+				memcpy(bits, &probes[i]->position, sizeof(bits));
+				seeds[i] = HashSeed(HashSeed(bits[0], bits[1]), bits[2]);
+			}
 
-					Float2 sample;
-#if 0
-					// Randomly select if we should sample our diffuse BRDF, or our specular BRDF
-					if (params.sampleSet && result.pathLen <= 1) {
-						sample = params.sampleSet->BRDF();
+			const int maxRays = numProbes * std::min((int)kPassSamples, _ctx.Samples);
+			std::vector<ProbeRay> entries;
+			std::vector<Ray> rays(maxRays);
+			std::vector<float> lens(maxRays, DEFAULT_RAYTRACE_MAX_LENGHT);
+			std::vector<Contact> contacts(maxRays);
+			// std::vector<bool> is packed, the hits are stored as bytes
+			std::vector<char> hits(maxRays);
+			entries.reserve(maxRays);
+
+			for (int first = 0; first < _ctx.Samples; first += kPassSamples) {
+				const int passSamples = std::min((int)kPassSamples, _ctx.Samples - first);
+
+				// the rays are sorted by the octant of their direction, then by their probe,
+				// the probes of a batch are in spatial order
+				entries.clear();
+				for (int i = 0; i < numProbes; ++i) {
+					for (int sampleIdx = first; sampleIdx < first + passSamples; ++sampleIdx) {
+						const Float2 u = SampleSobol2D(sampleIdx, seeds[i]);
+						const Float3 dir = LightProbeSampler::uniformSampleSphere(u.x, u.y);
+						const uint32 octant = (dir.x < 0 ? 1 : 0) | (dir.y < 0 ? 2 : 0) | (dir.z < 0 ? 4 : 0);
+
+						entries.push_back({ (octant << 24) | (uint32)i, i, sampleIdx, dir });
 					}
-					else {
-						sample = rand.RandomFloat2();
+				}
+				std::sort(entries.begin(), entries.end(), [](const ProbeRay& a, const ProbeRay& b) {
+					return a.key != b.key ? a.key < b.key : a.sample < b.sample;
+				});
+
+				const int count = (int)entries.size();
+				for (int k = 0; k < count; ++k) {
+					rays[k].orig = probes[entries[k].probe]->position;
+					rays[k].dir = entries[k].dir;
+				}
+				World::Instance()->GetScene()->RayCheckBatch(&contacts[0], (bool*)&hits[0], &rays[0], &lens[0], count, LFX_TERRAIN | LFX_MESH);
+
+				for (int k = 0; k < count; ++k) {
+					const ProbeRay& entry = entries[k];
+
+					IntegrationSampleSet sampleSet;
+					sampleSet.Init(seeds[entry.probe], entry.sample);
+
+					PathTraceParams params;
+					params.sampleSet = &sampleSet;
+					params.rayDir = rays[k].dir;
+					params.rayStart = rays[k].orig;
+					params.rayLen = DEFAULT_RAYTRACE_MAX_LENGHT;
+					params.maxPathLength = _ctx.MaxPathLength;
+					params.russianRouletteDepth = _ctx.RussianRouletteDepth;
+					params.russianRouletteProbability = _ctx.RussianRouletteProbability;
+					params.skyRadiance = _ctx.SkyRadiance;
+					params.diffuseScale = _ctx.LightingScale;
+					params.primaryContact = &contacts[k];
+					params.primaryHit = hits[k] != 0;
+					if (shareCache) {
+						params.radianceCache = World::Instance()->GetRadianceCache();
 					}
-#else
-					sample = rand.RandomFloat2();
-#endif
 
-					//Float3 v = Float3::Normalize(rayOrigin - hitSurface.position);
+					// the same estimator as the lightmap paths, their cached radiance is reused
+					bool hitSky = false;
+					PathTraceResult sampleResult = PathTrace(params, RTPathTraceFunc, _ctx.Random, hitSky);
 
-					// We're sampling the diffuse BRDF, so sample a cosine-weighted hemisphere
-					Float3 sampleDir;
-					sampleDir = SampleCosineHemisphere(sample);
-					sampleDir = Float3::Normalize(Mat3::Transform(sampleDir, tangentToWorld));
-					if (sampleDir.dot(vtx.Normal) > 0.0f) {
-						// Generate the ray for the new path
-						ray.orig = vtx.Position + sampleDir * 0.01f;
-						ray.dir = sampleDir;
-
-						continueTracing = true;
-					}
+					accumulators[entry.probe].add(entry.dir, sampleResult.color);
 				}
 			}
-			else {
-				Float3 diffuse;
-				if (SHPathTraceFunc(diffuse, params, ray, Vertex(), nullptr, true)) {
-					result.color += diffuse * throughput;
-				}
-				hitSky = true;
-			}
-
-			if (continueTracing == false) break;
 		}
 
-		return result;
+		for (int i = 0; i < numProbes; ++i) {
+			probes[i]->coefficients = _SHResolve(accumulators[i]);
+		}
 	}
 
 	void SHBaker::Run(SHProbe* probe)
 	{
-		_ctx.Samples = World::Instance()->GetSetting()->GIProbeSamples;
+		Run(std::vector<SHProbe*>(1, probe));
+	}
+
+	void SHBaker::Run(const std::vector<SHProbe*>& probes, int samples)
+	{
+		const auto* settings = World::Instance()->GetSetting();
+
+		_ctx.Samples = samples > 0 ? samples : settings->GIProbeSamples;
 		_ctx.LightingScale = World::Instance()->GetSetting()->GIProbeScale;
 		_ctx.MaxPathLength = World::Instance()->GetSetting()->GIProbePathLength;
+		_ctx.RussianRouletteDepth = World::Instance()->GetSetting()->GIRussianRouletteDepth;
+		_ctx.RussianRouletteProbability = World::Instance()->GetSetting()->GIRussianRouletteProbability;
 		_ctx.SkyRadiance = World::Instance()->GetSetting()->SkyRadiance;
 
-		std::vector<Float3> radianceCoefficients;
+		// the samples are projected as they are traced
+		switch (settings->ProbeEncoding) {
+		case PROBE_SH_L1:
+			_bake(probes, SHAccumulator<1>());
+			break;
 
-		// Calculate indirect lightings
-		{
-			std::vector<Float3> results;
-			std::vector<Float3> samples = LightProbeSampler::uniformSampleSphereAll(_ctx.Samples);
-
-			for (int sampleIdx = 0; sampleIdx < samples.size(); ++sampleIdx) {
-				Ray ray;
-				ray.orig = probe->position;
-				ray.dir = samples[sampleIdx];
-
-				PathTraceParams params;
-				params.sampleSet = nullptr;
-				params.rayDir = ray.dir;
-				params.rayStart = ray.orig;
-				params.rayLen = DEFAULT_RAYTRACE_MAX_LENGHT;
-				params.maxPathLength = _ctx.MaxPathLength;
-				//params.russianRouletteDepth = _ctx.RussianRouletteDepth;
-				//params.russianRouletteProbability = 0.5f;
-				params.skyRadiance = _ctx.SkyRadiance;
-				params.diffuseScale = _ctx.LightingScale;
-
-				bool hitSky = false;
-				PathTraceResult sampleResult;
-				if (params.diffuseScale > 0) {
-					sampleResult = SHPathTrace(params, _ctx.Random, hitSky);
-				}
-
-				// Calculate direct lightings
-				std::vector<Light*> lights;
-				SHGetLightList(lights, probe->position);
-				for (auto* light : lights) {
-#if 0
-					if (light->Type == Light::DIRECTION) {
-						continue;
-					}
-#endif
-					if (light->DirectScale <= 0) {
-						continue;
-					}
+		case PROBE_SH_L3:
+			_bake(probes, SHAccumulator<3>());
+			break;
 
-					Vertex vtx;
-					Material mat;
+		case PROBE_OCTAHEDRAL:
+			_bake(probes, OctahedralAccumulator(settings->ProbeOctahedralSize));
+			break;
 
-					vtx.Position = probe->position;
-					vtx.Normal = ray.dir;
-
-					Float3 color;
-					SHCalcDirectLighting(color, vtx, light, &mat);
-					sampleResult.color += color;
-				}
-
-				results.push_back(sampleResult.color);
-			}
-
-			radianceCoefficients = SH::project(samples, results);
+		default:
+			_bake(probes, SHAccumulator<2>());
+			break;
 		}
-
-		auto irradianceCoefficients = SH::convolveCosine(radianceCoefficients);
-		probe->coefficients = irradianceCoefficients;
 	}
 
 }
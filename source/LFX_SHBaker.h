@@ -2,26 +2,49 @@
 
 #include "LFX_SH.h"
 #include "LFX_Entity.h"
+#include "LFX_Light.h"
 #include "LFX_ILPathTrace.h"
 
 namespace LFX {
 
+	// encodings of the baked probes, World::Settings::ProbeEncoding
+	enum ProbeEncoding
+	{
+		PROBE_SH_L1 = 1,
+		PROBE_SH_L2 = 2,
+		// radiance sh, the runtime convolves it with the cosine lobe
+		PROBE_SH_L3 = 3,
+		// irradiance map of ProbeOctahedralSize x ProbeOctahedralSize texels
+		PROBE_OCTAHEDRAL = 4,
+	};
+
 	struct SHProbe : public Entity
 	{
 		Float3 position;
 		Float3 normal;
+		// sh coefficients or octahedral texels of the encoding
 		std::vector<Float3> coefficients;
 
 		virtual int GetType() override { return LFX_SHPROBE; }
 	};
 
+	// the lights of the probe at point, only the GI enabled ones light the probes
+	void SHGetLightList(std::vector<Light*>& lights, const Float3& point);
+
 	class SHBaker
 	{
 	public:
+		// probes baked together by a task
+		static const int kBatchProbes = 64;
+		// samples of every probe traced in one ray batch
+		static const int kPassSamples = 32;
+
 		struct Context
 		{
 			int Samples = 1024;
 			int MaxPathLength = 0;
+			int RussianRouletteDepth = -1;
+			float RussianRouletteProbability = 0;
 			float LightingScale = 0;
 			Float3 SkyRadiance;
 			ILBaker::Random Random;
@@ -31,6 +54,14 @@ namespace LFX {
 
 	public:
 		void Run(SHProbe* probe);
+		// the probes should be close to each other, their rays are traced in coherent batches,
+		// samples <= 0 uses GIProbeSamples
+		void Run(const std::vector<SHProbe*>& probes, int samples = 0);
+
+	protected:
+		// bakes the probes with an accumulator copied from prototype each
+		template <class Accumulator>
+		void _bake(const std::vector<SHProbe*>& probes, const Accumulator& prototype);
 	};
 
 }
\ No newline at end of file
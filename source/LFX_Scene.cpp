@@ -11,71 +11,21 @@ namespace LFX {
 	{
 	}
 
-	bool BVT_AddMesh(BSPTree<Mesh*>::Node* node, Mesh* mesh)
-	{
-		Aabb bound = mesh->GetBound();
-
-		if (node->aabb.Contain(bound))
-		{
-			if (node->child[0] != NULL && BVT_AddMesh(node->child[0], mesh))
-				return true;
-
-			if (node->child[1] != NULL && BVT_AddMesh(node->child[1], mesh))
-				return true;
-
-			node->elems.push_back(mesh);
-
-			return true;
-		}
-
-		return false;
-	}
-
-	Aabb BVT_Optimize(BSPTree<Mesh*>::Node* node)
-	{
-		if (node->child[0] == NULL)
-		{
-			if (node->elems.size() > 0)
-			{
-				Aabb bound = node->elems[0]->GetBound();
-				for (size_t i = 1; i < node->elems.size(); ++i)
-				{
-					bound.Merge(node->elems[i]->GetBound());
-				}
-
-				node->aabb = bound;
-			}
-		}
-		else
-		{
-			Aabb bound = BVT_Optimize(node->child[0]);
-			bound.Merge(BVT_Optimize(node->child[1]));
-
-			node->aabb = bound;
-		}
-
-		return node->aabb;
-	}
-
 	void Scene::Build()
 	{
-		Aabb worldBound;
-
-		worldBound.Invalid();
+		mMeshes.clear();
 		for (auto mesh : World::Instance()->GetMeshes()) {
-			Aabb bound = mesh->GetBound();
-			worldBound.Merge(bound);
-		}
-
-		mBVTree.Clear();
-		if (worldBound.Valid()) {
-			mBVTree.Build(worldBound, LFX_BVH_LEVELS);
-			for (auto mesh : World::Instance()->GetMeshes()) {
-				BVT_AddMesh(mBVTree.RootNode(), mesh);
+			if (mesh->Valid()) {
+				mMeshes.push_back(mesh);
 			}
+		}
 
-			BVT_Optimize(mBVTree.RootNode());
+		std::vector<Aabb> bounds(mMeshes.size());
+		for (size_t i = 0; i < mMeshes.size(); ++i) {
+			bounds[i] = mMeshes[i]->GetBound();
 		}
+
+		mBVH.Build(bounds);
 	}
 
 	bool Scene::RayCheck(Contact& contact, const Ray& ray, float len, int flags)
@@ -83,33 +33,7 @@ namespace LFX {
 		return _RayCheckImp(contact, ray, len, flags);
 	}
 
-	bool _occluded(BSPTree<Mesh*>::Node* node, const Ray& ray, float len)
-	{
-		float dist = 0;
-
-		if (!Intersect(ray, &dist, node->aabb)) {
-			return false;
-		}
-
-		for (size_t i = 0; i < node->elems.size(); ++i) {
-			if (node->elems[i]->Occluded(ray, len))
-				return true;
-		}
-
-		if (node->child[0] != NULL) {
-			if (_occluded(node->child[0], ray, len))
-				return true;
-		}
-
-		if (node->child[1] != NULL) {
-			if (_occluded(node->child[1], ray, len))
-				return true;
-		}
-
-		return false;
-	}
-
-	bool _occluded(const std::vector<Terrain*>& terrains, const Ray& ray, float len)
+	bool _occludedTerrain(const std::vector<Terrain*>& terrains, const Ray& ray, float len)
 	{
 		for (auto i : terrains) {
 			if (i->Occluded(ray, len)) {
@@ -122,9 +46,17 @@ namespace LFX {
 
 	bool Scene::_OccludedImp(const Ray& ray, float len, int flags)
 	{
-		if ((flags & LFX_MESH) && mBVTree.RootNode() != NULL && _occluded(mBVTree.RootNode(), ray, len))
+		auto occludedMeshes = [&](int first, int count) {
+			for (int i = first; i < first + count; ++i) {
+				if (mMeshes[mBVH.GetPrimitive(i)]->Occluded(ray, len))
+					return true;
+			}
+			return false;
+		};
+
+		if ((flags & LFX_MESH) && mBVH.Occluded(ray, len, occludedMeshes))
 			return true;
-		if ((flags & LFX_TERRAIN) && _occluded(World::Instance()->GetTerrains(), ray, len))
+		if ((flags & LFX_TERRAIN) && _occludedTerrain(World::Instance()->GetTerrains(), ray, len))
 			return true;
 
 		return false;
@@ -135,30 +67,21 @@ namespace LFX {
 		return _OccludedImp(ray, len, flags);
 	}
 
-	void _rayCheck(Contact& contract, BSPTree<Mesh*>::Node* node, const Ray& ray, float len)
+	void Scene::OccludedBatch(bool* results, const Ray* rays, const float* lens, int count, int flags)
 	{
-		float dist = 0;
-
-		if (!Intersect(ray, &dist, node->aabb) || contract.td < dist)
-			return;
-
-		for (size_t i = 0; i < node->elems.size(); ++i)
-		{
-			node->elems[i]->RayCheck(contract, ray, len);
-		}
-
-		if (node->child[0] != NULL)
-		{
-			_rayCheck(contract, node->child[0], ray, len);
+		for (int i = 0; i < count; ++i) {
+			results[i] = Occluded(rays[i], lens[i], flags);
 		}
+	}
 
-		if (node->child[1] != NULL)
-		{
-			_rayCheck(contract, node->child[1], ray, len);
+	void Scene::RayCheckBatch(Contact* contacts, bool* hits, const Ray* rays, const float* lens, int count, int flags)
+	{
+		for (int i = 0; i < count; ++i) {
+			hits[i] = RayCheck(contacts[i], rays[i], lens[i], flags);
 		}
 	}
 
-	void _rayCheck(Contact& contact, const std::vector<Terrain*>& terrains, const Ray& ray, float len)
+	void _rayCheckTerrain(Contact& contact, const std::vector<Terrain*>& terrains, const Ray& ray, float len)
 	{
 		for (auto i : terrains) {
 			i->RayCheck(contact, ray, len);
@@ -174,36 +97,20 @@ namespace LFX {
 		contact.entity = NULL;
 		contact.facing = false;
 
-		if ((flags & LFX_MESH) && mBVTree.RootNode() != NULL) {
-			_rayCheck(contact, mBVTree.RootNode(), ray, len);
+		if (flags & LFX_MESH) {
+			// meshes are visited front to back, the closest hit so far culls the farther ones
+			mBVH.RayCheck(ray, len, [&](int first, int count) {
+				for (int i = first; i < first + count; ++i) {
+					mMeshes[mBVH.GetPrimitive(i)]->RayCheck(contact, ray, len);
+				}
+				return std::min(contact.td, len);
+			});
 		}
 		if ((flags & LFX_TERRAIN) && World::Instance()->GetTerrains().size() > 0) {
-			_rayCheck(contact, World::Instance()->GetTerrains(), ray, len);
+			_rayCheckTerrain(contact, World::Instance()->GetTerrains(), ray, len);
 		}
 
 		if (contact.entity != NULL) {
-			Vertex a, b, c;
-			if (contact.entity->GetType() == LFX_TERRAIN) {
-				Terrain* terrain = (Terrain*)contact.entity;
-
-				Triangle tri = terrain->_getTriangle(contact.triIndex);
-				a = terrain->_getVertex(tri.Index0);
-				b = terrain->_getVertex(tri.Index1);
-				c = terrain->_getVertex(tri.Index2);
-			}
-			else {
-				Mesh* mesh = (Mesh*)contact.entity;
-
-				Triangle tri = mesh->_getTriangle(contact.triIndex);
-				a = mesh->_getVertex(tri.Index0);
-				b = mesh->_getVertex(tri.Index1);
-				c = mesh->_getVertex(tri.Index2);
-			}
-
-#if 0
-			Float3 triNml = Float3::Normalize(Float3::Cross(c.Position - a.Position, b.Position - a.Position));
-			contact.backFacing = Float3::Dot(triNml, ray.dir) >= 0.0f;
-#endif
 			contact.facing = Float3::Dot(contact.vhit.Normal, -ray.dir) >= 0.0f;
 		}
 
@@ -17,11 +17,16 @@ namespace LFX {
 		virtual bool RayCheck(Contact& contact, const Ray& ray, float len, int mask);
 		virtual bool Occluded(const Ray& ray, float len, int mask);
 
+		// Batch queries, rays should be coherent (sorted) for packet tracing
+		virtual void RayCheckBatch(Contact* contacts, bool* hits, const Ray* rays, const float* lens, int count, int mask);
+		virtual void OccludedBatch(bool* results, const Ray* rays, const float* lens, int count, int mask);
+
 		bool _RayCheckImp(Contact& contact, const Ray& ray, float len, int flags);
 		bool _OccludedImp(const Ray& ray, float len, int flags);
 
 	protected:
-		BSPTree<Mesh*> mBVTree;
+		BVH mBVH;
+		std::vector<Mesh*> mMeshes;
 	};
 
 }
\ No newline at end of file
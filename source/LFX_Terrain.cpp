@@ -2,6 +2,7 @@
 #include "LFX_Terrain.h"
 #include "LFX_AOBaker.h"
 #include "LFX_ILBakerRaytrace.h"
+#include "LFX_Denoiser.h"
 #include "LFX_EmbreeScene.h"
 
 namespace LFX {
@@ -70,7 +71,6 @@ namespace LFX {
 		int zGridCount = mDesc.GridCount.y;
 
 		mVertexBuffer.reserve((xGridCount + 1) * (zGridCount + 1));
-		mTriBuffer.reserve(xGridCount * zGridCount * 2);
 
 		for (int j = 0; j < zGridCount + 1; ++j)
 		{
@@ -91,28 +91,6 @@ namespace LFX {
 			}
 		}
 
-		for (int j = 0; j < zGridCount; ++j)
-		{
-			int row = j * (xGridCount + 1);
-			int row_n = row + (xGridCount + 1);
-
-			for (int i = 0; i < xGridCount; ++i)
-			{
-				Triangle t1, t2;
-
-				t1.Index0 = row + i;
-				t1.Index1 = row + i + 1;
-				t1.Index2 = row_n + i;
-
-				t2.Index0 = row_n + i;
-				t2.Index1 = row + i + 1;
-				t2.Index2 = row_n + i + 1;
-
-				mTriBuffer.push_back(t1);
-				mTriBuffer.push_back(t2);
-			}
-		}
-
 		int mapSize = mDesc.LMapSize - kLMapBorder * 2;
 		mLightingMap.resize(mDesc.BlockCount.x * mDesc.BlockCount.y);
 		for (int i = 0; i < mLightingMap.size(); ++i)
@@ -123,6 +101,9 @@ namespace LFX {
 			}
 		}
 
+		mIndirectMaps.resize(mDesc.BlockCount.x * mDesc.BlockCount.y);
+		mHorizonMaps.resize(mDesc.BlockCount.x * mDesc.BlockCount.y);
+
 		mBlockValid.resize(mDesc.BlockCount.x * mDesc.BlockCount.y);
 		for (int i = 0; i < mBlockValid.size(); ++i)
 		{
@@ -146,24 +127,12 @@ namespace LFX {
 		mMapSizeU = mapSize * mDesc.BlockCount.x;
 		mMapSizeV = mapSize * mDesc.BlockCount.y;
 
-		Aabb bound;
-		bound.minimum = mVertexBuffer[0].Position;
-		bound.maximum = mVertexBuffer[0].Position;
-
-		for (int i = 1; i < mVertexBuffer.size(); ++i)
+		std::vector<float> heights(mVertexBuffer.size());
+		for (int i = 0; i < mVertexBuffer.size(); ++i)
 		{
-			bound.minimum = Minimum(bound.minimum, mVertexBuffer[i].Position);
-			bound.maximum = Maximum(bound.maximum, mVertexBuffer[i].Position);
-		}
-
-		mBSPTree.Build(bound, 8);
-
-		for (int i = 0; i < mTriBuffer.size(); ++i)
-		{
-			bool hr = _addTri(mBSPTree.RootNode(), i);
-
-			assert(hr != NULL);
+			heights[i] = mVertexBuffer[i].Position.y;
 		}
+		mHeightMip.Build(heights, mDesc.GridCount, mDesc.Position, mDesc.GridSize);
 	}
 
 	const Vertex & Terrain::_getVertex(int i)
@@ -171,9 +140,28 @@ namespace LFX {
 		return mVertexBuffer[i];
 	}
 
-	const Triangle & Terrain::_getTriangle(int i)
+	Triangle Terrain::_getTriangle(int i)
 	{
-		return mTriBuffer[i];
+		const int cell = i / 2;
+		const int row = (cell / mDesc.GridCount.x) * mDesc.VertexCount.x;
+		const int row_n = row + mDesc.VertexCount.x;
+		const int x = cell % mDesc.GridCount.x;
+
+		Triangle t;
+		if (i % 2 == 0)
+		{
+			t.Index0 = row + x;
+			t.Index1 = row + x + 1;
+			t.Index2 = row_n + x;
+		}
+		else
+		{
+			t.Index0 = row_n + x;
+			t.Index1 = row + x + 1;
+			t.Index2 = row_n + x + 1;
+		}
+
+		return t;
 	}
 
 	const Vertex & Terrain::_getVertex(int i, int j)
@@ -294,17 +282,14 @@ namespace LFX {
 		return true;
 	}
 
-	void Terrain::_rayCheckImp(Contact & contract, BSPTree<int>::Node * node, const Ray & ray, float length)
+	void Terrain::_rayCheckCell(Contact & contract, int x, int z, const Ray & ray, float length)
 	{
 		float dist = 0;
 
-		if (!Intersect(ray, &dist, node->aabb) || dist >= contract.td || dist >= length)
-			return ;
-
-		for (int i = 0; i < node->elems.size(); ++i)
+		const int cell = z * mDesc.GridCount.x + x;
+		for (int triIndex = cell * 2; triIndex < cell * 2 + 2; ++triIndex)
 		{
-			int triIndex = node->elems[i];
-			const Triangle & triangle = mTriBuffer[triIndex];
+			const Triangle triangle = _getTriangle(triIndex);
 
 			const Float3 & a = mVertexBuffer[triangle.Index0].Position;
 			const Float3 & b = mVertexBuffer[triangle.Index1].Position;
@@ -326,32 +311,26 @@ namespace LFX {
 				Vertex::Lerp(contract.vhit, v0, v1, v2, tu, tv);
 			}
 		}
-
-		if (node->child[0] != NULL)
-			_rayCheckImp(contract, node->child[0], ray, length);
-
-		if (node->child[1] != NULL)
-			_rayCheckImp(contract, node->child[1], ray, length);
 	}
 
 	void Terrain::RayCheck(Contact & contract, const Ray & ray, float length)
 	{
-		assert(mBSPTree.RootNode() != NULL);
+		assert(mHeightMip.Valid());
 
-		_rayCheckImp(contract, mBSPTree.RootNode(), ray, length);
+		mHeightMip.RayCheck(ray, std::min(contract.td, length), [&](int x, int z) {
+			_rayCheckCell(contract, x, z, ray, length);
+			return std::min(contract.td, length);
+		});
 	}
 
-	bool Terrain::_occludedImp(BSPTree<int>::Node * node, const Ray & ray, float length)
+	bool Terrain::_occludedCell(int x, int z, const Ray & ray, float length)
 	{
 		float dist = 0;
 
-		if (!Intersect(ray, &dist, node->aabb) || dist >= length)
-			return false;
-
-		for (int i = 0; i < node->elems.size(); ++i)
+		const int cell = z * mDesc.GridCount.x + x;
+		for (int triIndex = cell * 2; triIndex < cell * 2 + 2; ++triIndex)
 		{
-			int triIndex = node->elems[i];
-			const Triangle & triangle = mTriBuffer[triIndex];
+			const Triangle triangle = _getTriangle(triIndex);
 
 			const Float3 & a = mVertexBuffer[triangle.Index0].Position;
 			const Float3 & b = mVertexBuffer[triangle.Index1].Position;
@@ -362,47 +341,41 @@ namespace LFX {
 				return true;
 		}
 
-		if (node->child[0] != NULL && _occludedImp(node->child[0], ray, length))
-			return true;
-
-		if (node->child[1] != NULL && _occludedImp(node->child[1], ray, length))
-			return true;
-
 		return false;
 	}
 
 	bool Terrain::Occluded(const Ray & ray, float length)
 	{
-		assert(mBSPTree.RootNode() != NULL);
+		assert(mHeightMip.Valid());
 
-		return _occludedImp(mBSPTree.RootNode(), ray, length);
+		return mHeightMip.Occluded(ray, length, [&](int x, int z) {
+			return _occludedCell(x, z, ray, length);
+		});
 	}
 
-	bool Terrain::_addTri(BSPTree<int>::Node * node, int t)
+	int Terrain::NumOfLightingTiles()
 	{
-		const Triangle & triangle = mTriBuffer[t];
-
-		const Float3 & a = mVertexBuffer[triangle.Index0].Position;
-		const Float3 & b = mVertexBuffer[triangle.Index1].Position;
-		const Float3 & c = mVertexBuffer[triangle.Index2].Position;
+		const int mapSize = mDesc.LMapSize - Terrain::kLMapBorder * 2;
+		const int tiles = (mapSize + ILBakerRaytrace::TileSize - 1) / ILBakerRaytrace::TileSize;
 
-		if (node->aabb.Contain(a) && node->aabb.Contain(b) && node->aabb.Contain(c))
-		{
-			if (node->child[0] != NULL && _addTri(node->child[0], t))
-				return true;
-
-			if (node->child[1] != NULL && _addTri(node->child[1], t))
-				return true;
-
-			node->elems.push_back(t);
-
-			return true;
-		}
+		return tiles * tiles;
+	}
 
-		return false;
+	Rectangle<int> Terrain::GetLightingTile(int tile)
+	{
+		const int tileSize = ILBakerRaytrace::TileSize;
+		const int mapSize = mDesc.LMapSize - Terrain::kLMapBorder * 2;
+		const int tiles = (mapSize + tileSize - 1) / tileSize;
+
+		Rectangle<int> rect;
+		rect.x = (tile % tiles) * tileSize;
+		rect.y = (tile / tiles) * tileSize;
+		rect.w = std::min(tileSize, mapSize - rect.x);
+		rect.h = std::min(tileSize, mapSize - rect.y);
+		return rect;
 	}
 
-	void Terrain::CalcuDirectLighting(int xblock, int yblock, const std::vector<Light *> & lights)
+	void Terrain::CalcuDirectLighting(int xblock, int yblock, int tile, const std::vector<Light *> & lights)
 	{
 		if (World::Instance()->GetSetting()->Selected) return;
 
@@ -412,14 +385,17 @@ namespace LFX {
 		int sx = mapSize * xblock;
 		int sy = mapSize * yblock;
 		auto* lmap = mLightingMap[yblock * mDesc.BlockCount.x + xblock];
+		const Rectangle<int> rect = GetLightingTile(tile);
+		const int samples = msaa * msaa;
 
-		for (int line = 0; line < mapSize; ++line)
+		// sample all texels of the tile first, the shadow rays of each light are traced in batches
+		std::vector<Vertex> verts(rect.w * rect.h * samples);
+		for (int line = rect.y; line < rect.bottom(); ++line)
 		{
 			int j = sy + line;
-			for (int i = sx; i < sx + mapSize; ++i)
+			for (int i = sx + rect.x; i < sx + rect.right(); ++i)
 			{
-				float shadowMask = 1.0f;
-				Float3 color(0, 0, 0);
+				Vertex* texelVerts = &verts[((line - rect.y) * rect.w + (i - sx - rect.x)) * samples];
 
 				for (int y = 0; y < msaa; ++y)
 				{
@@ -428,7 +404,7 @@ namespace LFX {
 						float u = (i + x / (float)msaa) / (mMapSizeU - 1);
 						float v = (j + y / (float)msaa) / (mMapSizeV - 1);
 
-						Vertex p;
+						Vertex& p = texelVerts[y * msaa + x];
 						p.Position.x = u * mDesc.Dimension.x;
 						p.Position.z = v * mDesc.Dimension.y;
 						p.UV = Float2(0, 0);
@@ -437,15 +413,35 @@ namespace LFX {
 						GetHeightAt(p.Position.y, p.Position.x, p.Position.z);
 						GetNormalAt(p.Normal, p.Position.x, p.Position.z);
 						p.Position += Float3(mDesc.Position.x, 0, mDesc.Position.z);
-
-						for (int l = 0; l < lights.size(); ++l)
-						{
-							float mask = 1.0f;
-							color += _doDirectLighting(p, lights[l], mask);
-							shadowMask += mask;
-						}
 					}
 				}
+			}
+		}
+
+		const int count = (int)verts.size();
+		std::vector<Float3> colors(count, Float3(0, 0, 0));
+		std::vector<float> shadowMasks(count, 1.0f);
+		std::vector<const Material*> mtls(count, &mMaterial);
+		for (int l = 0; l < lights.size(); ++l)
+		{
+			CalcDirectLightingBatch(&colors[0], &shadowMasks[0], &verts[0], &mtls[0], count,
+				lights[l], true, LFX_MESH | LFX_TERRAIN);
+		}
+
+		for (int line = rect.y; line < rect.bottom(); ++line)
+		{
+			int j = sy + line;
+			for (int i = sx + rect.x; i < sx + rect.right(); ++i)
+			{
+				const int first = ((line - rect.y) * rect.w + (i - sx - rect.x)) * samples;
+
+				float shadowMask = 0.0f;
+				Float3 color(0, 0, 0);
+				for (int k = 0; k < samples; ++k)
+				{
+					color += colors[first + k];
+					shadowMask += shadowMasks[first + k];
+				}
 
 				color /= (float)msaa * msaa;
 				shadowMask /= (float)msaa * msaa;
@@ -459,7 +455,7 @@ namespace LFX {
 		}
 	}
 
-	void Terrain::CalcuIndirectLighting(int xblock, int yblock)
+	void Terrain::CalcuIndirectLighting(int xblock, int yblock, int tile)
 	{
 		if (World::Instance()->GetSetting()->Selected) return;
 
@@ -472,37 +468,21 @@ namespace LFX {
 
 		int sx = mapSize * xblock;
 		int sy = mapSize * yblock;
-		std::vector<RVertex> rchart(mapSize * msaa * mapSize * msaa);
+		const Rectangle<int> rect = GetLightingTile(tile);
+		std::vector<RVertex> rchart(rect.w * msaa * rect.h * msaa);
 
 		int index = 0;
-		for (int l = 0; l < mapSize; ++l)
+		for (int l = rect.y; l < rect.bottom(); ++l)
 		{
 			int j = sy + l;
-			for (int i = sx; i < sx + mapSize; ++i)
+			for (int i = sx + rect.x; i < sx + rect.right(); ++i)
 			{
 				for (int y = 0; y < msaa; ++y)
 				{
 					for (int x = 0; x < msaa; ++x)
 					{
-						float u = (i + x / (float)msaa) / (mMapSizeU - 1);
-						float v = (j + y / (float)msaa) / (mMapSizeV - 1);
-
 						RVertex p;
-						p.Position.x = u * mDesc.Dimension.x;
-						p.Position.z = v * mDesc.Dimension.y;
-						p.Tangent = Float3(1, 0, 0);
-						p.Binormal = Float3(0, 0, 1);
-						p.UV = Float2(0, 0);
-						p.LUV = Float2(0, 0);
-						p.MaterialId = 0;
-
-						GetHeightAt(p.Position.y, p.Position.x, p.Position.z);
-						GetNormalAt(p.Normal, p.Position.x, p.Position.z);
-
-						p.Position += Float3(mDesc.Position.x, 0, mDesc.Position.z);
-						p.Binormal = Float3::Cross(p.Normal, p.Tangent);
-						p.Tangent = Float3::Cross(p.Binormal, p.Normal);
-
+						_getTexelVertex(p, i + x / (float)msaa, j + y / (float)msaa);
 						rchart[index++] = p;
 					}
 				}
@@ -511,12 +491,14 @@ namespace LFX {
 
 		//
 		ILBakerRaytrace baker;
-		baker.Run(this, mapSize * msaa, mapSize * msaa, rchart);
+		baker.Run(this, mapSize * msaa, mapSize * msaa, rchart,
+			Rectangle<int>(rect.x * msaa, rect.y * msaa, rect.w * msaa, rect.h * msaa));
 
 		auto* lmap = mLightingMap[yblock * mDesc.BlockCount.x + xblock];
-		for (int j = 0; j < mapSize; ++j)
+		auto& indirectMap = mIndirectMaps[yblock * mDesc.BlockCount.x + xblock];
+		for (int j = 0; j < rect.h; ++j)
 		{
-			for (int i = 0; i < mapSize; ++i)
+			for (int i = 0; i < rect.w; ++i)
 			{
 				Float3 color = Float3(0, 0, 0);
 				for (int y = 0; y < msaa; ++y)
@@ -526,14 +508,20 @@ namespace LFX {
 						int u = i * msaa + x;
 						int v = j * msaa + y;
 
-						color.x += baker._ctx.BakeOutput[v * mapSize * msaa + u].x;
-						color.y += baker._ctx.BakeOutput[v * mapSize * msaa + u].y;
-						color.z += baker._ctx.BakeOutput[v * mapSize * msaa + u].z;
+						color.x += baker._ctx.BakeOutput[v * rect.w * msaa + u].x;
+						color.y += baker._ctx.BakeOutput[v * rect.w * msaa + u].y;
+						color.z += baker._ctx.BakeOutput[v * rect.w * msaa + u].z;
 					}
 				}
 				color /= (float)msaa * msaa;
 
-				auto& outColor = lmap[(j - 0) * mapSize + (i - 0)];
+				// the denoised block is added in PostProcess()
+				if (!indirectMap.empty()) {
+					indirectMap[(rect.y + j) * mapSize + (rect.x + i)] = Float4(color.x, color.y, color.z, 1);
+					continue;
+				}
+
+				auto& outColor = lmap[(rect.y + j) * mapSize + (rect.x + i)];
 				outColor.Diffuse.x += color.x;
 				outColor.Diffuse.y += color.y;
 				outColor.Diffuse.z += color.z;
@@ -637,32 +625,12 @@ namespace LFX {
 		}
 	}
 
-	Float3 Terrain::_doDirectLighting(const Vertex & v, Light * pLight, float& shadowMask)
-	{
-		float kl = 0;
-		Float3 color;
-
-		if (pLight->DirectScale > 0 || pLight->SaveShadowMask)
-		{
-			World::Instance()->GetShader()->DoLighting(
-				color, kl, Float3(0, 0, 0), v, pLight, &mMaterial, false, false
-			);
-			if (kl >= 0 && pLight->CastShadow)
-			{
-				float s = CalcShadowMask(v.Position, pLight, LFX_MESH | LFX_TERRAIN);
-				kl *= s;
-				color *= s;
-			}
-		}
-
-		return kl > 0 ? color * pLight->DirectScale : Float3(0, 0, 0);
-	}
-
-	void Terrain::CalcuAmbientOcclusion(int xblock, int yblock)
+	void Terrain::CalcuAmbientOcclusion(int xblock, int yblock, int tile)
 	{
 		if (World::Instance()->GetSetting()->Selected) return;
 
 		AOBaker baker;
+		baker.SetSeed(tile);
 
 		int mapSize = mDesc.LMapSize - Terrain::kLMapBorder * 2;
 		int msaa = World::Instance()->GetSetting()->MSAA;
@@ -671,10 +639,12 @@ namespace LFX {
 		int sy = mapSize * yblock;
 
 		auto* lmap = mLightingMap[yblock * mDesc.BlockCount.x + xblock];
-		for (int l = 0; l < mapSize; ++l)
+		auto& indirectMap = mIndirectMaps[yblock * mDesc.BlockCount.x + xblock];
+		const Rectangle<int> rect = GetLightingTile(tile);
+		for (int l = rect.y; l < rect.bottom(); ++l)
 		{
 			int j = sy + l;
-			for (int i = sx; i < sx + mapSize; ++i)
+			for (int i = sx + rect.x; i < sx + rect.right(); ++i)
 			{
 				Float3 color = Float3(0, 0, 0);
 
@@ -682,42 +652,188 @@ namespace LFX {
 				{
 					for (int x = 0; x < msaa; ++x)
 					{
-						float u = (i + x / (float)msaa) / (mMapSizeU - 1);
-						float v = (j + y / (float)msaa) / (mMapSizeV - 1);
-
 						RVertex p;
-						p.Position.x = u * mDesc.Dimension.x;
-						p.Position.z = v * mDesc.Dimension.y;
-						p.Tangent = Float3(1, 0, 0);
-						p.Binormal = Float3(0, 0, 1);
-						p.UV = Float2(0, 0);
-						p.LUV = Float2(0, 0);
-						p.MaterialId = 0;
+						_getTexelVertex(p, i + x / (float)msaa, j + y / (float)msaa);
 
-						GetHeightAt(p.Position.y, p.Position.x, p.Position.z);
-						GetNormalAt(p.Normal, p.Position.x, p.Position.z);
-
-						p.Position += Float3(mDesc.Position.x, 0, mDesc.Position.z);
-						p.Binormal = Float3::Cross(p.Normal, p.Tangent);
-						p.Tangent = Float3::Cross(p.Binormal, p.Normal);
+						// the heightfield is covered by the horizon map, only the meshes are traced
+						const float terrainOcc = _getHorizonOcclusion(xblock, yblock,
+							p.Position.x - mDesc.Position.x, p.Position.z - mDesc.Position.z);
+						const float meshOcc = baker.CalcOcclusion(p, LFX_MESH, this);
 
-						color += baker.Calc(p, LFX_MESH, this);
+						color += baker.ToColor(1 - (1 - terrainOcc) * (1 - meshOcc));
 					}
 				}
 
 				color /= (float)msaa * msaa;
 
-				auto& outColor = lmap[(j - 0) * mapSize + (i - 0)];
+				const int index = (j - sy) * mapSize + (i - sx);
+				auto& outColor = lmap[index];
 				outColor.Diffuse.x *= color.x;
 				outColor.Diffuse.y *= color.y;
 				outColor.Diffuse.z *= color.z;
 				outColor.AO = (color.x + color.y + color.z) / 3.0f;
+
+				// the indirect lighting of a denoised block is not in the lighting map yet
+				if (!indirectMap.empty()) {
+					indirectMap[index].x *= color.x;
+					indirectMap[index].y *= color.y;
+					indirectMap[index].z *= color.z;
+				}
+			}
+		}
+	}
+
+	void Terrain::_calcuHorizonMap(int xblock, int yblock)
+	{
+		const float radius = World::Instance()->GetSetting()->AORadius;
+		const float hr = radius / 2;
+		const int grids = mDesc.GridCount.x / mDesc.BlockCount.x;
+		const int steps = Clamp<int>((int)std::ceil(radius / mDesc.GridSize), 1, kMaxHorizonSteps);
+		const float stepLength = radius / steps;
+
+		Float2 dirs[kHorizonDirections];
+		for (int d = 0; d < kHorizonDirections; ++d) {
+			const float angle = Pi2 * (d + 0.5f) / kHorizonDirections;
+			dirs[d] = Float2(std::cos(angle), std::sin(angle));
+		}
+
+		auto& horizonMap = mHorizonMaps[yblock * mDesc.BlockCount.x + xblock];
+		horizonMap.resize((grids + 1) * (grids + 1));
+		for (int j = 0; j <= grids; ++j)
+		{
+			for (int i = 0; i <= grids; ++i)
+			{
+				const int gx = std::min(xblock * grids + i, mDesc.VertexCount.x - 1);
+				const int gz = std::min(yblock * grids + j, mDesc.VertexCount.y - 1);
+				const Float3 & p = _getPosition(gx, gz);
+				const Float3 & n = _getNormal(gx, gz);
+
+				// the fraction of a cosine weighted hemisphere below an horizon of elevation h is sin(h)^2,
+				// the sweep keeps the highest one of every direction
+				float occlusion = 0;
+				for (int d = 0; d < kHorizonDirections; ++d)
+				{
+					float dirOcc = 0;
+					for (int s = 1; s <= steps; ++s)
+					{
+						const float dx = dirs[d].x * stepLength * s;
+						const float dz = dirs[d].y * stepLength * s;
+
+						float h = 0;
+						if (!GetHeightAt(h, gx * mDesc.GridSize + dx, gz * mDesc.GridSize + dz))
+							break;
+
+						const Float3 w = Float3(dx, h - p.y, dz);
+						const float dist = w.len();
+						const float sinH = w.dot(n) / dist;
+						if (sinH <= 0)
+							continue;
+
+						float kd = (dist <= hr) ? 1.0f : (1 - std::min((dist - hr) / (radius - hr), 1.0f));
+						dirOcc = std::max(dirOcc, sinH * sinH * kd);
+					}
+
+					occlusion += dirOcc;
+				}
+
+				horizonMap[j * (grids + 1) + i] = occlusion / kHorizonDirections;
 			}
 		}
 	}
 
+	float Terrain::_getHorizonOcclusion(int xblock, int yblock, float x, float z)
+	{
+		const auto& horizonMap = mHorizonMaps[yblock * mDesc.BlockCount.x + xblock];
+		if (horizonMap.empty())
+			return 0;
+
+		const int grids = mDesc.GridCount.x / mDesc.BlockCount.x;
+		const float fx = Clamp<float>(x / mDesc.GridSize - xblock * grids, 0.0f, (float)grids);
+		const float fz = Clamp<float>(z / mDesc.GridSize - yblock * grids, 0.0f, (float)grids);
+
+		const int ix0 = std::min((int)fx, grids - 1);
+		const int iz0 = std::min((int)fz, grids - 1);
+		const float dx = fx - ix0;
+		const float dz = fz - iz0;
+
+		const float a = horizonMap[iz0 * (grids + 1) + ix0];
+		const float b = horizonMap[iz0 * (grids + 1) + ix0 + 1];
+		const float c = horizonMap[(iz0 + 1) * (grids + 1) + ix0];
+		const float d = horizonMap[(iz0 + 1) * (grids + 1) + ix0 + 1];
+
+		return (a * (1 - dx) + b * dx) * (1 - dz) + (c * (1 - dx) + d * dx) * dz;
+	}
+
+	void Terrain::_getTexelVertex(RVertex& p, float u, float v)
+	{
+		u /= (mMapSizeU - 1);
+		v /= (mMapSizeV - 1);
+
+		p.Position.x = u * mDesc.Dimension.x;
+		p.Position.z = v * mDesc.Dimension.y;
+		p.Tangent = Float3(1, 0, 0);
+		p.Binormal = Float3(0, 0, 1);
+		p.UV = Float2(0, 0);
+		p.LUV = Float2(0, 0);
+		p.MaterialId = 0;
+
+		GetHeightAt(p.Position.y, p.Position.x, p.Position.z);
+		GetNormalAt(p.Normal, p.Position.x, p.Position.z);
+
+		p.Position += Float3(mDesc.Position.x, 0, mDesc.Position.z);
+		p.Binormal = Float3::Cross(p.Normal, p.Tangent);
+		p.Tangent = Float3::Cross(p.Binormal, p.Normal);
+	}
+
+	void Terrain::BeginLighting(int xblock, int yblock)
+	{
+		const auto* settings = World::Instance()->GetSetting();
+		auto& indirectMap = mIndirectMaps[yblock * mDesc.BlockCount.x + xblock];
+		if (settings->Denoise && settings->GIScale > 0 && !settings->Selected) {
+			const int mapSize = mDesc.LMapSize - Terrain::kLMapBorder * 2;
+			indirectMap.assign(mapSize * mapSize, Float4(0, 0, 0, 0));
+		}
+		else {
+			indirectMap = std::vector<Float4>();
+		}
+
+		if (settings->AOLevel > 0 && settings->AORadius > 0 && !settings->Selected) {
+			_calcuHorizonMap(xblock, yblock);
+		}
+	}
+
 	void Terrain::PostProcess(int xblock, int yblock)
 	{
+		auto& indirectMap = mIndirectMaps[yblock * mDesc.BlockCount.x + xblock];
+		if (!indirectMap.empty()) {
+			const int mapSize = mDesc.LMapSize - Terrain::kLMapBorder * 2;
+			const int sx = mapSize * xblock;
+			const int sy = mapSize * yblock;
+
+			std::vector<RVertex> gbuffer(mapSize * mapSize);
+			for (int j = 0; j < mapSize; ++j)
+			{
+				for (int i = 0; i < mapSize; ++i)
+				{
+					_getTexelVertex(gbuffer[j * mapSize + i], (float)(sx + i), (float)(sy + j));
+				}
+			}
+
+			Denoiser::Run(&indirectMap[0], &gbuffer[0], mapSize, mapSize, World::Instance()->GetSetting()->DenoiseIterations);
+
+			auto* lmap = mLightingMap[yblock * mDesc.BlockCount.x + xblock];
+			for (int i = 0; i < mapSize * mapSize; ++i)
+			{
+				lmap[i].Diffuse.x += indirectMap[i].x;
+				lmap[i].Diffuse.y += indirectMap[i].y;
+				lmap[i].Diffuse.z += indirectMap[i].z;
+			}
+
+			indirectMap = std::vector<Float4>();
+		}
+
+		mHorizonMaps[yblock * mDesc.BlockCount.x + xblock] = std::vector<float>();
+
 #if 0
 		Float4* lmap = mLightingMap[yblock * mDesc.BlockCount.x + xblock];
 		int mapSize = mDesc.LMapSize - Terrain::kLMapBorder * 2;
@@ -1,9 +1,10 @@
 #pragma once
 
-#include "LFX_BSP.h"
+#include "LFX_HeightMip.h"
 #include "LFX_Types.h"
 #include "LFX_Entity.h"
 #include "LFX_Light.h"
+#include "LFX_Rasterizer.h"
 
 namespace LFX {
 
@@ -11,7 +12,10 @@ namespace LFX {
 	{
 	public:
 		enum {
-			kLMapBorder = 0
+			kLMapBorder = 0,
+			// horizon sweeps of the ambient occlusion
+			kHorizonDirections = 16,
+			kMaxHorizonSteps = 64,
 		};
 
 		struct Desc
@@ -45,7 +49,9 @@ namespace LFX {
 		std::vector<bool> & _getBlockValids() { return mBlockValid; }
 
 		const Vertex & _getVertex(int i);
-		const Triangle & _getTriangle(int i);
+		// the triangles are not stored, triangle i is the half (i % 2) of grid cell (i / 2)
+		Triangle _getTriangle(int i);
+		int NumOfTriangles() const { return mDesc.GridCount.x * mDesc.GridCount.y * 2; }
 		const Vertex & _getVertex(int i, int j);
 		const Float3 & _getPosition(int i, int j);
 		const Float3 & _getNormal(int i, int j);
@@ -55,35 +61,47 @@ namespace LFX {
 		void RayCheck(Contact & contract, const Ray & ray, float length);
 		bool Occluded(const Ray & ray, float length);
 
-		void CalcuDirectLighting(int xblock, int yblock, const std::vector<Light *> & lights);
-		void CalcuIndirectLighting(int xblock, int yblock);
-		void CalcuAmbientOcclusion(int xblock, int yblock);
+		// the lighting map of a block is baked by tiles, the tiles can be calculated by different threads
+		int NumOfLightingTiles();
+		Rectangle<int> GetLightingTile(int tile);
+
+		// allocates the indirect buffer of the block when it is denoised and computes its horizon map
+		void BeginLighting(int xblock, int yblock);
+		void CalcuDirectLighting(int xblock, int yblock, int tile, const std::vector<Light *> & lights);
+		void CalcuIndirectLighting(int xblock, int yblock, int tile);
+		void CalcuAmbientOcclusion(int xblock, int yblock, int tile);
 		void PostProcess(int xblock, int yblock);
 
 		void GetLightingMap(int xBlock, int zBlock, std::vector<LightmapValue> & colors);
 		void GetBlockGeometry(int xBlock, int zBlock, Vertex * vbuff, int * ibuff);
 		LightmapValue* _getLightingMap(int xBlock, int zBlock);
 		std::vector<Vertex> & _getVertexBuffer() { return mVertexBuffer; }
-		std::vector<Triangle> & _getTriBuffer() { return mTriBuffer; }
 
 		void GetLightList(std::vector<Light *> & lights, int xBlock, int zBlock, bool forGI);
 
 	protected:
-		bool _addTri(BSPTree<int>::Node * node, int triIndex);
-		void _rayCheckImp(Contact & contract, BSPTree<int>::Node * node, const Ray & ray, float length);
-		bool _occludedImp(BSPTree<int>::Node * node, const Ray & ray, float length);
-
-		Float3 _doDirectLighting(const Vertex & v, Light * pLight, float& shadowMask);
+		// texel vertex at the lighting map coordinates (u, v) of the terrain
+		void _getTexelVertex(RVertex& p, float u, float v);
+		// occlusion of the heightfield on the grid vertices of the block
+		void _calcuHorizonMap(int xblock, int yblock);
+		// bilinear horizon occlusion at the local position (x, z)
+		float _getHorizonOcclusion(int xblock, int yblock, float x, float z);
+		// intersects the two triangles of grid cell (x, z)
+		void _rayCheckCell(Contact & contract, int x, int z, const Ray & ray, float length);
+		bool _occludedCell(int x, int z, const Ray & ray, float length);
 
 	protected:
 		Desc mDesc;
 		std::vector<Vertex> mVertexBuffer;
-		std::vector<Triangle> mTriBuffer;
-		BSPTree<int> mBSPTree;
+		HeightMip mHeightMip;
 
 		int mMapSizeU;
 		int mMapSizeV;
 		std::vector<LightmapValue*> mLightingMap;
+		// indirect lighting of the blocks being denoised, valid between BeginLighting() and PostProcess()
+		std::vector<std::vector<Float4>> mIndirectMaps;
+		// horizon occlusion of the blocks, valid between BeginLighting() and PostProcess()
+		std::vector<std::vector<float>> mHorizonMaps;
 		std::vector<bool> mBlockValid;
 
 		Material mMaterial;
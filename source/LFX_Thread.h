@@ -3,6 +3,7 @@
 #include "LFX_Types.h"
 #ifndef _WIN32
 #include <pthread.h>
+#include <sys/time.h>
 #endif
 #include <atomic>
 
@@ -10,6 +11,8 @@ namespace LFX {
 
 	class Mutex
 	{
+		friend class Condition;
+
 #ifdef _WIN32
 		CRITICAL_SECTION mSection;
 
@@ -58,6 +61,83 @@ namespace LFX {
 			pthread_mutex_unlock(&mSection);
 		}
 
+#endif
+	};
+
+	//
+	class Condition
+	{
+#ifdef _WIN32
+		CONDITION_VARIABLE mCondition;
+
+	public:
+		Condition()
+		{
+			InitializeConditionVariable(&mCondition);
+		}
+
+		~Condition()
+		{
+		}
+
+		// return false if timeout, the mutex must be locked
+		bool Wait(Mutex& mutex, float second = -1)
+		{
+			DWORD ms = second < 0 ? INFINITE : (DWORD)(second * 1000);
+			return SleepConditionVariableCS(&mCondition, &mutex.mSection, ms) != 0;
+		}
+
+		void Signal()
+		{
+			WakeConditionVariable(&mCondition);
+		}
+
+		void Broadcast()
+		{
+			WakeAllConditionVariable(&mCondition);
+		}
+
+#else
+		pthread_cond_t mCondition;
+
+	public:
+		Condition()
+		{
+			pthread_cond_init(&mCondition, NULL);
+		}
+
+		~Condition()
+		{
+			pthread_cond_destroy(&mCondition);
+		}
+
+		// return false if timeout, the mutex must be locked
+		bool Wait(Mutex& mutex, float second = -1)
+		{
+			if (second < 0) {
+				return pthread_cond_wait(&mCondition, &mutex.mSection) == 0;
+			}
+
+			timeval tv;
+			gettimeofday(&tv, NULL);
+			long long usec = tv.tv_usec + (long long)(second * 1000000);
+
+			timespec ts;
+			ts.tv_sec = tv.tv_sec + (time_t)(usec / 1000000);
+			ts.tv_nsec = (long)(usec % 1000000) * 1000;
+			return pthread_cond_timedwait(&mCondition, &mutex.mSection, &ts) == 0;
+		}
+
+		void Signal()
+		{
+			pthread_cond_signal(&mCondition);
+		}
+
+		void Broadcast()
+		{
+			pthread_cond_broadcast(&mCondition);
+		}
+
 #endif
 	};
 
@@ -74,7 +74,6 @@ namespace LFX {
 #define FLT_MAX 3.402823466e+38F
 #endif
 
-#define LFX_BVH_LEVELS 8
 
 #define UNIT_LEN 1.0f
 #define LMAP_BORDER 1
@@ -86,7 +85,16 @@ namespace LFX {
 #define SAFE_DELETE(p) if (p) { delete p; p = NULL; }
 #define SAFE_DELETE_ARRAY(p) if (p) { delete[] p; p = NULL; }
 
+// Embree 汾: Windows Ĭʹ 3rd µ Embree2, ƽ̨ɹűָ 3  4
+#ifndef LFX_EMBREE_VERSION
 #ifdef _WIN32
+#define LFX_EMBREE_VERSION 2
+#else
+#define LFX_EMBREE_VERSION 0
+#endif
+#endif
+
+#if LFX_EMBREE_VERSION > 0
 #define LFX_USE_EMBREE_SCENE
 #endif
 
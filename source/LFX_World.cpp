@@ -27,6 +27,13 @@ namespace LFX {
 	static const int LFX_FILE_VERSION_372_3 = 0x2003;
 	static const int LFX_FILE_VERSION_373 = 0x3730;
 	static const int LFX_FILE_VERSION_390 = 0x3900;
+	static const int LFX_FILE_VERSION_391 = 0x3910;
+	static const int LFX_FILE_VERSION_392 = 0x3920;
+	static const int LFX_FILE_VERSION_393 = 0x3930;
+	static const int LFX_FILE_VERSION_394 = 0x3940;
+	static const int LFX_FILE_VERSION_395 = 0x3950;
+	static const int LFX_FILE_VERSION_396 = 0x3960;
+	static const int LFX_FILE_VERSION_397 = 0x3970;
 
 	bool CheckFileVersion(int v)
 	{
@@ -34,7 +41,14 @@ namespace LFX {
 			|| v == LFX_FILE_VERSION_372_2
 			|| v == LFX_FILE_VERSION_372_3
 			|| v == LFX_FILE_VERSION_373
-			|| v == LFX_FILE_VERSION_390;
+			|| v == LFX_FILE_VERSION_390
+			|| v == LFX_FILE_VERSION_391
+			|| v == LFX_FILE_VERSION_392
+			|| v == LFX_FILE_VERSION_393
+			|| v == LFX_FILE_VERSION_394
+			|| v == LFX_FILE_VERSION_395
+			|| v == LFX_FILE_VERSION_396
+			|| v == LFX_FILE_VERSION_397;
 	}
 
 	static const int LFX_FILE_TERRAIN = 0x01;
@@ -42,9 +56,45 @@ namespace LFX {
 	static const int LFX_FILE_LIGHT = 0x03;
 	static const int LFX_FILE_SHPROBE = 0x04;
 	static const int LFX_FILE_CAMERA = 0x05;
+	static const int LFX_FILE_MESH_INSTANCE = 0x06;
+	static const int LFX_FILE_MESH_TRANSFORM = 0x07;
+	static const int LFX_FILE_PROBE_ENCODED = 0x08;
 	static const int LFX_FILE_ENVIROMENT = 0x10;
 	static const int LFX_FILE_EOF = 0x00;
 
+	static void _LoadLight(Stream& stream, Light* l, int version)
+	{
+		if (version >= LFX_FILE_VERSION_390) {
+			l->Name = stream.ReadString();
+		}
+		stream >> l->Type;
+		stream >> l->Position;
+		stream >> l->Direction;
+		stream >> l->Color;
+		stream >> l->AttenStart;
+		stream >> l->AttenEnd;
+		stream >> l->AttenFallOff;
+		stream >> l->SpotInner;
+		stream >> l->SpotOuter;
+		stream >> l->SpotFallOff;
+		stream >> l->DirectScale;
+		stream >> l->IndirectScale;
+		stream >> l->GIEnable;
+		stream >> l->CastShadow;
+		if (version >= LFX_FILE_VERSION_372_3) {
+			stream >> l->ShadowMask;
+		}
+		if (l->Type == Light::DIRECTION && l->DirectScale == 0) {
+			l->SaveShadowMask = true;
+		}
+		if (version >= LFX_FILE_VERSION_390) {
+			stream >> l->transform[0];
+			stream >> l->transform[1];
+			stream >> l->transform[2];
+			stream >> l->transform[3];
+		}
+	}
+
 	bool World::Load()
 	{
 		String filename = "tmp/lfx.in";
@@ -97,6 +147,41 @@ namespace LFX {
 		}
 		stream >> mSetting.BakeLightMap;
 		stream >> mSetting.BakeLightProbe;
+		if (version >= LFX_FILE_VERSION_391) {
+			stream >> mSetting.GIProgressive;
+			stream >> mSetting.GINoiseThreshold;
+			stream >> mSetting.GITimeBudget;
+		}
+		if (version >= LFX_FILE_VERSION_392) {
+			stream >> mSetting.GIRussianRouletteDepth;
+			stream >> mSetting.GIRussianRouletteProbability;
+		}
+		if (version >= LFX_FILE_VERSION_393) {
+			stream >> mSetting.GIIrradianceCache;
+			stream >> mSetting.GIIrradianceCacheError;
+		}
+		if (version >= LFX_FILE_VERSION_394) {
+			stream >> mSetting.GIRadianceCache;
+			stream >> mSetting.GIRadianceCacheVoxel;
+		}
+		if (version >= LFX_FILE_VERSION_395) {
+			stream >> mSetting.Denoise;
+			stream >> mSetting.DenoiseIterations;
+		}
+		if (version >= LFX_FILE_VERSION_396) {
+			stream >> mSetting.ProbeEncoding;
+			stream >> mSetting.ProbeOctahedralSize;
+			if (mSetting.ProbeEncoding < PROBE_SH_L1 || mSetting.ProbeEncoding > PROBE_OCTAHEDRAL) {
+				LOGW("Invalid probe encoding %d, use L2 sh", mSetting.ProbeEncoding);
+				mSetting.ProbeEncoding = PROBE_SH_L2;
+			}
+			mSetting.ProbeOctahedralSize = Clamp(mSetting.ProbeOctahedralSize, 2, 64);
+		}
+		if (version >= LFX_FILE_VERSION_397) {
+			stream >> mSetting.ProbeAutoPlace;
+			stream >> mSetting.ProbeSpacing;
+			stream >> mSetting.ProbePruneError;
+		}
 		// disable gamma correction
 		mSetting.Gamma = 1;
 		// Force set gi scale
@@ -246,37 +331,32 @@ namespace LFX {
 				break;
 			}
 
-			case LFX_FILE_LIGHT: {
-				Light *l = CreateLight();
-				if (version >= LFX_FILE_VERSION_390) {
-					l->Name = stream.ReadString();
-				}
-				stream >> l->Type;
-				stream >> l->Position;
-				stream >> l->Direction;
-				stream >> l->Color;
-				stream >> l->AttenStart;
-				stream >> l->AttenEnd;
-				stream >> l->AttenFallOff;
-				stream >> l->SpotInner;
-				stream >> l->SpotOuter;
-				stream >> l->SpotFallOff;
-				stream >> l->DirectScale;
-				stream >> l->IndirectScale;
-				stream >> l->GIEnable;
-				stream >> l->CastShadow;
-				if (version >= LFX_FILE_VERSION_372_3) {
-					stream >> l->ShadowMask;
-				}
-				if (l->Type == Light::DIRECTION && l->DirectScale == 0) {
-					l->SaveShadowMask = true;
-				}
-				if (version >= LFX_FILE_VERSION_390) {
-					stream >> l->transform[0];
-					stream >> l->transform[1];
-					stream >> l->transform[2];
-					stream >> l->transform[3];
+			case LFX_FILE_MESH_INSTANCE: {
+				String name = stream.ReadString();
+				bool castShadow = stream.ReadT<bool>();
+				bool receiveShadow = stream.ReadT<bool>();
+				int lmapSize = stream.ReadT<int>();
+				int source = stream.ReadT<int>();
+				// transform relative to the source mesh, row vectors
+				Mat4 transform;
+				stream.Read(&transform, sizeof(Mat4));
+
+				if (source < 0 || source >= (int)mMeshes.size() || mMeshes[source]->IsInstance()) {
+					LOGE("Mesh instance '%s' has invalid source %d", name.c_str(), source);
+					return false;
 				}
+
+				Mesh *m = CreateMesh();
+				m->SetName(name);
+				m->SetCastShadow(castShadow);
+				m->SetRecieveShadow(receiveShadow);
+				m->SetLightingMapSize(lmapSize);
+				m->SetInstance(mMeshes[source], transform);
+				break;
+			}
+
+			case LFX_FILE_LIGHT: {
+				_LoadLight(stream, CreateLight(), version);
 				break;
 			}
 
@@ -923,9 +1003,33 @@ namespace LFX {
 	void SaveLightProbes(FILE* fp)
 	{
 		const auto& probes = World::Instance()->GetSHProbes();
+		const int encoding = World::Instance()->GetSetting()->ProbeEncoding;
 
 		const int numSHProbes = probes.size();
-		if (numSHProbes > 0) {
+		if (numSHProbes > 0 && encoding != PROBE_SH_L2) {
+			// the other encodings are written with their encoding and resolution,
+			// the resolution is the coefficient count of sh and the map size of octahedral maps,
+			// radiance is 1 if the runtime has to convolve the coefficients with the cosine lobe
+			const int size = encoding == PROBE_OCTAHEDRAL
+				? World::Instance()->GetSetting()->ProbeOctahedralSize
+				: (encoding + 1) * (encoding + 1);
+			const int radiance = encoding == PROBE_SH_L3 ? 1 : 0;
+
+			fwrite(&LFX_FILE_PROBE_ENCODED, sizeof(int), 1, fp);
+			fwrite(&numSHProbes, sizeof(int), 1, fp);
+			fwrite(&encoding, sizeof(int), 1, fp);
+			fwrite(&size, sizeof(int), 1, fp);
+			fwrite(&radiance, sizeof(int), 1, fp);
+			for (int i = 0; i < probes.size(); ++i) {
+				const auto& probe = probes[i];
+				const int numCoefs = probe.coefficients.size() * 3;
+				fwrite(&probe.position, sizeof(probe.position), 1, fp);
+				fwrite(&probe.normal, sizeof(probe.normal), 1, fp);
+				fwrite(&numCoefs, sizeof(int), 1, fp);
+				fwrite((const float*)probe.coefficients.data(), numCoefs * sizeof(float), 1, fp);
+			}
+		}
+		else if (numSHProbes > 0) {
 			fwrite(&LFX_FILE_SHPROBE, sizeof(int), 1, fp);
 			fwrite(&numSHProbes, sizeof(int), 1, fp);
 			for (int i = 0; i < probes.size(); ++i) {
@@ -1004,6 +1108,7 @@ namespace LFX {
 		mCameras.clear();
 
 		SAFE_DELETE(mScene);
+		mProbePlacer.Clear();
 	}
 
 	Texture* World::LoadTexture(const String & filename)
@@ -1128,47 +1233,6 @@ namespace LFX {
 		return nullptr;
 	}
 
-	bool _World_AttachMesh(BSPTree<Mesh*>::Node* node, Mesh* mesh)
-	{
-		Aabb bound = mesh->GetBound();
-
-		if (node->aabb.Contain(bound))
-		{
-			if (node->child[0] != NULL && _World_AttachMesh(node->child[0], mesh))
-				return true;
-
-			if (node->child[1] != NULL && _World_AttachMesh(node->child[1], mesh))
-				return true;
-
-			node->elems.push_back(mesh);
-
-			return true;
-		}
-
-		return false;
-	}
-
-	Aabb _World_Optimize(BSPTree<Mesh *>::Node * node)
-	{
-		if (node->child[0] == NULL) {
-			if (node->elems.size() > 0) {
-				Aabb bounds = node->elems[0]->GetBound();
-				for (size_t i = 1; i < node->elems.size(); ++i) {
-					bounds.Merge(node->elems[i]->GetBound());
-				}
-
-				node->aabb = bounds;
-			}
-		}
-		else {
-			Aabb bounds = _World_Optimize(node->child[0]);
-			bounds.Merge(_World_Optimize(node->child[1]));
-			node->aabb = bounds;
-		}
-
-		return node->aabb;
-	}
-
 	void World::BuildScene()
 	{
 		LOGI("-: Building meshes %d", (int)mMeshes.size());
@@ -1187,6 +1251,22 @@ namespace LFX {
 			terrain->Build();
 		}
 
+		_createScene();
+		_placeProbes();
+	}
+
+	void World::_placeProbes()
+	{
+		if (mSetting.BakeLightProbe && mSetting.ProbeAutoPlace) {
+			LOGI("-: Placing light probes");
+			mProbePlacer.Place(mSHProbes);
+		}
+	}
+
+	void World::_createScene()
+	{
+		SAFE_DELETE(mScene);
+
 		//#undef LFX_USE_EMBREE_SCENE
 #ifdef LFX_USE_EMBREE_SCENE
 		LOGI("-: Building embree scene");
@@ -1196,6 +1276,159 @@ namespace LFX {
 		mScene = new Scene();
 #endif
 		mScene->Build();
+
+		mLightIndex.Build(mLights);
+
+		float voxelSize = mSetting.GIRadianceCacheVoxel;
+		if (voxelSize <= 0) {
+			Aabb bound;
+			bound.Invalid();
+			for (auto* mesh : mMeshes) {
+				bound.Merge(mesh->GetBound());
+			}
+
+			float extent = 1.0f;
+			if (!mMeshes.empty()) {
+				const Float3 size = bound.Size();
+				extent = std::max(extent, std::max(size.x, std::max(size.y, size.z)));
+			}
+			for (auto* terrain : mTerrains) {
+				extent = std::max(extent, std::max(terrain->GetDesc().Dimension.x, terrain->GetDesc().Dimension.y));
+			}
+
+			voxelSize = extent / 256;
+		}
+		mRadianceCache.SetVoxelSize(voxelSize);
+	}
+
+	bool World::LoadDelta()
+	{
+		String filename = "tmp/lfx.delta";
+
+		FileStream stream(filename.c_str());
+		if (!stream.IsOpen()) {
+			return true;
+		}
+
+		int version;
+		stream >> version;
+		if (!CheckFileVersion(version)) {
+			LOGE("file head invalid");
+			return false;
+		}
+
+		std::vector<bool> moved(mMeshes.size(), false);
+		int numMoved = 0, numLights = 0;
+
+		int ckId = 0;
+		while (stream.Read(&ckId, sizeof(int))) {
+			if (ckId == 0) {
+				break;
+			}
+
+			switch (ckId) {
+			// index of the mesh in lfx.out, transform applied after its current placement
+			case LFX_FILE_MESH_TRANSFORM: {
+				int index = stream.ReadT<int>();
+				Mat4 transform;
+				stream.Read(&transform, sizeof(Mat4));
+
+				if (index < 0 || index >= (int)mMeshes.size()) {
+					LOGE("Mesh transform has invalid mesh %d", index);
+					return false;
+				}
+
+				Mesh* mesh = mMeshes[index];
+				mesh->ApplyTransform(transform);
+				moved[index] = true;
+				++numMoved;
+
+				// the instances are placed relative to the source geometry, they keep their place
+				if (!mesh->IsInstance()) {
+					const Mat4 inv = Mat4::InverseAffine(transform);
+					for (auto* instance : mMeshes) {
+						if (instance->GetSource() == mesh) {
+							instance->SetInstance(mesh, Mat4::Multiply(inv, instance->GetTransform()));
+						}
+					}
+				}
+				break;
+			}
+
+			// index of the light, a new light is appended
+			case LFX_FILE_LIGHT: {
+				int index = stream.ReadT<int>();
+				if (index < 0 || index > (int)mLights.size()) {
+					LOGE("Light delta has invalid light %d", index);
+					return false;
+				}
+
+				Light* l = index < (int)mLights.size() ? mLights[index] : CreateLight();
+				*l = Light();
+				_LoadLight(stream, l, version);
+				++numLights;
+				break;
+			}
+
+			default:
+				LOGW("Unknown chunk %d", ckId);
+				return false;
+			};
+		}
+
+		// the transforms are relative, the delta is applied once
+		stream.Close();
+		remove(filename.c_str());
+
+		LOGI("-: Delta meshes %d, lights %d", numMoved, numLights);
+		// the index holds the lights by their range, changed and appended lights are placed again
+		if (numLights > 0) {
+			mLightIndex.Build(mLights);
+		}
+
+		if (numMoved == 0) {
+			return true;
+		}
+
+		// sources first, instances are built from them
+		for (int pass = 0; pass < 2; ++pass) {
+			for (size_t i = 0; i < mMeshes.size(); ++i) {
+				if (moved[i] && mMeshes[i]->IsInstance() == (pass == 1)) {
+					mMeshes[i]->Build();
+				}
+			}
+		}
+
+		_createScene();
+		// the probes placed for the old layout may be inside the moved meshes
+		_placeProbes();
+
+		return true;
+	}
+
+	void World::ResetLighting()
+	{
+		for (auto* mesh : mMeshes) {
+			const int size = mesh->GetLightingMapSize();
+			mesh->_getLightingMap().assign(size * size, LightmapValue());
+		}
+
+		for (auto* terrain : mTerrains) {
+			const auto& desc = terrain->GetDesc();
+			const int mapSize = desc.LMapSize - Terrain::kLMapBorder * 2;
+			for (int y = 0; y < desc.BlockCount.y; ++y) {
+				for (int x = 0; x < desc.BlockCount.x; ++x) {
+					LightmapValue* lmap = terrain->_getLightingMap(x, y);
+					std::fill(lmap, lmap + mapSize * mapSize, LightmapValue());
+				}
+			}
+		}
+
+		for (auto& probe : mSHProbes) {
+			probe.coefficients.clear();
+		}
+
+		mRadianceCache.Clear();
 	}
 
 }
\ No newline at end of file
@@ -6,8 +6,11 @@
 #include "LFX_Camera.h"
 #include "LFX_Terrain.h"
 #include "LFX_Scene.h"
+#include "LFX_LightIndex.h"
+#include "LFX_RadianceCache.h"
 #include "LFX_Shader.h"
 #include "LFX_SHBaker.h"
+#include "LFX_ProbePlacer.h"
 #include "LFX_Rasterizer.h"
 #include "LFX_Enviroment.h"
 
@@ -40,10 +43,35 @@ namespace LFX {
 			float GIScale;
 			int GISamples;
 			int GIPathLength;
+			// progressive GI: texels stop once the standard error of their mean is below
+			// GINoiseThreshold (relative), GITimeBudget is the wall clock budget in seconds (0 unlimited)
+			bool GIProgressive;
+			float GINoiseThreshold;
+			float GITimeBudget;
+			// russian roulette: after GIRussianRouletteDepth bounces a path continues with the
+			// probability min(GIRussianRouletteProbability, luminance(throughput)), -1 disables it
+			int GIRussianRouletteDepth;
+			float GIRussianRouletteProbability;
+			// irradiance cache: texels between sparse records are interpolated when the error of
+			// the records is below GIIrradianceCacheError, ignored when GIProgressive is on
+			bool GIIrradianceCache;
+			float GIIrradianceCacheError;
+			// radiance cache: path vertices after the first bounce reuse the radiance other paths
+			// left in their voxel, GIRadianceCacheVoxel is the voxel size (0 for 1/256 of the world)
+			bool GIRadianceCache;
+			float GIRadianceCacheVoxel;
 
 			float GIProbeScale;
 			int GIProbeSamples;
 			int GIProbePathLength;
+			// ProbeEncoding of the baked probes, ProbeOctahedralSize is the resolution of PROBE_OCTAHEDRAL
+			int ProbeEncoding;
+			int ProbeOctahedralSize;
+			// generates the probes from the geometry instead of the input ones, ProbeSpacing <= 0 derives
+			// the spacing from the scene size, ProbePruneError <= 0 keeps every candidate
+			bool ProbeAutoPlace;
+			float ProbeSpacing;
+			float ProbePruneError;
 
 			int AOLevel;
 			float AOStrength;
@@ -53,6 +81,9 @@ namespace LFX {
 			int Threads;
 
 			bool Filter;
+			// edge avoiding a-trous filter of the indirect lighting, DenoiseIterations passes
+			bool Denoise;
+			int DenoiseIterations;
 			bool BakeLightMap;
 			bool BakeLightProbe;
 
@@ -73,6 +104,20 @@ namespace LFX {
 				GIScale = 1.0f;
 				GISamples = 25;
 				GIPathLength = 2;
+				GIProgressive = false;
+				GINoiseThreshold = 0.02f;
+				GITimeBudget = 0;
+				GIRussianRouletteDepth = 4;
+				GIRussianRouletteProbability = 0.5f;
+				GIIrradianceCache = false;
+				GIIrradianceCacheError = 0.3f;
+				GIRadianceCache = false;
+				GIRadianceCacheVoxel = 0;
+				ProbeEncoding = PROBE_SH_L2;
+				ProbeOctahedralSize = 8;
+				ProbeAutoPlace = false;
+				ProbeSpacing = 0;
+				ProbePruneError = 0.05f;
 
 				AOLevel = 0;
 				AOStrength = 1.0f;
@@ -81,6 +126,8 @@ namespace LFX {
 
 				Threads = 1;
 				Filter = false;
+				Denoise = false;
+				DenoiseIterations = 4;
 				BakeLightMap = true;
 				BakeLightProbe = false;
 			}
@@ -96,6 +143,13 @@ namespace LFX {
 		void Save();
 		void Clear();
 
+		// Applies tmp/lfx.delta (moved meshes, changed lights) to a loaded and built world,
+		// only the moved meshes and the scene are built again. The delta file is removed once applied,
+		// no delta file is not an error.
+		bool LoadDelta();
+		// clears the baked results so the world can be baked again
+		void ResetLighting();
+
 		Shader* GetShader() { return mShader; }
 
 		Texture* LoadTexture(const String& filename);
@@ -113,10 +167,19 @@ namespace LFX {
 		const std::vector<Mesh*>& GetMeshes() const { return mMeshes; }
 		const std::vector<Light*>& GetLights() const { return mLights; }
 		const std::vector<SHProbe>& GetSHProbes() const { return mSHProbes; }
+		std::vector<SHProbe>& _getSHProbes() { return mSHProbes; }
 		const std::vector<Terrain*>& GetTerrains() const { return mTerrains; }
 
 		void BuildScene();
 		Scene* GetScene() { return mScene; }
+		const LightIndex* GetLightIndex() const { return &mLightIndex; }
+		RadianceCache* GetRadianceCache() { return &mRadianceCache; }
+		// the automatic probe placement, its candidates are pruned by the renderer
+		ProbePlacer* _getProbePlacer() { return &mProbePlacer; }
+
+	protected:
+		void _createScene();
+		void _placeProbes();
 
 	protected:
 		Settings mSetting;
@@ -129,5 +192,8 @@ namespace LFX {
 		std::vector<Terrain *> mTerrains;
 		std::vector<SHProbe> mSHProbes;
 		Scene* mScene;
+		LightIndex mLightIndex;
+		RadianceCache mRadianceCache;
+		ProbePlacer mProbePlacer;
 	};
 }
\ No newline at end of file
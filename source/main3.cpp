@@ -1,6 +1,7 @@
 #include <iostream>
 #include <set>
 #include <cstdarg>
+#include <cstring>
 #ifndef _WIN32
 #include <sys/time.h>
 #endif
@@ -20,14 +21,39 @@ enum {
 };
 
 bool GExpportGLTF = false;
+// keep the built world resident and serve successive bakes until disconnected
+bool GDaemon = false;
 std::atomic<int> GStatus(0);
 int GProgress = 0;
+// progressive bakes stream a preview of the lighting maps every few seconds
+const int GPreviewInterval = 10;
+const char* GPreviewPath = "output/preview";
 LFX::Log* GLog = NULL;
 LFX::World* GWorld = NULL;
 LFX::IRenderer* GRenderer = NULL;
+// the socket thread only posts requests, the main loop creates and deletes the renderer and the world
+std::atomic<bool> GStartRequest(false);
+std::atomic<bool> GCancelRequest(false);
+std::atomic<bool> GReloadRequest(false);
+std::atomic<bool> GShutdownRequest(false);
 
 void StartEngine(bool render)
 {
+	if (GWorld != NULL) {
+		// resident world, only the delta is loaded and the built scene is reused
+		if (GWorld->LoadDelta()) {
+			GWorld->ResetLighting();
+			GRenderer = new LFX::CRenderer;
+			GRenderer->Start();
+			GStatus = E_STARTING;
+		}
+		else {
+			GStatus = E_STOPPED;
+			LOGE("?: Load scene delta failed");
+		}
+		return;
+	}
+
 	GWorld = new LFX::World();
 	if (GExpportGLTF) {
 		GWorld->GetSetting()->LoadTexture = false;
@@ -54,6 +80,34 @@ void StartEngine(bool render)
 	}
 }
 
+// handles the requests of the socket thread, called by the main loop between its iterations
+void HandleRequests()
+{
+	if (GShutdownRequest) {
+		SAFE_DELETE(GRenderer);
+		SAFE_DELETE(GWorld);
+		GStatus = E_STOPPED;
+		return;
+	}
+
+	if (GReloadRequest.exchange(false)) {
+		// the next start loads the whole scene again
+		SAFE_DELETE(GWorld);
+	}
+
+	if (GStartRequest.exchange(false)) {
+		GProgress = 0;
+		StartEngine(true);
+	}
+
+	if (GCancelRequest.exchange(false) && GRenderer != NULL) {
+		// cancel the bake, the world stays resident
+		LOGI("Cancel baking");
+		SAFE_DELETE(GRenderer);
+		GStatus = 0;
+	}
+}
+
 time_t GetTicks()
 {
 #ifdef _WIN32
@@ -65,11 +119,16 @@ time_t GetTicks()
 #endif
 }
 
-const char* progress_format(const char* tag, int progress)
+const char* progress_format(const char* tag, int progress, int eta = -1)
 {
 	static char text[256];
 
-	sprintf(text, "%s %d%%\n", tag, progress);
+	if (eta >= 0) {
+		sprintf(text, "%s %d%% ETA %02d:%02d:%02d\n", tag, progress, eta / 3600, (eta / 60) % 60, eta % 60);
+	}
+	else {
+		sprintf(text, "%s %d%%\n", tag, progress);
+	}
 
 	return text;
 }
@@ -85,7 +144,10 @@ int remote_main(int argc, char* argv[])
 	std::string commands;
 	for (int i = 0; i < argc; ++i) {
 		commands += argv[i];
-		if (i == 1) {
+		if (strcmp(argv[i], "-daemon") == 0) {
+			GDaemon = true;
+		}
+		else if (i == 1) {
 			url = argv[i];
 		}
 
@@ -98,94 +160,136 @@ int remote_main(int argc, char* argv[])
 	h.socket()->emit("Login");
 
 	h.socket()->on("Start", [](sio::event &) {
-		if (GStatus != 0) {
+		if (GStatus != 0 || GStartRequest) {
 			LOGE("?: Start faield, the world is started");
 			return;
 		}
-		
-		GProgress = 0;
-		StartEngine(true);
+
+		GStartRequest = true;
 	});
 
 	h.socket()->on("Stop", [](sio::event &) {
-		SAFE_DELETE(GRenderer);
-		SAFE_DELETE(GWorld);
-		GStatus = E_STOPPED;
+		if (GDaemon) {
+			GCancelRequest = true;
+		}
+		else {
+			GShutdownRequest = true;
+		}
+	});
+
+	h.socket()->on("Reload", [](sio::event &) {
+		if (GStatus != 0) {
+			LOGE("?: Reload failed, the world is baking");
+			return;
+		}
+
+		GReloadRequest = true;
 	});
 
 	h.socket()->on("disconnect", [](sio::event &) {
 		LOGE("?: Disconnect");
-		SAFE_DELETE(GRenderer);
-		SAFE_DELETE(GWorld);
-		GStatus = E_STOPPED;
+		GShutdownRequest = true;
 	});
 	
-	// waiting for start
-	while (GStatus == 0) {
-		LFX::Thread::Sleep(1);
-	}
-
-	// start
-	if (GStatus == E_STARTING && GRenderer != NULL) {
-		const char* text = progress_format("Start", 0);
-		LOGI(text);
-		h.socket()->emit("Start", std::string(text));
-		GStatus = E_BAKING;
-	}
-
-	// bake
-	while (GStatus == E_BAKING && GRenderer != NULL) {
-		float kp = (GRenderer->GetProgress() + 1) / (float)(GRenderer->GetTaskCount() + 1);
-		int progress = (int)(kp * 100);
-
-		if (GProgress != progress) {
-			GProgress = progress;
+	while (1) {
+		// waiting for start
+		while (GStatus == 0) {
+			HandleRequests();
+			if (GStatus == 0) {
+				LFX::Thread::Sleep(1);
+			}
+		}
 
-			const char* text = progress_format("Build lighting", progress);
+		// start
+		if (GStatus == E_STARTING && GRenderer != NULL) {
+			const char* text = progress_format("Start", 0);
 			LOGI(text);
-			h.socket()->emit("Progress", std::string(text));
+			h.socket()->emit("Start", std::string(text));
+			GStatus = E_BAKING;
 		}
 
-#if 0
-		static time_t last_tick = GetTickCount();
-		time_t current_ticks = GetTicks();
-		if ((current_ticks - last_tick) / 1000000 > 5) {
-			h.socket()->emit("Tick");
-		}
-#endif
+		// bake
+		time_t lastPreviewTicks = GetTicks();
+		while (GStatus == E_BAKING && GRenderer != NULL) {
+			HandleRequests();
+			if (GStatus != E_BAKING) {
+				break;
+			}
 
-		GRenderer->Update();
+			float kp = GRenderer->GetProgressRatio();
+			int progress = (int)(kp * 100);
 
-		if (GRenderer->End()) {
-			if (GProgress != 100) {
-				const char* text = progress_format("Build lighting", 100);
+			if (GProgress != progress) {
+				GProgress = progress;
+
+				const char* text = progress_format("Build lighting", progress, (int)GRenderer->GetRemainingTime());
 				LOGI(text);
 				h.socket()->emit("Progress", std::string(text));
 			}
 
-			LOGI("Delete renderer");
-			SAFE_DELETE(GRenderer);
+			if (GWorld->GetSetting()->GIProgressive && (GetTicks() - lastPreviewTicks) / 1000000 >= GPreviewInterval) {
+				lastPreviewTicks = GetTicks();
+				GRenderer->SavePreview(GPreviewPath);
+				h.socket()->emit("Preview", std::string(GPreviewPath));
+			}
 
-			LOGI("Save world...");
-			GWorld->Save();
-			LOGI("Save world end.");
+#if 0
+			static time_t last_tick = GetTickCount();
+			time_t current_ticks = GetTicks();
+			if ((current_ticks - last_tick) / 1000000 > 5) {
+				h.socket()->emit("Tick");
+			}
+#endif
 
-			LOGI("Clear world...");
-			GWorld->Clear();
-			LOGI("Clear world end.");
+			GRenderer->Update();
 
-			LOGI("Emit finished");
-			h.socket()->emit("Finished");
-			
-			LOGI("Delete world");
-			SAFE_DELETE(GWorld);
-			GStatus = E_FINISHED;
+			if (GRenderer->End()) {
+				if (GProgress != 100) {
+					const char* text = progress_format("Build lighting", 100);
+					LOGI(text);
+					h.socket()->emit("Progress", std::string(text));
+				}
+
+				LOGI("Delete renderer");
+				SAFE_DELETE(GRenderer);
+
+				LOGI("Save world...");
+				GWorld->Save();
+				LOGI("Save world end.");
+
+				if (GDaemon) {
+					LOGI("Emit finished");
+					GStatus = 0;
+					h.socket()->emit("Finished");
+					break;
+				}
+
+				LOGI("Clear world...");
+				GWorld->Clear();
+				LOGI("Clear world end.");
+
+				LOGI("Emit finished");
+				h.socket()->emit("Finished");
+
+				LOGI("Delete world");
+				SAFE_DELETE(GWorld);
+				GStatus = E_FINISHED;
+			}
+		};
+
+		if (!GDaemon || GStatus == E_STOPPED) {
+			break;
 		}
-	};
+	}
 
 	LOGI("Wait to stop");
 	int time = 0;
 	while (GStatus != E_STOPPED && time < 60/*seconds*/) {
+		HandleRequests();
+		if (GStatus == E_STOPPED) {
+			break;
+		}
+
 		LFX::Thread::Sleep(5);
 		LOGI("Wait stop...");
 		time += 5;
@@ -208,13 +312,13 @@ int local_main(int argc, char* argv[])
 	StartEngine(true);
 
 	while (GRenderer != NULL) {
-		float kp = (GRenderer->GetProgress() + 1) / (float)(GRenderer->GetTaskCount() + 1);
+		float kp = GRenderer->GetProgressRatio();
 		int progress = (int)(kp * 100);
 
 		if (GProgress != progress) {
 			GProgress = progress;
 
-			const char* text = progress_format("Build lighting", progress);
+			const char* text = progress_format("Build lighting", progress, (int)GRenderer->GetRemainingTime());
 			LOGI(text);
 		}
 